@@ -0,0 +1,82 @@
+#include <utilities/imageOps.h>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <random>
+#include <vector>
+
+// Times every image op with the vector loops on and off, and checks both give the same bytes.
+
+static const unsigned int width = 2048;
+static const unsigned int height = 2048;
+static const size_t pixelCount = (size_t)width * height;
+static const int repeats = 10;
+
+static bool allMatched = true;
+
+// Runs the op once to fill the output, then times it and returns milliseconds per run
+static double timeOp(const std::function<void()> &op) {
+    op();
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < repeats; i++) {
+        op();
+    }
+    std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+    return elapsed.count() / repeats;
+}
+
+// `reset` puts the input back before each run for the ops that work in place. The copy is timed too, so their speedups are understated.
+static void benchmark(const char* name, size_t bytes, const std::function<void()> &op,
+                      const std::vector<unsigned char> &output, const std::function<void()> &reset = nullptr) {
+    auto run = [&] {
+        if (reset) reset();
+        op();
+    };
+
+    setImageOpsVectorized(false);
+    double scalarTime = timeOp(run);
+    std::vector<unsigned char> scalarOutput = output;
+
+    setImageOpsVectorized(true);
+    double vectorTime = timeOp(run);
+    bool matches = scalarOutput == output;
+    allMatched = allMatched && matches;
+
+    std::printf("%-18s %8.2f ms %8.0f MB/s   %8.2f ms %8.0f MB/s   %5.2fx  %s\n", name,
+                scalarTime, bytes / scalarTime / 1000.0, vectorTime, bytes / vectorTime / 1000.0,
+                scalarTime / vectorTime, matches ? "" : "MISMATCH");
+}
+
+int main() {
+    std::mt19937 random(1234);
+    std::vector<unsigned char> rgba(4 * pixelCount);
+    for (unsigned char &byte : rgba) {
+        byte = (unsigned char)random();
+    }
+    std::vector<unsigned char> rgb(3 * pixelCount);
+    std::memcpy(rgb.data(), rgba.data(), rgb.size());
+
+    std::vector<unsigned char> work(4 * pixelCount);
+    std::vector<unsigned char> single(pixelCount);
+    std::vector<unsigned char> half(pixelCount);
+    auto copyInput = [&] { std::memcpy(work.data(), rgba.data(), work.size()); };
+
+    std::printf("Image ops on %ux%u RGBA, %s\n", width, height, imageOpsInstructionSet());
+    std::printf("%-18s %25s   %25s   %s\n", "", "scalar", "vectorized", "speedup");
+
+    benchmark("flipRows", rgba.size(), [&] { flipRows(work.data(), 4 * width, height); }, work, copyInput);
+    benchmark("expandToRGBA 3", rgb.size(), [&] { expandToRGBA(rgb.data(), 3, pixelCount, work.data()); }, work);
+    benchmark("expandToRGBA 1", pixelCount, [&] { expandToRGBA(rgb.data(), 1, pixelCount, work.data()); }, work);
+    benchmark("extractChannel", rgba.size(), [&] { extractChannel(rgba.data(), pixelCount, 2, single.data()); }, single);
+
+    const unsigned char* channels[4] = {rgb.data(), rgb.data() + pixelCount, rgb.data() + 2 * pixelCount, nullptr};
+    benchmark("packChannels", rgba.size(), [&] { packChannels(channels, pixelCount, work.data()); }, work);
+
+    const unsigned int order[4] = {2, 2, 2, IMAGE_CHANNEL_ONE};
+    benchmark("swizzleChannels", rgba.size(), [&] { swizzleChannels(work.data(), pixelCount, order); }, work, copyInput);
+    benchmark("premultiplyAlpha", rgba.size(), [&] { premultiplyAlpha(work.data(), pixelCount); }, work, copyInput);
+    benchmark("downsample2x2", rgba.size(), [&] { downsample2x2(rgba.data(), width, height, half.data()); }, half);
+
+    return allMatched ? 0 : 1;
+}
@@ -0,0 +1,69 @@
+#include <sceneOctree.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <chrono>
+#include <cstdio>
+#include <functional>
+#include <random>
+
+// Times small sphere and ray queries on the octree against checking every node, for growing numbers of nodes
+// spread through a 2000 unit cube. The octree should stay roughly flat while the scan grows with the node count.
+
+static double timeRuns(int runs, const std::function<void()> &run) {
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < runs; i++) {
+        run();
+    }
+    std::chrono::duration<double, std::micro> elapsed = std::chrono::steady_clock::now() - start;
+    return elapsed.count() / runs;
+}
+
+int main() {
+    std::mt19937 random(1234);
+    std::uniform_real_distribution<float> coordinate(-1000, 1000), size(0.5f, 5);
+    initSceneOctree(glm::vec3(0), 1000);
+    SceneNode* root = createSceneNode(GEOMETRY);
+    std::vector<SceneNode*> nodes;
+
+    std::printf("%8s %14s %14s %14s %14s\n", "nodes", "sphere (us)", "scan (us)", "ray (us)", "frustum (us)");
+    for (size_t count : {1000, 10000, 100000, 300000}) {
+        while (nodes.size() < count) {
+            SceneNode* node = createSceneNode(GEOMETRY);
+            addChild(root, node);
+            setLocalPosition(node->transform, glm::vec3(coordinate(random), coordinate(random), coordinate(random)));
+            node->boundingRadius = size(random);
+            nodes.push_back(node);
+        }
+        updateWorldTransforms();
+        for (SceneNode* node : nodes) {
+            addToOctree(node);
+        }
+
+        std::vector<SceneNode*> results;
+        std::vector<OctreeRayHit> hits;
+        glm::vec3 center(coordinate(random), coordinate(random), coordinate(random));
+        double sphereTime = timeRuns(200, [&] {
+            results.clear();
+            querySphere(center, 20, results);
+        });
+        double scanTime = timeRuns(20, [&] {
+            results.clear();
+            for (SceneNode* node : nodes) {
+                glm::vec3 offset = glm::vec3(worldMatrix(node->transform)[3]) - center;
+                if (glm::length(offset) <= 20 + node->boundingRadius) {
+                    results.push_back(node);
+                }
+            }
+        });
+        double rayTime = timeRuns(200, [&] {
+            hits.clear();
+            queryRay(center, glm::vec3(1, 0.2f, 0.1f), 200, hits);
+        });
+        glm::mat4 viewProjection = glm::perspective(1.0f, 1.5f, 0.1f, 150.0f) * glm::lookAt(center, center + glm::vec3(0, 0, -1), glm::vec3(0, 1, 0));
+        double frustumTime = timeRuns(200, [&] {
+            results.clear();
+            queryFrustum(viewProjection, results);
+        });
+        std::printf("%8zu %14.2f %14.2f %14.2f %14.2f\n", count, sphereTime, scanTime, rayTime, frustumTime);
+    }
+    return 0;
+}
@@ -0,0 +1,77 @@
+#include <utilities/sceneFile.h>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <random>
+#include <string>
+
+// Writes a scene of 100k nodes (a few hundred roots with random trees below them), then times compiling it,
+// opening the compiled file and creating the scene nodes from it.
+
+static const int nodeCount = 100000;
+
+static double timeOnce(const std::function<void()> &run) {
+    auto start = std::chrono::steady_clock::now();
+    run();
+    std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+    return elapsed.count();
+}
+
+int main(int argc, const char* argv[]) {
+    std::string textFileName = argc > 1 ? argv[1] : "sceneFileBenchmark.scene";
+    std::string binaryFileName = textFileName.substr(0, textFileName.rfind('.')) + ".bscene";
+
+    std::mt19937 random(1234);
+    std::uniform_real_distribution<float> coordinate(-100, 100), angle(-3.1f, 3.1f);
+    {
+        std::ofstream text(textFileName);
+        for (int i = 0; i < nodeCount; i++) {
+            text << "node n" << i << (i % 4 == 0 ? " GEOMETRY_NORMAL_MAPPED" : " GEOMETRY");
+            if (i >= 300) {
+                text << " n" << random() % i;
+            }
+            text << "\n    mesh " << (i % 2 ? "sphere" : "cube")
+                 << "\n    position " << coordinate(random) << " " << coordinate(random) << " " << coordinate(random)
+                 << "\n    rotation 0 " << angle(random) << " 0\n";
+        }
+    }
+
+    double compileTime = timeOnce([&] {
+        compileScene(textFileName, binaryFileName);
+    });
+
+    SceneFile scene;
+    bool opened = false;
+    double openTime = timeOnce([&] {
+        opened = openScene(binaryFileName, scene);
+    });
+    if (!opened || scene.nodeCount != nodeCount) {
+        std::printf("Could not open the compiled scene\n");
+        return 1;
+    }
+
+    SceneResources resources;
+    resources.meshes["sphere"] = SceneMesh{1, 100, nullptr, 1, -1};
+    resources.meshes["cube"] = SceneMesh{2, 36, nullptr, 1, -1};
+    SceneNode* root = createSceneNode(GEOMETRY);
+    std::vector<SceneNode*> nodes;
+    double instantiateTime = timeOnce([&] {
+        nodes = instantiateScene(scene, root, resources);
+    });
+    double updateTime = timeOnce([&] {
+        updateWorldTransforms();
+    });
+    double destroyTime = timeOnce([&] {
+        destroySceneNode(root);
+    });
+    closeScene(scene);
+
+    std::printf("Scene of %d nodes\n", nodeCount);
+    std::printf("%-32s %8.2f ms\n", "compile text to binary", compileTime);
+    std::printf("%-32s %8.2f ms\n", "open (map and check) binary", openTime);
+    std::printf("%-32s %8.2f ms\n", "instantiate nodes", instantiateTime);
+    std::printf("%-32s %8.2f ms\n", "first world transform update", updateTime);
+    std::printf("%-32s %8.2f ms\n", "destroy all nodes", destroyTime);
+    return sceneNodeCount() == 0 ? 0 : 1;
+}
@@ -0,0 +1,99 @@
+#include <utilities/transformKernels.h>
+#define GLM_ENABLE_EXPERIMENTAL
+#include <glm/gtx/transform.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <functional>
+#include <random>
+#include <vector>
+
+// Times building local and normal matrices the old way (seven glm matrix products and an inverse),
+// with the closed form one transform at a time, and with the closed form four at a time.
+
+static const size_t transformCount = 100000;
+static const int repeats = 20;
+
+static double timeRuns(const std::function<void()> &run) {
+    run();
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < repeats; i++) {
+        run();
+    }
+    std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+    return elapsed.count() / repeats;
+}
+
+template <typename Matrix>
+static float largestDifference(const std::vector<Matrix> &a, const std::vector<Matrix> &b, int columns, int rows) {
+    float difference = 0;
+    for (size_t i = 0; i < a.size(); i++) {
+        for (int column = 0; column < columns; column++) {
+            for (int row = 0; row < rows; row++) {
+                difference = std::max(difference, std::fabs(a[i][column][row] - b[i][column][row]));
+            }
+        }
+    }
+    return difference;
+}
+
+int main() {
+    std::mt19937 random(1234);
+    std::uniform_real_distribution<float> coordinate(-100, 100), angle(-6.3f, 6.3f), scale(0.1f, 10);
+    std::vector<float> components[12];
+    for (size_t i = 0; i < transformCount; i++) {
+        for (int axis = 0; axis < 3; axis++) {
+            components[axis].push_back(coordinate(random));
+            components[3 + axis].push_back(angle(random));
+            components[6 + axis].push_back(scale(random));
+            components[9 + axis].push_back(coordinate(random) / 10);
+        }
+    }
+    TransformComponents transforms;
+    for (int axis = 0; axis < 3; axis++) {
+        transforms.position[axis] = components[axis].data();
+        transforms.rotation[axis] = components[3 + axis].data();
+        transforms.scale[axis] = components[6 + axis].data();
+        transforms.referencePoint[axis] = components[9 + axis].data();
+    }
+
+    std::vector<glm::mat4> glmMatrices(transformCount), scalarMatrices(transformCount), vectorMatrices(transformCount);
+    std::vector<glm::mat3> glmNormals(transformCount), scalarNormals(transformCount), vectorNormals(transformCount);
+
+    double glmTime = timeRuns([&] {
+        for (size_t i = 0; i < transformCount; i++) {
+            glm::vec3 position(components[0][i], components[1][i], components[2][i]);
+            glm::vec3 rotation(components[3][i], components[4][i], components[5][i]);
+            glm::vec3 scaling(components[6][i], components[7][i], components[8][i]);
+            glm::vec3 referencePoint(components[9][i], components[10][i], components[11][i]);
+            glmMatrices[i] = glm::translate(position)
+                           * glm::translate(referencePoint)
+                           * glm::rotate(rotation.y, glm::vec3(0,1,0))
+                           * glm::rotate(rotation.x, glm::vec3(1,0,0))
+                           * glm::rotate(rotation.z, glm::vec3(0,0,1))
+                           * glm::scale(scaling)
+                           * glm::translate(-referencePoint);
+            glmNormals[i] = glm::mat3(glm::inverse(glm::transpose(glmMatrices[i])));
+        }
+    });
+    double scalarTime = timeRuns([&] {
+        composeTransformsScalar(transforms, nullptr, transformCount, scalarMatrices.data(), scalarNormals.data());
+    });
+    double vectorTime = timeRuns([&] {
+        composeTransforms(transforms, nullptr, transformCount, vectorMatrices.data(), vectorNormals.data());
+    });
+
+    // Positions go up to a few hundred, so differences in the last bits show up around 1e-5
+    float scalarError = std::max(largestDifference(glmMatrices, scalarMatrices, 4, 4), largestDifference(glmNormals, scalarNormals, 3, 3));
+    float vectorError = std::max(largestDifference(glmMatrices, vectorMatrices, 4, 4), largestDifference(glmNormals, vectorNormals, 3, 3));
+
+    std::printf("Local and normal matrices for %zu transforms\n", transformCount);
+    std::printf("%-24s %8.3f ms %8.1f ns/transform\n", "glm products + inverse", glmTime, 1e6 * glmTime / transformCount);
+    std::printf("%-24s %8.3f ms %8.1f ns/transform %6.2fx  max difference %g\n", "closed form", scalarTime,
+                1e6 * scalarTime / transformCount, glmTime / scalarTime, scalarError);
+    std::printf("%-24s %8.3f ms %8.1f ns/transform %6.2fx  max difference %g\n", "closed form, 4 at once", vectorTime,
+                1e6 * vectorTime / transformCount, glmTime / vectorTime, vectorError);
+
+    return scalarError < 1e-3f && vectorError < 1e-3f ? 0 : 1;
+}
@@ -1,4 +1,7 @@
 #version 430 core
+#ifdef MATERIAL_BINDLESS
+#extension GL_ARB_bindless_texture : require
+#endif
 
 in layout(location = 0) vec3 pos; // mv
 in layout(location = 1) vec3 normal;
@@ -7,36 +10,106 @@ in layout(location = 3) mat3 TBN;
 
 out vec4 color;
 
-struct LightInfo {
+// The lights that can reach this pass, same layout as GPULight in lights.cpp
+const int LIGHT_POINT = 0;
+const int LIGHT_SPOT = 1;
+const int LIGHT_DIRECTIONAL = 2;
+struct Light {
     vec3 position;
+    int type;
     vec3 color;
+    float range; // 0 for no limit
+    vec3 direction;
+    float cos_inner_angle;
+    float cos_outer_angle;
+};
+layout(std430, binding = 3) readonly buffer Lights {
+    int light_count;
+    Light lights[];
 };
-uniform LightInfo light_info[3];
-//uniform vec3 lights[3];//In gamelogic store positions of all lights and put them in a uniform after we are done updating their nodes, this one is now replaced with light_info
 uniform vec3 ball_pos;
-uniform layout(location = 6) int do_textures;
+uniform layout(location = 6) int do_textures_uniform;
 uniform layout(location = 7) int is_2d;
-uniform layout(location = 9) int do_roughness;
+uniform layout(location = 9) int do_roughness_uniform;
 uniform layout(location = 10) int is_skybox;
-uniform layout(location = 11) int do_metal_roughness;
+uniform layout(location = 11) int do_metal_roughness_uniform;
 uniform layout(location = 12) int dynamicCube;
 uniform layout(location = 8) mat4 V;
-uniform layout(location = 13) int has_normal_map;
+uniform layout(location = 13) int has_normal_map_uniform;
+
+// Drawn by the GPU culling path, the per object switches come from the object buffer through the vertex shader.
+// Same bits as GPUObjectFlags.
+uniform layout(location = 16) int gpu_driven;
+flat in layout(location = 6) int object_material;
+flat in layout(location = 7) int object_flags;
+int do_textures = gpu_driven != 0 ? int((object_flags & 1) != 0) : do_textures_uniform;
+int do_roughness = gpu_driven != 0 ? int((object_flags & 2) != 0) : do_roughness_uniform;
+int do_metal_roughness = gpu_driven != 0 ? int((object_flags & 4) != 0) : do_metal_roughness_uniform;
+int has_normal_map = gpu_driven != 0 ? int((object_flags & 8) != 0) : has_normal_map_uniform;
 
 
 layout(binding = 0) uniform sampler2D diffuseTexture;
+layout(binding = 3) uniform samplerCube cubeMap;
+layout(binding = 5) uniform samplerCube dynamicCubeMap;
+
+// Texture slots, same order as MaterialSlot
+const int DIFFUSE = 0;
+const int NORMAL_MAP = 1;
+const int ROUGHNESS = 2;
+const int METAL_ROUGHNESS = 3;
+
+#ifdef MATERIAL_TEXTURES
+// Textures are looked up through the material buffer, so nothing is bound per draw
+struct Material {
+    uvec2 handles[4]; // bindless
+    ivec4 layers[4];  // texture array, layer and the finest level in it
+};
+layout(std430, binding = 2) readonly buffer Materials {
+    Material materials[];
+};
+uniform layout(location = 14) int material_id_uniform;
+int material_id = gpu_driven != 0 ? object_material : material_id_uniform;
+layout(binding = 8) uniform sampler2DArray textureArrays[8];
+
+vec4 sampleTexture(int slot, vec2 uv) {
+    if (is_2d != 0) return texture(diffuseTexture, uv); // Overlays like text still bind their texture directly
+#ifdef MATERIAL_BINDLESS
+    uvec2 handle = materials[material_id].handles[slot];
+    if (handle == uvec2(0)) return vec4(1.0);
+    return texture(sampler2D(handle), uv);
+#else
+    ivec4 layer = materials[material_id].layers[slot];
+    if (layer.x < 0) return vec4(1.0);
+    // Streamed textures only have their coarser levels in the array until the finer ones come in
+    float lod = max(textureQueryLod(textureArrays[layer.x], uv).y, float(layer.z));
+    return textureLod(textureArrays[layer.x], vec3(uv, layer.y), lod);
+#endif
+}
+#else
 layout(binding = 1) uniform sampler2D normalMap;
 layout(binding = 2) uniform sampler2D roughnessMap;
-layout(binding = 3) uniform samplerCube cubeMap;
 layout(binding = 4) uniform sampler2D metalRoughnessMap;
-layout(binding = 5) uniform samplerCube dynamicCubeMap;
 
+vec4 sampleTexture(int slot, vec2 uv) {
+    if (slot == NORMAL_MAP) return texture(normalMap, uv);
+    if (slot == ROUGHNESS) return texture(roughnessMap, uv);
+    if (slot == METAL_ROUGHNESS) return texture(metalRoughnessMap, uv);
+    return texture(diffuseTexture, uv);
+}
+#endif
 
-vec4 diffuse_texture_color = texture(diffuseTexture, textureCoordinates);
-vec3 normal_texture_color = TBN*(texture(normalMap, textureCoordinates).xyz*2-1);
-vec3 test_normal_texture_color = texture(normalMap, textureCoordinates).xyz*2-1; // Temporary solution to TBN mystery
-vec4 roughness_texture = texture(roughnessMap, textureCoordinates);
-vec4 metal_roughness_texture = texture(metalRoughnessMap, textureCoordinates);
+
+// Normal maps may be stored with only x and y (BC5), so z is rebuilt from them
+vec3 sampleNormalMap(vec2 uv) {
+    vec2 xy = sampleTexture(NORMAL_MAP, uv).xy*2-1;
+    return vec3(xy, sqrt(max(0.0, 1.0 - dot(xy, xy))));
+}
+
+vec4 diffuse_texture_color = sampleTexture(DIFFUSE, textureCoordinates);
+vec3 normal_texture_color = TBN*sampleNormalMap(textureCoordinates);
+vec3 test_normal_texture_color = sampleNormalMap(textureCoordinates); // Temporary solution to TBN mystery
+vec4 roughness_texture = sampleTexture(ROUGHNESS, textureCoordinates);
+vec4 metal_roughness_texture = sampleTexture(METAL_ROUGHNESS, textureCoordinates);
 
 
 float rand(vec2 co) { return fract(sin(dot(co.xy, vec2(12.9898,78.233))) * 43758.5453); }
@@ -89,8 +162,9 @@ void main()
             vec3 frag_to_ball_center = ball_pos-pos;
             float hardening = 1;
 
-            for(int i = 0; i < 1; i++) { // Just process one of the lights (just loop 3 again to get the other ones)
-                vec3 frag_to_light = light_info[i].position - pos;
+            for(int i = 0; i < light_count; i++) {
+                // Directional lights are treated as very far away, so the ball still casts a shadow from them
+                vec3 frag_to_light = lights[i].type == LIGHT_DIRECTIONAL ? -lights[i].direction*10000 : lights[i].position - pos;
                 bool shadow = (length(reject(frag_to_ball_center, frag_to_light)) < ball_radius) 
                                 && (length(frag_to_light) > (length(frag_to_ball_center))+ball_radius) && (dot(frag_to_light,frag_to_ball_center) > 0);
 
@@ -99,8 +173,17 @@ void main()
 
                 if (!shadow){
                     vec3 light_dir = normalize(frag_to_light);
-                    float light_to_fragment_distance = length(pos-light_info[i].position);
+                    float light_to_fragment_distance = length(pos-lights[i].position);
                     float L = 1/(l_a + light_to_fragment_distance*l_b + pow(light_to_fragment_distance, 2)*l_c); //attenuation
+                    if (lights[i].type == LIGHT_DIRECTIONAL){
+                        L = 1;
+                    }
+                    else if (lights[i].range > 0){ // Fade out to nothing at the range, so culled lights don't pop
+                        L *= pow(clamp(1 - pow(light_to_fragment_distance/lights[i].range, 4), 0.0, 1.0), 2);
+                    }
+                    if (lights[i].type == LIGHT_SPOT){
+                        L *= smoothstep(lights[i].cos_outer_angle, lights[i].cos_inner_angle, dot(-light_dir, lights[i].direction));
+                    }
 
                     //Check for soft shadow
                     if(soft_shadow){
@@ -112,14 +195,14 @@ void main()
 
                     // See if we need to use diffuse colors of texture
                     if (do_textures != 0){
-                        diffuse_out += max(0.0, dot(normalized_normal, light_dir))*L * light_info[i].color*hardening * vec3(diffuse_texture_color);
+                        diffuse_out += max(0.0, dot(normalized_normal, light_dir))*L * lights[i].color*hardening * vec3(diffuse_texture_color);
                     }
                     else{
-                        diffuse_out += max(0.0, dot(normalized_normal, light_dir))*L * light_info[i].color*hardening;
+                        diffuse_out += max(0.0, dot(normalized_normal, light_dir))*L * lights[i].color*hardening;
                     }
                     
                     // Good ol' specular
-                    specular_out += pow(max(0.0, dot(reflect(-light_dir, normalized_normal), surface_to_eye)), sharpness_factor)*L* light_info[i].color*hardening;
+                    specular_out += pow(max(0.0, dot(reflect(-light_dir, normalized_normal), surface_to_eye)), sharpness_factor)*L* lights[i].color*hardening;
                 }
                 
             }
@@ -14,6 +14,25 @@ uniform layout(location = 5) mat3 normal_matrix;
 uniform layout(location = 6) int do_textures;
 uniform layout(location = 7) int is_2d;
 uniform layout(location = 10) int is_skybox;
+uniform layout(location = 15) vec4 uv_transform; // scale and offset into a texture atlas
+
+// Drawn by the GPU culling path: the uniforms above that differ per object come from the object buffer instead,
+// same layout as gpuCulling.cpp
+uniform layout(location = 16) int gpu_driven;
+in layout(location = 5) uint object_index; // Per instance, the draw's base instance
+struct Object {
+    mat4 model;
+    vec4 normal_matrix[3];
+    vec4 uv_transform;
+    vec4 sphere;
+    uint mesh;
+    int material_id;
+    uint flags;
+    uint passes;
+};
+layout(std430, binding = 4) readonly buffer Objects {
+    Object objects[];
+};
 
 //TODO: multiply normal_matrix with TBA matrix
 
@@ -21,14 +40,29 @@ out layout(location = 0) vec3 pos_out;
 out layout(location = 1) vec3 normal_out;
 out layout(location = 2) vec2 textureCoordinates_out;
 out layout(location = 3) mat3 TBN;
+flat out layout(location = 6) int object_material;
+flat out layout(location = 7) int object_flags;
 
 void main()
 {   
+    mat4 model = M;
+    mat3 normal_model = normal_matrix;
+    vec4 uv = uv_transform;
+    object_material = 0;
+    object_flags = 0;
+    if (gpu_driven != 0) {
+        model = objects[object_index].model;
+        normal_model = mat3(objects[object_index].normal_matrix[0].xyz, objects[object_index].normal_matrix[1].xyz, objects[object_index].normal_matrix[2].xyz);
+        uv = objects[object_index].uv_transform;
+        object_material = objects[object_index].material_id;
+        object_flags = int(objects[object_index].flags);
+    }
+
     //TBN is mostly stolen from the tutorial
     //vec3 vertexNormal_cameraspace = normal_matrix * normalize(normal_in);
-    vec3 vertexNormal_cameraspace = normal_matrix * normalize(cross(indexed_bitangents, indexed_tangents));
-    vec3 vertexTangent_cameraspace = normal_matrix * normalize(indexed_tangents);
-    vec3 vertexBitangent_cameraspace = normal_matrix * normalize(indexed_bitangents);
+    vec3 vertexNormal_cameraspace = normal_model * normalize(cross(indexed_bitangents, indexed_tangents));
+    vec3 vertexTangent_cameraspace = normal_model * normalize(indexed_tangents);
+    vec3 vertexBitangent_cameraspace = normal_model * normalize(indexed_bitangents);
 
     TBN = transpose(mat3(
         vertexTangent_cameraspace,
@@ -39,14 +73,14 @@ void main()
     if (is_skybox != 0)  {
         pos_out = position;
     } else {
-        pos_out = (V * M * vec4(position, 1.0f)).xyz;
+        pos_out = (V * model * vec4(position, 1.0f)).xyz;
     }
 
-    normal_out = normalize(normal_matrix * normal_in);
-    textureCoordinates_out = textureCoordinates_in;
+    normal_out = normalize(normal_model * normal_in);
+    textureCoordinates_out = textureCoordinates_in * uv.xy + uv.zw;
     if(is_2d == 0){
-        gl_Position = P * V * M * vec4(position, 1.0f);
+        gl_Position = P * V * model * vec4(position, 1.0f);
     } else {
-        gl_Position = M * vec4(position, 1.0f);
+        gl_Position = model * vec4(position, 1.0f);
     }
 }
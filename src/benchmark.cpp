@@ -0,0 +1,204 @@
+#include "benchmark.hpp"
+#include <utilities/profiler.h>
+#include <utilities/textureLoader.h>
+#include <utilities/timeutils.h>
+#include <glm/gtc/matrix_transform.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+static const double benchmarkTimeStep = 1.0 / 60.0;
+static const double textureWaitSeconds = 60;
+
+static CommandLineOptions benchmarkOptions;
+static unsigned int framesDone = 0;
+
+
+void beginBenchmark(const CommandLineOptions &options) {
+    benchmarkOptions = options;
+    framesDone = 0;
+
+    auto start = std::chrono::steady_clock::now();
+    while (pendingTextureLoads() > 0) {
+        std::chrono::duration<double> waited = std::chrono::steady_clock::now() - start;
+        if (waited.count() > textureWaitSeconds) {
+            std::cout << "Still waiting for " << pendingTextureLoads() << " textures, starting the benchmark anyway" << std::endl;
+            break;
+        }
+        pumpTextureUploads();
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    setFixedTimeDelta(benchmarkTimeStep);
+    std::cout << "Benchmark: " << options.benchmarkWarmupFrames << " warm-up frames, then " << options.benchmarkFrames << " measured frames" << std::endl;
+}
+
+// Once around the cat, rising and sinking a little, over 20 seconds
+glm::mat4 benchmarkView(double time) {
+    const glm::vec3 target(0, -30, -80);
+    float angle = float(time * 2 * M_PI / 20.0);
+    glm::vec3 eye = target + glm::vec3(90 * std::sin(angle), 25 + 15 * std::sin(2 * angle), 90 * std::cos(angle));
+    return glm::lookAt(eye, target, glm::vec3(0, 1, 0));
+}
+
+static double peakMemoryMegabytes() {
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS counters;
+    if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+        return -1;
+    }
+    return counters.PeakWorkingSetSize / (1024.0 * 1024.0);
+#else
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) {
+        return -1;
+    }
+#ifdef __APPLE__
+    return usage.ru_maxrss / (1024.0 * 1024.0); // Bytes
+#else
+    return usage.ru_maxrss / 1024.0; // Kilobytes
+#endif
+#endif
+}
+
+static std::string jsonString(const char* text) {
+    std::string quoted = "\"";
+    for (const char* c = text ? text : ""; *c; c++) {
+        if (*c == '"' || *c == '\\') {
+            quoted += '\\';
+        }
+        if ((unsigned char)*c >= 0x20) {
+            quoted += *c;
+        }
+    }
+    return quoted + "\"";
+}
+
+// Nearest rank
+static double percentile(const std::vector<double> &sorted, double fraction) {
+    size_t rank = (size_t)std::ceil(fraction * sorted.size());
+    return sorted[std::min(sorted.size() - 1, rank > 0 ? rank - 1 : 0)];
+}
+
+struct PassTotals {
+    double calls = 0;
+    double cpu = 0;
+    double gpu = 0;
+    bool hasGpu = false;
+};
+
+static void writeReport(unsigned long long firstFrame) {
+    finishProfiler();
+    std::vector<const ProfileFrame*> frames;
+    for (const ProfileFrame* frame : profileHistory()) {
+        if (frame->index >= firstFrame) {
+            frames.push_back(frame);
+        }
+    }
+    if (frames.empty()) {
+        std::cout << "The benchmark measured no frames" << std::endl;
+        return;
+    }
+
+    // Scopes are summed per frame by their path, so the six cube map faces count as one pass run six times
+    std::vector<double> frameTimes;
+    std::map<std::string, PassTotals> passes;
+    std::map<std::string, double> counters;
+    std::vector<std::string> paths;
+    for (const ProfileFrame* frame : frames) {
+        frameTimes.push_back(frame->cpuEnd - frame->cpuStart);
+        paths.resize(frame->events.size());
+        for (size_t i = 0; i < frame->events.size(); i++) {
+            const ProfileEvent &event = frame->events[i];
+            paths[i] = event.parent < 0 ? event.name : paths[event.parent] + "/" + event.name;
+            PassTotals &pass = passes[paths[i]];
+            pass.calls++;
+            pass.cpu += event.cpuEnd - event.cpuStart;
+            if (event.gpuStart >= 0) {
+                pass.gpu += event.gpuEnd - event.gpuStart;
+                pass.hasGpu = true;
+            }
+        }
+        for (const ProfileCounter &counter : frame->counters) {
+            counters[counter.name] += counter.value;
+        }
+    }
+    std::vector<double> sorted = frameTimes;
+    std::sort(sorted.begin(), sorted.end());
+    double total = 0;
+    for (double time : frameTimes) {
+        total += time;
+    }
+    double frameCount = frames.size();
+
+    std::ofstream file(benchmarkOptions.benchmarkReport);
+    if (!file) {
+        std::cout << "Could not write the benchmark report to " << benchmarkOptions.benchmarkReport << std::endl;
+        return;
+    }
+    file.precision(4);
+    file << std::fixed;
+    file << "{\n";
+    file << "  \"renderer\": " << jsonString((const char*)glGetString(GL_RENDERER)) << ",\n";
+    file << "  \"version\": " << jsonString((const char*)glGetString(GL_VERSION)) << ",\n";
+    file << "  \"scene\": " << jsonString(benchmarkOptions.scene.c_str()) << ",\n";
+    file << "  \"resolution\": [" << windowWidth << ", " << windowHeight << "],\n";
+    file << "  \"timeStep\": " << benchmarkTimeStep << ",\n";
+    file << "  \"warmupFrames\": " << benchmarkOptions.benchmarkWarmupFrames << ",\n";
+    file << "  \"frames\": " << frames.size() << ",\n";
+    file << "  \"frameTimeMs\": {\"mean\": " << total / frameCount << ", \"min\": " << sorted.front()
+         << ", \"p50\": " << percentile(sorted, 0.5) << ", \"p90\": " << percentile(sorted, 0.9)
+         << ", \"p95\": " << percentile(sorted, 0.95) << ", \"p99\": " << percentile(sorted, 0.99)
+         << ", \"max\": " << sorted.back() << "},\n";
+    file << "  \"passes\": [";
+    bool first = true;
+    for (const auto &pass : passes) {
+        file << (first ? "\n" : ",\n") << "    {\"name\": " << jsonString(pass.first.c_str())
+             << ", \"callsPerFrame\": " << pass.second.calls / frameCount
+             << ", \"cpuMs\": " << pass.second.cpu / frameCount;
+        if (pass.second.hasGpu) {
+            file << ", \"gpuMs\": " << pass.second.gpu / frameCount;
+        }
+        file << "}";
+        first = false;
+    }
+    file << "\n  ],\n";
+    file << "  \"countersPerFrame\": {";
+    first = true;
+    for (const auto &counter : counters) {
+        file << (first ? "" : ", ") << jsonString(counter.first.c_str()) << ": " << counter.second / frameCount;
+        first = false;
+    }
+    file << "},\n";
+    file << "  \"peakMemoryMB\": " << peakMemoryMegabytes() << "\n";
+    file << "}\n";
+
+    std::cout << "Benchmark: " << frames.size() << " frames, mean " << total / frameCount << " ms, p99 "
+              << percentile(sorted, 0.99) << " ms. Report written to " << benchmarkOptions.benchmarkReport << std::endl;
+}
+
+bool continueBenchmark() {
+    framesDone++;
+    unsigned int runLength = benchmarkOptions.benchmarkWarmupFrames + benchmarkOptions.benchmarkFrames;
+    if (framesDone < runLength) {
+        return true;
+    }
+    // The profiler counts frames from the start of the main loop, the same as we do
+    writeReport(benchmarkOptions.benchmarkWarmupFrames);
+    return false;
+}
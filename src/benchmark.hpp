@@ -0,0 +1,17 @@
+#pragma once
+
+#include <utilities/window.hpp>
+#include <glm/glm.hpp>
+
+// A fixed run for measuring performance, for --benchmark. The game steps with a fixed time step and the camera flies
+// a fixed path, so every run draws the same frames. After the warm-up frames the measured frames are profiled, and
+// the frame time percentiles, per pass times, draw counts and peak memory are written to a JSON report.
+
+// Call after initGame(). Waits for the textures the scene starts loading, so they don't land in the middle of the run.
+void beginBenchmark(const CommandLineOptions &options);
+
+// Call after every frame. Returns false once the run is over and the report is written.
+bool continueBenchmark();
+
+// Where the camera is after this many seconds of game time
+glm::mat4 benchmarkView(double time);
@@ -1,4 +1,7 @@
+#include <atomic>
 #include <chrono>
+#include <condition_variable>
+#include <mutex>
 #include <GLFW/glfw3.h>
 #include <glad/glad.h>
 #include <SFML/Audio/SoundBuffer.hpp>
@@ -15,11 +18,23 @@
 #include <fmt/format.h>
 #include "gamelogic.h"
 #include "sceneGraph.hpp"
+#include "sceneOctree.hpp"
 #define GLM_ENABLE_EXPERIMENTAL
 #include <glm/gtx/transform.hpp>
 
 #include "utilities/imageLoader.hpp"
 #include "utilities/glfont.h"
+#include "utilities/meshlets.h"
+#include "utilities/textureLoader.h"
+#include "utilities/materials.h"
+#include "utilities/textureAtlas.h"
+#include "utilities/sceneFile.h"
+#include "utilities/lights.h"
+#include "utilities/profiler.h"
+#include "utilities/frameLatency.h"
+#include "utilities/commandList.h"
+#include "utilities/gpuCulling.h"
+#include "benchmark.hpp"
 #define TINYOBJLOADER_IMPLEMENTATION
 #include <tiny_obj_loader.h>
 #include <utilities/camera.hpp>
@@ -48,10 +63,79 @@ SceneNode* catNode;
 SceneNode* stoneNode;
 
 double ballRadius = 3.0f;
-bool dynamicCubeReady = false;
 bool show_stone = true;
+
+// The dynamic cube map is only drawn again when something moved, or a texture in it arrived
+bool reflectionNeedsUpdate = true;
+unsigned int lastPendingTextureLoads = 0;
+
+void markReflectionDirty(const std::vector<TransformID> &, void*) {
+    reflectionNeedsUpdate = true;
+}
 //bool cat_rot_pos = true;
 
+// Textures and materials of destroyed nodes. Nodes are destroyed by the simulation, but these belong to the render
+// thread, which lets go of them once the frame it is drawing (which may still show the node) is done.
+std::mutex releasedMutex;
+std::vector<TextureHandle> releasedTextures;
+std::vector<int> releasedMaterials;
+
+void forgetSceneNode(SceneNode* node) {
+    removeFromOctree(node);
+    if (node->lightID >= 0) {
+        destroyLight(node->lightID);
+    }
+    std::lock_guard<std::mutex> lock(releasedMutex);
+    for (int handle : node->textureHandles) {
+        if (handle != -1) {
+            releasedTextures.push_back(handle);
+        }
+    }
+    if (node->materialID >= 0) {
+        releasedMaterials.push_back(node->materialID);
+    }
+}
+
+void releaseDestroyedNodes() {
+    std::lock_guard<std::mutex> lock(releasedMutex);
+    for (TextureHandle handle : releasedTextures) {
+        releaseTexture(handle);
+    }
+    for (int material : releasedMaterials) {
+        releaseMaterial(material);
+    }
+    releasedTextures.clear();
+    releasedMaterials.clear();
+}
+
+// Nodes the last preparePass() found inside the view have their cullPass set to this
+unsigned int cullPass = 0;
+std::vector<SceneNode*> visibleNodes;
+
+// Set when the plain objects are culled and drawn on the GPU, see gpuCulling.h
+bool gpuCullingEnabled = false;
+
+// Meshlet meshes stay on the CPU path, which culls their clusters
+bool drawnOnGPU(const SceneNode* node) {
+    return gpuCullingEnabled && node->gpuMesh >= 0 && !node->isSkybox && node->meshlets == nullptr
+        && (node->nodeType == GEOMETRY || node->nodeType == GEOMETRY_NORMAL_MAPPED);
+}
+
+// The skybox is always drawn and 2D geometry is in screen space, everything else is culled through the octree
+// unless the GPU culls it
+void addSceneToOctree(SceneNode* node) {
+    if (!node->isSkybox && node->nodeType != GEOMETRY_2D && !drawnOnGPU(node)) {
+        addToOctree(node);
+    }
+    for (SceneNode* child : node->children) {
+        addSceneToOctree(child);
+    }
+}
+
+// Clusters for the dense scanned meshes, shared by every node using them
+std::vector<Meshlet> catMeshlets;
+std::vector<Meshlet> stoneMeshlets;
+
 GLuint cubemap;
 GLuint framebuffer;
 GLuint depthbuffer;
@@ -83,15 +167,18 @@ bool mouseRightReleased = false;
 // Modify if you want the music to start further on in the track. Measured in seconds.
 const float debug_startTime = 0;
 double totalElapsedTime = debug_startTime;
+double previousElapsedTime = debug_startTime; // At the tick before, for drawing in between
 double gameElapsedTime = debug_startTime;
 
+// Smoothed frame time for the on-screen FPS counter
+double averageFrameTime = 0;
+
 double mouseSensitivity = 1.0;
 double lastMouseX = windowWidth / 2;
 double lastMouseY = windowHeight / 2;
 void mouseCallback(GLFWwindow* window, double x, double y) {
     int windowWidth, windowHeight;
     glfwGetWindowSize(window, &windowWidth, &windowHeight);
-    glViewport(0, 0, windowWidth, windowHeight);
 
     double deltaX = x - lastMouseX;
     double deltaY = y - lastMouseY;
@@ -107,13 +194,6 @@ void mouseCallback(GLFWwindow* window, double x, double y) {
     glfwSetCursorPos(window, windowWidth / 2, windowHeight / 2);
 }
 
-// A few lines to help you if you've never used c++ structs
-struct LightSource {
-    SceneNode *lightNode;
-    glm::vec3 lightColor;
-};
-LightSource lightSources[3];
-
 
 //For general 2d textures
 void uploadTexture(GLuint *unbound_int, PNGImage& image){
@@ -129,6 +209,30 @@ void uploadTexture(GLuint *unbound_int, PNGImage& image){
 }
 
 
+// Gives every textured node a material, so the shader can find its textures without binding them per draw.
+// The skybox and 2D nodes keep binding theirs. resolveTextures() fills in the textures every frame.
+void assignMaterials(SceneNode* node) {
+    bool hasTextures = node->textureID != -1 || node->normalMapTextureID != -1
+                       || node->roughnessMapID != -1 || node->metalRoughnessMapID != -1;
+    for (int handle : node->textureHandles) {
+        hasTextures = hasTextures || handle != -1;
+    }
+    if (hasTextures && !node->isSkybox && node->nodeType != GEOMETRY_2D) {
+        node->materialID = createMaterial();
+    }
+    for (SceneNode* child : node->children) {
+        assignMaterials(child);
+    }
+}
+
+float meshBoundingRadius(const Mesh& mesh) {
+    float radius = 0;
+    for (const glm::vec3& vertex : mesh.vertices) {
+        radius = std::max(radius, glm::length(vertex));
+    }
+    return radius;
+}
+
 //For tiny object loader, got it from Odd Erik
 Mesh loadObj(std::string filename){
     tinyobj::attrib_t attributes;
@@ -185,7 +289,7 @@ void initGame(GLFWwindow* window, CommandLineOptions gameOptions) {
     glfwSetCursorPosCallback(window, mouseCallback);
 
     shader = new Gloom::Shader();
-    shader->makeBasicShader("../res/shaders/simple.vert", "../res/shaders/simple.frag");
+    shader->makeBasicShader("../res/shaders/simple.vert", "../res/shaders/simple.frag", materialShaderDefines());
     shader->activate();
 
     // Create meshes
@@ -196,6 +300,11 @@ void initGame(GLFWwindow* window, CommandLineOptions gameOptions) {
     Mesh box_sky = cube(boxDimensions, glm::vec2(100), true, true);
     Mesh stone = loadObj("../res/textures/stone/source/final_stone.obj");
 
+    // Split the scanned meshes into meshlets, so the half facing away from the camera can be skipped
+    catMeshlets = buildMeshlets(cat);
+    stoneMeshlets = buildMeshlets(stone);
+    std::cout << fmt::format("Built {} meshlets for the cat and {} for the stone.", catMeshlets.size(), stoneMeshlets.size()) << std::endl;
+
     // Fill buffers
     unsigned int ballVAO = generateBuffer(sphere);
     unsigned int boxVAO  = generateBuffer(box);
@@ -204,87 +313,78 @@ void initGame(GLFWwindow* window, CommandLineOptions gameOptions) {
     unsigned int catVAO = generateBuffer(cat);
     unsigned int stoneVAO = generateBuffer(stone);
 
-    // Construct scene
+    // The GPU culling path draws the simple meshes from shared buffers, textures then come from the materials
+    int ballGPUMesh = -1, boxGPUMesh = -1, padGPUMesh = -1;
+    if (options.gpuCulling && materialTextureMode() == MATERIAL_TEXTURES_BOUND) {
+        std::cout << "GPU culling needs textures through the material buffer (--texture-binding arrays or bindless), culling on the CPU instead" << std::endl;
+    } else if (options.gpuCulling) {
+        ballGPUMesh = addGPUMesh(sphere);
+        boxGPUMesh = addGPUMesh(box);
+        padGPUMesh = addGPUMesh(pad);
+        initGPUCulling();
+        gpuCullingEnabled = true;
+    }
+
+    // Construct scene. The nodes come from the scene file, the meshes it names are the ones built above.
     rootNode = createSceneNode(GEOMETRY);
     charTextureNode = createSceneNode(GEOMETRY_2D);
     boxNode  = createSceneNode(GEOMETRY_NORMAL_MAPPED);
     padNode  = createSceneNode(GEOMETRY);
-    ballNode = createSceneNode(GEOMETRY);
-    ballNode2 = createSceneNode(GEOMETRY);
-    ballNode3 = createSceneNode(GEOMETRY);
-    skyboxNode = createSceneNode(GEOMETRY);
-    catNode  = createSceneNode(GEOMETRY_NORMAL_MAPPED);
-    stoneNode = createSceneNode(GEOMETRY_NORMAL_MAPPED);
-
-    lightSources[0].lightNode = createSceneNode(POINT_LIGHT);
-    lightSources[1].lightNode = createSceneNode(POINT_LIGHT);
-    lightSources[2].lightNode = createSceneNode(POINT_LIGHT);
-    
-    lightSources[0].lightNode->lightID = 0;
-    lightSources[1].lightNode->lightID = 1;
-    lightSources[2].lightNode->lightID = 2;
-
-    lightSources[0].lightColor = glm::vec3(0.1, 0.1, 0.1);
-    lightSources[1].lightColor = glm::vec3(0.0, 1.0, 0.0);
-    lightSources[2].lightColor = glm::vec3(0.0, 0.0, 1.0);
-
-    lightSources[0].lightNode->position = glm::vec3(0.0, 300.0, 0.0);
-    lightSources[1].lightNode->position = glm::vec3( 0.0, 300.0, -80.0);
-    lightSources[2].lightNode->position = glm::vec3( 0.0, 300.0, -70.0);
-
-    rootNode->children.push_back(skyboxNode);
-    //rootNode->children.push_back(boxNode);
-    //rootNode->children.push_back(padNode);
-    rootNode->children.push_back(ballNode);
-    //rootNode->children.push_back(charTextureNode);
-    //padNode->children.push_back(catNode);
-    rootNode->children.push_back(stoneNode);
-    rootNode->children.push_back(catNode);
-    rootNode->children.push_back(ballNode2);
-    rootNode->children.push_back(ballNode3);
-    
-    //rootNode->children.push_back(boxNode);
-
-    //addChild(padNode, lightSources[1].lightNode);
-    //addChild(ballNode, lightSources[1].lightNode);
-    //addChild(boxNode, lightSources[2].lightNode);
-
-    addChild(rootNode, lightSources[0].lightNode);
-    addChild(rootNode, lightSources[1].lightNode);
-    addChild(rootNode, lightSources[2].lightNode);
 
+    SceneResources sceneResources;
+    sceneResources.meshes["sphere"] = SceneMesh{(int)ballVAO, (unsigned int)sphere.indices.size(), nullptr, 1, ballGPUMesh};
+    sceneResources.meshes["box"] = SceneMesh{(int)boxVAO, (unsigned int)box.indices.size(), nullptr, 1, boxGPUMesh};
+    sceneResources.meshes["pad"] = SceneMesh{(int)padVAO, (unsigned int)pad.indices.size(), nullptr, 1, padGPUMesh};
+    sceneResources.meshes["skybox"] = SceneMesh{(int)skyboxVAO, (unsigned int)box_sky.indices.size(), nullptr, 1, -1};
+    sceneResources.meshes["cat"] = SceneMesh{(int)catVAO, (unsigned int)cat.indices.size(), &catMeshlets, meshBoundingRadius(cat), -1};
+    sceneResources.meshes["stone"] = SceneMesh{(int)stoneVAO, (unsigned int)stone.indices.size(), &stoneMeshlets, meshBoundingRadius(stone), -1};
+    // The textures decode on the loader threads, the nodes show placeholders until they are uploaded
+    sceneResources.loadTexture = [](std::string fileName, TextureUsage usage) { return loadTextureAsync(fileName, nullptr, usage); };
+    setSceneNodeDestroyedCallback(forgetSceneNode);
+
+    SceneFile scene;
+    if (!openScene(options.scene, scene)) {
+        std::cout << "Could not load the scene " << options.scene << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    std::vector<SceneNode*> sceneNodes = instantiateScene(scene, rootNode, sceneResources);
+    auto namedNode = [&](const std::string &name) {
+        int index = findSceneFileNode(scene, name);
+        if (index < 0) {
+            std::cout << "The scene " << options.scene << " has no node called " << name << std::endl;
+            exit(EXIT_FAILURE);
+        }
+        return sceneNodes[index];
+    };
+    skyboxNode = namedNode("skybox");
+    ballNode = namedNode("ball");
+    ballNode2 = namedNode("ball2");
+    ballNode3 = namedNode("ball3");
+    catNode = namedNode("cat");
+    stoneNode = namedNode("stone");
+    for (uint32_t i = 0; i < scene.nodeCount; i++) {
+        const SceneFileNode &fileNode = scene.nodes[i];
+        SceneNode* node = sceneNodes[i];
+        LightType type;
+        switch (node->nodeType) {
+            case POINT_LIGHT: type = LIGHT_POINT; break;
+            case SPOT_LIGHT: type = LIGHT_SPOT; break;
+            case DIRECTIONAL_LIGHT: type = LIGHT_DIRECTIONAL; break;
+            default: continue;
+        }
+        glm::vec3 color(fileNode.lightColor[0], fileNode.lightColor[1], fileNode.lightColor[2]);
+        node->lightID = createLight(node->transform, type, color, fileNode.lightRange);
+        setSpotAngles(node->lightID, fileNode.spotAngles[0], fileNode.spotAngles[1]);
+    }
+    closeScene(scene);
 
     boxNode->vertexArrayObjectID  = boxVAO;
     boxNode->VAOIndexCount        = box.indices.size();
+    boxNode->gpuMesh              = boxGPUMesh;
 
     padNode->vertexArrayObjectID  = padVAO;
     padNode->VAOIndexCount        = pad.indices.size();
-
-    ballNode->vertexArrayObjectID = ballVAO;
-    ballNode->VAOIndexCount       = sphere.indices.size();
-    ballNode->position            = glm::vec3(30.0, -20, -70);
-    ballNode->scale               = glm::vec3(8.0);
-
-    ballNode2->vertexArrayObjectID = ballVAO;
-    ballNode2->VAOIndexCount       = sphere.indices.size();
-    ballNode2->position            = glm::vec3(10, -20, -60);
-    ballNode2->scale               = glm::vec3(8.0);
-
-    ballNode3->vertexArrayObjectID = ballVAO;
-    ballNode3->VAOIndexCount       = sphere.indices.size();
-    ballNode3->position            = glm::vec3(10, -20, -100);
-    ballNode3->scale               = glm::vec3(8.0);
-
-    catNode->vertexArrayObjectID  = catVAO;
-    catNode->VAOIndexCount        = cat.indices.size();
-    catNode->scale                = glm::vec3(5);
-    catNode->position             = glm::vec3(0.0, -30.0, -80.0);
-    catNode->rotation             = glm::vec3(0.0, 50.0, 0.0);
-
-    stoneNode->vertexArrayObjectID  = stoneVAO;
-    stoneNode->VAOIndexCount        = stone.indices.size();
-    stoneNode->scale                = glm::vec3(20);
-    stoneNode->position             = glm::vec3(-5.0, -60.0, -75.0);
+    padNode->gpuMesh              = padGPUMesh;
     
 
     // Texture time
@@ -297,10 +397,12 @@ void initGame(GLFWwindow* window, CommandLineOptions gameOptions) {
 
     charTextureNode->vertexArrayObjectID = charmapVAO;
     charTextureNode->VAOIndexCount = charmapMesh.indices.size();
-    charTextureNode->position = glm::vec3( 0.0, 0.0, 0.0);
-    charTextureNode->scale = glm::vec3(0.12); // The texture was appearantly a bit big
+    setLocalPosition(charTextureNode->transform, glm::vec3( 0.0, 0.0, 0.0));
+    setLocalScale(charTextureNode->transform, glm::vec3(0.12)); // The texture was appearantly a bit big
     charTextureNode->textureID = charmap_id;
 
+    initTextRenderer(charmap_id);
+
 
     // Texture time, but now with normals and such
     /*PNGImage diffuse_bricks =  loadPNGFile("../res/textures/Brick03_col.png");
@@ -318,25 +420,7 @@ void initGame(GLFWwindow* window, CommandLineOptions gameOptions) {
     uploadTexture(&rough_bricks_id, rough_bricks);
     boxNode->roughnessMapID = rough_bricks_id;*/
 
-    // Cat texture time
-    PNGImage diffuse_cat =  loadPNGFile("../res/textures/cat_lucky/textures/maneki_white_baseColor_gold.png");
-    GLuint diffuse_cat_id;
-    uploadTexture(&diffuse_cat_id, diffuse_cat);
-    catNode->textureID = diffuse_cat_id;
-
-    PNGImage normal_cat =  loadPNGFile("../res/textures/cat_lucky/textures/maneki_white_normal.png");
-    GLuint normal_cat_id;
-    uploadTexture(&normal_cat_id, normal_cat);
-    catNode->normalMapTextureID = normal_cat_id;
-
-    PNGImage metal_rough_cat =  loadPNGFile("../res/textures/cat_lucky/textures/maneki_white_metallicRoughness.png");
-    GLuint metal_rough_cat_id;
-    uploadTexture(&metal_rough_cat_id, metal_rough_cat);
-    catNode->metalRoughnessMapID = metal_rough_cat_id;
-
     // Skybox time here
-    skyboxNode->vertexArrayObjectID = skyboxVAO;
-    skyboxNode->VAOIndexCount       = box_sky.indices.size(); 
 
     std::vector<std::string> skyboxFaces {
         "../res/textures/cubemap/posx.jpg", //right
@@ -350,41 +434,37 @@ void initGame(GLFWwindow* window, CommandLineOptions gameOptions) {
     GLuint skyboxTextureID;
     loadCubeMap(&skyboxTextureID, skyboxFaces);
     skyboxNode->textureID = skyboxTextureID;
-    skyboxNode->isSkybox = true;
-
-    // Now it is stone time (ok, perhaps not)
-    PNGImage diffuse_stone =  loadPNGFile("../res/textures/stone/textures/stone_color.png");
-    GLuint diffuse_stone_id;
-    uploadTexture(&diffuse_stone_id, diffuse_stone);
-    stoneNode->textureID = diffuse_stone_id;
-
-    PNGImage normal_stone =  loadPNGFile("../res/textures/stone/textures/stone_normals.png");
-    GLuint normal_stone_id;
-    uploadTexture(&normal_stone_id, normal_stone);
-    stoneNode->normalMapTextureID = normal_stone_id;
-
-    PNGImage rough_stone =  loadPNGFile("../res/textures/stone3/textures/moss_rock_roughness.png");
-    GLuint rough_stone_id;
-    uploadTexture(&rough_stone_id, rough_stone);
-    catNode->roughnessMapID = rough_stone_id;
 
     //Colors for the balls (I'm lazy)
-    PNGImage red_ball =  loadPNGFile("../res/textures/Red.png");
-    GLuint red_ball_id;
-    uploadTexture(&red_ball_id, red_ball);
-    ballNode->textureID = red_ball_id;
+    // They are single colours, so they end up as three pixels of one atlas page and the balls share a texture
+    std::string ballTextures[3] = {"../res/textures/Red.png", "../res/textures/Green.png", "../res/textures/Blue.png"};
+    SceneNode* balls[3] = {ballNode, ballNode2, ballNode3};
+    int ballAtlasImages[3];
+    for (int i = 0; i < 3; i++) {
+        ballAtlasImages[i] = addAtlasImage(ballTextures[i]);
+    }
+    buildAtlases();
+    for (int i = 0; i < 3; i++) {
+        AtlasRegion region = atlasRegion(ballAtlasImages[i]);
+        if (region.textureID != -1) {
+            balls[i]->textureID = region.textureID;
+            balls[i]->uvTransform = region.uvTransform;
+        } else {
+            balls[i]->textureHandles[MATERIAL_DIFFUSE] = loadTextureAsync(ballTextures[i], nullptr);
+        }
+    }
 
-    PNGImage green_ball =  loadPNGFile("../res/textures/Green.png");
-    GLuint green_ball_id;
-    uploadTexture(&green_ball_id, green_ball);
-    ballNode2->textureID = green_ball_id;
+    if (materialTextureMode() != MATERIAL_TEXTURES_BOUND) {
+        assignMaterials(rootNode);
+    }
 
-    PNGImage blue_ball =  loadPNGFile("../res/textures/Blue.png");
-    GLuint blue_ball_id;
-    uploadTexture(&blue_ball_id, blue_ball);
-    ballNode3->textureID = blue_ball_id;
+    // Big enough for the whole scene, things outside still work but are not culled any faster
+    initSceneOctree(glm::vec3(0), 1024);
+    updateWorldTransforms();
+    addSceneToOctree(rootNode);
 
     initDynamicCube(&cubemap, &framebuffer, &depthbuffer); // Init the hidden cubemap
+    addTransformListener(markReflectionDirty);
 
     getTimeDeltaSeconds();
 
@@ -401,6 +481,12 @@ glm::vec3 cameraPosition;
 void key_callback(GLFWwindow* window, int key, int scancode, int action, int mods)
 {
     camera.handleKeyboardInputs(key, action);
+    if (key == GLFW_KEY_F3 && action == GLFW_PRESS) {
+        setProfilerOverlayVisible(!profilerOverlayVisible());
+    }
+    if (key == GLFW_KEY_F4 && action == GLFW_PRESS) {
+        writeChromeTrace(options.profileTrace.empty() ? "profile.json" : options.profileTrace);
+    }
 }
 static void cursor_position_callback(GLFWwindow* window, double xpos, double ypos)
 {   
@@ -411,27 +497,23 @@ void mouse_button_callback(GLFWwindow* window, int button, int action, int mods)
     camera.handleMouseButtonInputs(button, action);
     if (button == GLFW_MOUSE_BUTTON_RIGHT && action == GLFW_PRESS){
         show_stone = !show_stone;
+        reflectionNeedsUpdate = true;
     }
 }
 
 //TODO: Find why reflection seems wrong/cover it up by moving the balls
 
-void updateFrame(GLFWwindow* window) {
-    glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
-    glfwSetKeyCallback(window, key_callback);
-    glfwSetMouseButtonCallback(window, mouse_button_callback);
-    glfwSetCursorPosCallback(window, cursor_position_callback);
-
-    double timeDelta = getTimeDeltaSeconds();
+void updateFrame(GLFWwindow* window, double timeDelta) {
+    previousElapsedTime = totalElapsedTime;
     totalElapsedTime += timeDelta;
 
     double deltaAngle = fmod(totalElapsedTime, 6.28);
     double deltaAngle2 = fmod(totalElapsedTime/2, 6.28);
     double deltaAngle3 = fmod(totalElapsedTime*2, 6.28);
 
-    ballNode->position = glm::vec3(catNode->position.x +  25 * cos( deltaAngle ), 0, catNode->position.z + 25* sin( deltaAngle ));
-    ballNode2->position = glm::vec3(catNode->position.x +  50 * cos( deltaAngle2 ), -20.0, catNode->position.z + 50* sin( deltaAngle2 ));
-    ballNode3->position = glm::vec3(catNode->position.x +  40 * cos( deltaAngle3 ), -10.0, catNode->position.z + 40* sin( deltaAngle3 ));
+    setLocalPosition(ballNode->transform, glm::vec3(localPosition(catNode->transform).x +  25 * cos( deltaAngle ), 0, localPosition(catNode->transform).z + 25* sin( deltaAngle )));
+    setLocalPosition(ballNode2->transform, glm::vec3(localPosition(catNode->transform).x +  50 * cos( deltaAngle2 ), -20.0, localPosition(catNode->transform).z + 50* sin( deltaAngle2 )));
+    setLocalPosition(ballNode3->transform, glm::vec3(localPosition(catNode->transform).x +  40 * cos( deltaAngle3 ), -10.0, localPosition(catNode->transform).z + 40* sin( deltaAngle3 )));
 
 
     /*if(catNode->rotation.y >= 3.14){
@@ -600,11 +682,6 @@ void updateFrame(GLFWwindow* window) {
         }
     }*/
 
-    projection = glm::perspective(glm::radians(80.0f), float(windowWidth) / float(windowHeight), 0.1f, 350.f);
-
-    cameraPosition = glm::vec3(0, 2, -20);
-
-
     // rotate skybox lol
     //skyboxNode->rotation.y += timeDelta / 2;
 
@@ -638,149 +715,393 @@ void updateFrame(GLFWwindow* window) {
         boxNode->position.y - (boxDimensions.y/2) + (padDimensions.y/2),
         boxNode->position.z - (boxDimensions.z/2) + (padDimensions.z/2) + (1 - padPositionZ) * (boxDimensions.z - padDimensions.z)
     };*/
+}
 
-    updateNodeTransformations(rootNode, glm::identity<glm::mat4>());
-    //view = cameraTransform;
-    camera.updateCamera(timeDelta);
-    view = camera.getViewMatrix();
-    glUniform3fv(shader->getUniformFromName("ball_pos"), 1, glm::value_ptr(glm::vec3(ballNode->currentTransformationMatrix*glm::vec4(0,0,0,1))));
+// What drawing a node needs, gathered once per frame after the transforms are updated. Every pass
+// (the six cube map faces and the main view) draws from these instead of going back to the nodes.
+struct RenderProxy {
+    SceneNode* node;        // For preparePass() on the simulation side. The render thread never follows it, the node may be gone by then.
+    glm::mat4 model;
+    glm::mat4 inverseModel; // For moving the camera into object space when culling meshlets
+    glm::mat3 normalMatrix;
+    glm::vec3 center;       // World space bounding sphere
+    float radius;
+    bool inOctree;
+
+    SceneNodeType nodeType;
+    int vertexArrayObjectID;
+    unsigned int indexCount;
+    const std::vector<Meshlet>* meshlets;
+    int gpuMesh;            // -1 unless drawn by the GPU culling path
+    bool isSkybox;
+    bool reflected;         // Drawn into the dynamic cube map
+    glm::vec4 uvTransform;
+    int materialID;
+    // The node's own texture IDs, which never change. The texture loader swaps the IDs of the loaded textures on the
+    // render thread, so resolveTextures() looks them up from the handles there.
+    TextureHandle textureHandles[MATERIAL_SLOT_COUNT];
+    int textureID;
+    int normalMapTextureID;
+    int roughnessMapID;
+    int metalRoughnessMapID;
+};
+
+// One pass as the simulation saw it: the camera, what the octree found inside its view, and the lights that reach it
+struct PassSnapshot {
+    glm::mat4 view;
+    glm::mat4 projection;
+    std::vector<unsigned int> visible; // Proxies to draw, in tree order so the skybox is still first
+    std::vector<char> lights;          // From packVisibleLights()
+};
+
+// Everything drawing a frame needs, copied out by the simulation so the render thread never looks at state
+// the simulation goes on to change
+struct FrameSnapshot {
+    std::vector<RenderProxy> proxies;
+    std::vector<unsigned int> cpuProxies; // The proxies the GPU does not cull
+    PassSnapshot mainPass;
+    PassSnapshot cubeFaces[6];
+    bool drawCubeMap;
+    glm::vec3 ballPosition;
+    int windowWidth;
+    int windowHeight;
+    double averageFrameTime;
+    double inputTime;
+};
 
+// Frames go from the simulation to the render thread through three snapshots: one being filled, the newest
+// finished one, and one being drawn. Neither side ever waits for the other to be done with its snapshot. The
+// simulation only waits for the render thread to have picked up the last frame before it reads input for the
+// next one, so it runs at most a frame ahead.
+FrameSnapshot snapshots[3];
+int fillingSnapshot = 0;
+int newestSnapshot = 1;
+int drawingSnapshot = 2;
+bool snapshotPublished = false;
+bool renderingStopped = false;
+std::mutex snapshotMutex;
+std::condition_variable snapshotChanged;
+
+// Set by the render thread when textures are landing, so the reflection gets drawn again with them
+std::atomic<bool> texturesArriving(false);
+
+bool waitForRenderer() {
+    std::unique_lock<std::mutex> lock(snapshotMutex);
+    snapshotChanged.wait(lock, [] { return !snapshotPublished || renderingStopped; });
+    return !renderingStopped;
 }
 
-void updateNodeTransformations(SceneNode* node, glm::mat4 transformationThusFar) {
-    glm::mat4 transformationMatrix =
-              glm::translate(node->position)
-            * glm::translate(node->referencePoint)
-            * glm::rotate(node->rotation.y, glm::vec3(0,1,0))
-            * glm::rotate(node->rotation.x, glm::vec3(1,0,0))
-            * glm::rotate(node->rotation.z, glm::vec3(0,0,1))
-            * glm::scale(node->scale)
-            * glm::translate(-node->referencePoint);
+void publishSnapshot() {
+    std::lock_guard<std::mutex> lock(snapshotMutex);
+    std::swap(fillingSnapshot, newestSnapshot);
+    snapshotPublished = true;
+    snapshotChanged.notify_all();
+}
 
-    node->currentTransformationMatrix = transformationThusFar * transformationMatrix; // M
+bool acquireFrame() {
+    std::unique_lock<std::mutex> lock(snapshotMutex);
+    snapshotChanged.wait(lock, [] { return snapshotPublished || renderingStopped; });
+    if (!snapshotPublished) {
+        return false;
+    }
+    std::swap(drawingSnapshot, newestSnapshot);
+    snapshotPublished = false;
+    snapshotChanged.notify_all();
+    return true;
+}
 
-    switch(node->nodeType) {
-        case GEOMETRY: break;rootNode->children.push_back(stoneNode);
-        case SPOT_LIGHT: case POINT_LIGHT: 
-            GLint pos_location = shader->getUniformFromName("light_info[" + std::to_string(node->lightID) + "].position");
-            glUniform3fv(pos_location, 1, glm::value_ptr(glm::vec3(node->currentTransformationMatrix * glm::vec4(0,0,0,1))));
+void stopRendering() {
+    std::lock_guard<std::mutex> lock(snapshotMutex);
+    renderingStopped = true;
+    snapshotChanged.notify_all();
+}
 
-            GLint col_location = shader->getUniformFromName("light_info[" + std::to_string(node->lightID) + "].color");
-            glUniform3fv(col_location, 1, glm::value_ptr(lightSources[node->lightID].lightColor));
-            break;
-        
+// In tree order, so the skybox is still drawn first
+void addRenderProxies(SceneNode* node, std::vector<RenderProxy> &proxies) {
+    bool drawn = node->vertexArrayObjectID != -1 && node->nodeType != POINT_LIGHT && node->nodeType != SPOT_LIGHT
+        && node->nodeType != DIRECTIONAL_LIGHT;
+    if (drawn) {
+        RenderProxy proxy;
+        proxy.node = node;
+        proxy.model = worldMatrix(node->transform);
+        proxy.inverseModel = node->meshlets ? glm::inverse(proxy.model) : glm::mat4(1);
+        proxy.normalMatrix = normalMatrix(node->transform);
+        float scale = std::max(glm::length(glm::vec3(proxy.model[0])), std::max(glm::length(glm::vec3(proxy.model[1])), glm::length(glm::vec3(proxy.model[2]))));
+        proxy.center = glm::vec3(proxy.model[3]);
+        proxy.radius = node->boundingRadius * scale;
+        proxy.inOctree = isInOctree(node);
+        proxy.nodeType = node->nodeType;
+        proxy.vertexArrayObjectID = node->vertexArrayObjectID;
+        proxy.indexCount = node->VAOIndexCount;
+        proxy.meshlets = node->meshlets;
+        proxy.gpuMesh = drawnOnGPU(node) ? node->gpuMesh : -1;
+        proxy.isSkybox = node->isSkybox;
+        // I don't render cat when sampeling for dynamic cubemap
+        proxy.reflected = node->nodeType != GEOMETRY_NORMAL_MAPPED || (node == stoneNode && show_stone);
+        proxy.uvTransform = node->uvTransform;
+        proxy.materialID = node->materialID;
+        std::copy(std::begin(node->textureHandles), std::end(node->textureHandles), proxy.textureHandles);
+        proxy.textureID = node->textureID;
+        proxy.normalMapTextureID = node->normalMapTextureID;
+        proxy.roughnessMapID = node->roughnessMapID;
+        proxy.metalRoughnessMapID = node->metalRoughnessMapID;
+        proxies.push_back(proxy);
+    }
+    for (SceneNode* child : node->children) {
+        addRenderProxies(child, proxies);
     }
+}
+
+void extractRenderProxies(std::vector<RenderProxy> &proxies) {
+    proxies.clear();
+    addRenderProxies(rootNode, proxies);
+}
 
-    for(SceneNode* child : node->children) {
-        updateNodeTransformations(child, node->currentTransformationMatrix);
+void resolveTextures(std::vector<RenderProxy> &proxies) {
+    for (RenderProxy &proxy : proxies) {
+        int* textureIDs[MATERIAL_SLOT_COUNT] = {&proxy.textureID, &proxy.normalMapTextureID, &proxy.roughnessMapID, &proxy.metalRoughnessMapID};
+        int materialTextures[MATERIAL_SLOT_COUNT];
+        for (int slot = 0; slot < MATERIAL_SLOT_COUNT; slot++) {
+            if (proxy.textureHandles[slot] != -1) {
+                *textureIDs[slot] = textureFromHandle(proxy.textureHandles[slot]);
+            }
+            materialTextures[slot] = *textureIDs[slot];
+        }
+        if (proxy.materialID != -1) {
+            setMaterialTextures(proxy.materialID, materialTextures);
+        }
     }
 }
 
-void renderNode(SceneNode* node) {
-    glUniformMatrix4fv(3, 1, GL_FALSE, glm::value_ptr(node->currentTransformationMatrix)); //M
-    glUniformMatrix4fv(8, 1, GL_FALSE, glm::value_ptr(view)); //V
-    glUniformMatrix4fv(4, 1, GL_FALSE, glm::value_ptr(projection)); //P
+// Finds what the pass sees. The octree and the nodes' cullPass belong to the simulation, so this runs there.
+void preparePass(const FrameSnapshot &frame, PassSnapshot &pass, glm::mat4 passView, glm::mat4 passProjection) {
+    PROFILE_SCOPE("cull");
+    pass.view = passView;
+    pass.projection = passProjection;
+
+    cullPass++;
+    visibleNodes.clear();
+    queryFrustum(passProjection * passView, visibleNodes);
+    for (SceneNode* node : visibleNodes) {
+        node->cullPass = cullPass;
+    }
+    pass.visible.clear();
+    for (unsigned int i : frame.cpuProxies) {
+        const RenderProxy &proxy = frame.proxies[i];
+        if (!proxy.inOctree || proxy.node->cullPass == cullPass) {
+            pass.visible.push_back(i);
+        }
+    }
+    packVisibleLights(passProjection * passView, pass.lights);
+}
+
+// Everything that follows the frame rate rather than the ticks: input, the camera, and the world transforms
+// blended between the last two ticks. Then the frame is handed to the render thread.
+void prepareFrame(GLFWwindow* window, double frameTime, float interpolation, double inputTime) {
+    glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
+    glfwSetKeyCallback(window, key_callback);
+    glfwSetMouseButtonCallback(window, mouse_button_callback);
+    glfwSetCursorPosCallback(window, cursor_position_callback);
 
-    glm::mat3 normal_matrix = glm::mat3(glm::inverse(glm::transpose(node->currentTransformationMatrix)));
-    glUniformMatrix3fv(5, 1, GL_FALSE, glm::value_ptr(normal_matrix));
+    averageFrameTime = 0.95 * averageFrameTime + 0.05 * frameTime;
 
+    int windowWidth, windowHeight;
+    glfwGetWindowSize(window, &windowWidth, &windowHeight);
 
-    if (node->textureID != -1) {
-        glUniform1i(6, 1); // do_texture
-        glBindTextureUnit(0, node->textureID);
-    } else  {
-        glUniform1i(6, 0); // don't do_texture
+    projection = glm::perspective(glm::radians(80.0f), float(windowWidth) / float(windowHeight), 0.1f, 350.f);
+
+    cameraPosition = glm::vec3(0, 2, -20);
+
+    {
+        PROFILE_SCOPE("transforms");
+        interpolateWorldTransforms(interpolation);
+        gatherLights();
+    }
+    //view = cameraTransform;
+    if (options.benchmark) {
+        view = benchmarkView(previousElapsedTime + interpolation * (totalElapsedTime - previousElapsedTime));
+    } else {
+        camera.updateCamera(frameTime);
+        view = camera.getViewMatrix();
     }
 
-    if (node->roughnessMapID != -1) {
-        glUniform1i(9, 1); // roughness
-        glBindTextureUnit(2, node->roughnessMapID);
-    } else  {
-        glUniform1i(9, 0); // no roughness
+    FrameSnapshot &frame = snapshots[fillingSnapshot];
+    {
+        PROFILE_SCOPE("snapshot");
+        extractRenderProxies(frame.proxies);
+        frame.cpuProxies.clear();
+        for (unsigned int i = 0; i < frame.proxies.size(); i++) {
+            if (frame.proxies[i].gpuMesh < 0) {
+                frame.cpuProxies.push_back(i);
+            }
+        }
+    }
+    // The cube map is only drawn again when something moved, or a texture in it arrived
+    frame.drawCubeMap = reflectionNeedsUpdate || texturesArriving;
+    if (frame.drawCubeMap) {
+        for (int i = 0; i < 6; i++) {
+            glm::mat4 faceProjection, faceView;
+            getDynamicCubeSides(i, &faceProjection, &faceView, glm::vec3(0.0, -10.0, -80.0)); // cat position (tbh. it's static, so we can hard code) glm::vec3(catNode->currentTransformationMatrix * glm::vec4(0,0,0,1)))
+            preparePass(frame, frame.cubeFaces[i], faceView, faceProjection);
+        }
+        reflectionNeedsUpdate = false;
     }
+    preparePass(frame, frame.mainPass, view, projection);
+
+    frame.ballPosition = glm::vec3(worldMatrix(ballNode->transform)*glm::vec4(0,0,0,1));
+    frame.windowWidth = windowWidth;
+    frame.windowHeight = windowHeight;
+    frame.averageFrameTime = averageFrameTime;
+    frame.inputTime = inputTime;
+    publishSnapshot();
+}
+
+// Lets the texture streamer know how big the node's textures show up, assuming they are stretched once across the node
+void requestNodeTextureDetail(const RenderProxy &proxy, const PassSnapshot &pass, float viewportHeight) {
+    float distance = std::max(-(pass.view * glm::vec4(proxy.center, 1)).z, proxy.radius);
+    float pixels = proxy.radius / distance * pass.projection[1][1] * viewportHeight;
+
+    requestTextureDetail(proxy.textureID, pixels);
+    requestTextureDetail(proxy.normalMapTextureID, pixels);
+    requestTextureDetail(proxy.roughnessMapID, pixels);
+    requestTextureDetail(proxy.metalRoughnessMapID, pixels);
+}
+
+// Draw commands for the frame, recorded on the render thread once the texture IDs are known
+CommandList frameCommands;
 
-    if (node->metalRoughnessMapID != -1) {
-        glUniform1i(11, 1); // metal roughness
-        glBindTextureUnit(4, node->metalRoughnessMapID);
-    } else  {
-        glUniform1i(11, 0); // no metal roughness
+// The CommandPass bits of the passes that draw the proxy
+unsigned int proxyPasses(const RenderProxy &proxy) {
+    return proxy.reflected ? COMMAND_PASS_ALL : COMMAND_PASS_MAIN;
+}
+
+// One command object per proxy, so the passes' visible lists index both. The GPU draws its own, so they get
+// an empty one.
+void recordProxy(const RenderProxy &proxy, bool bindTextures) {
+    if (proxy.gpuMesh >= 0) {
+        beginCommandObject(frameCommands, 0);
+        return;
     }
+    beginCommandObject(frameCommands, proxyPasses(proxy));
 
-    if (node->isSkybox){
-        glUniform1i(10, 1);
-        glBindTextureUnit(3, node->textureID);
+    recordUniform(frameCommands, 3, proxy.model); //M
+    recordUniform(frameCommands, 5, proxy.normalMatrix);
+    recordUniform(frameCommands, 15, proxy.uvTransform); // uv_transform
+
+    // With materials the shader finds the 2D textures itself, material 0 has none
+    if (!bindTextures) {
+        recordUniform(frameCommands, 14, proxy.materialID != -1 ? proxy.materialID : 0); // material_id
     }
-    else{
-        glUniform1i(10, 0);
+
+    recordUniform(frameCommands, 6, proxy.textureID != -1 ? 1 : 0); // do_texture
+    if (bindTextures && proxy.textureID != -1) recordTexture(frameCommands, 0, proxy.textureID);
+
+    recordUniform(frameCommands, 9, proxy.roughnessMapID != -1 ? 1 : 0); // roughness
+    if (bindTextures && proxy.roughnessMapID != -1) recordTexture(frameCommands, 2, proxy.roughnessMapID);
+
+    recordUniform(frameCommands, 11, proxy.metalRoughnessMapID != -1 ? 1 : 0); // metal roughness
+    if (bindTextures && proxy.metalRoughnessMapID != -1) recordTexture(frameCommands, 4, proxy.metalRoughnessMapID);
+
+    recordUniform(frameCommands, 10, proxy.isSkybox ? 1 : 0);
+    if (proxy.isSkybox) recordTexture(frameCommands, 3, proxy.textureID);
+
+    // Plain geometry is drawn without its normal map
+    bool plainGeometry = proxy.nodeType == GEOMETRY && !proxy.isSkybox;
+    recordUniform(frameCommands, 13, proxy.normalMapTextureID != -1 && !plainGeometry ? 1 : 0);
+    if (bindTextures && proxy.normalMapTextureID != -1) recordTexture(frameCommands, 1, proxy.normalMapTextureID);
+
+    recordUniform(frameCommands, 7, proxy.nodeType == GEOMETRY_2D ? 1 : 0); // is_2d
+    recordVertexArray(frameCommands, proxy.vertexArrayObjectID);
+
+    if (proxy.isSkybox) {
+        recordDepthMask(frameCommands, false); //We want the skabox to be all the way in the back
+        recordPassView(frameCommands, 8, true); // V without translation
+        recordDraw(frameCommands, proxy.indexCount);
+        recordDepthMask(frameCommands, true);
+        recordPassView(frameCommands, 8, false); // V again for everything after
+    } else if (proxy.meshlets != nullptr && proxy.nodeType != GEOMETRY_2D) {
+        recordMeshletDraw(frameCommands, proxy.meshlets, proxy.model, proxy.inverseModel);
+    } else {
+        recordDraw(frameCommands, proxy.indexCount);
     }
+}
 
-    if(dynamicCubeReady){
-        glUniform1i(12, 1);
-        glBindTextureUnit(5, cubemap);
+void recordFrameCommands(const FrameSnapshot &frame) {
+    PROFILE_SCOPE("record commands");
+    bool bindTextures = materialTextureMode() == MATERIAL_TEXTURES_BOUND;
+    beginCommandList(frameCommands, 8, 4); // V, P
+    for (const RenderProxy &proxy : frame.proxies) {
+        recordProxy(proxy, bindTextures);
     }
-    else{
-        glUniform1i(12, 0);
+}
+
+// Hands the objects the GPU culls over to it, and culls them for every pass of the frame. The main pass
+// takes draw list 0, the cube map faces 1 to 6.
+void cullFrameObjects(const FrameSnapshot &frame) {
+    PROFILE_GPU_SCOPE("gpu cull");
+    beginGPUObjects();
+    for (const RenderProxy &proxy : frame.proxies) {
+        if (proxy.gpuMesh < 0) {
+            continue;
+        }
+        unsigned int flags = 0;
+        if (proxy.textureID != -1) flags |= GPU_OBJECT_TEXTURED;
+        if (proxy.roughnessMapID != -1) flags |= GPU_OBJECT_ROUGHNESS;
+        if (proxy.metalRoughnessMapID != -1) flags |= GPU_OBJECT_METAL_ROUGHNESS;
+        // Plain geometry is drawn without its normal map
+        if (proxy.normalMapTextureID != -1 && proxy.nodeType == GEOMETRY_NORMAL_MAPPED) flags |= GPU_OBJECT_NORMAL_MAP;
+        addGPUObject(proxy.gpuMesh, proxy.model, proxy.normalMatrix, proxy.uvTransform, proxy.materialID != -1 ? proxy.materialID : 0,
+                     flags, proxy.center, proxy.radius, proxyPasses(proxy));
+        // Which of them are seen is only known on the GPU, so they ask for the detail they would need in view
+        requestNodeTextureDetail(proxy, frame.mainPass, frame.windowHeight);
     }
 
-    if (node->normalMapTextureID != -1){
-        glUniform1i(13, 1);
-        glBindTextureUnit(1, node->normalMapTextureID);
+    GPUCullPass cullPasses[gpuCullingPassLimit];
+    cullPasses[0] = GPUCullPass{frame.mainPass.projection * frame.mainPass.view, COMMAND_PASS_MAIN};
+    for (int i = 0; i < 6; i++) {
+        cullPasses[i + 1] = GPUCullPass{frame.cubeFaces[i].projection * frame.cubeFaces[i].view, COMMAND_PASS_REFLECTION};
     }
-    else{
-        glUniform1i(13, 0);
+    cullGPUObjects(cullPasses, frame.drawCubeMap ? 7 : 1);
+}
+
+// One pass over the proxies it sees, replaying the frame's commands. Only the lights and the cube map differ
+// between passes apart from the camera. gpuDrawList is the pass's list from cullFrameObjects().
+void renderPass(const FrameSnapshot &frame, const PassSnapshot &pass, CommandPass passType, int gpuDrawList) {
+    uploadLights(pass.lights);
+
+    // The cube map can't be sampled while it is being drawn
+    if (passType == COMMAND_PASS_MAIN) {
+        glUniform1i(12, 1);
+        glBindTextureUnit(5, cubemap);
+    } else {
+        glUniform1i(12, 0);
     }
 
-    switch(node->nodeType) {
-        case GEOMETRY:
-            if(node->vertexArrayObjectID != -1) {
-                glUniform1i(7, 0); // is_3d
-                if (!node->isSkybox){
-                    glUniform1i(13, 0);
-                    glBindVertexArray(node->vertexArrayObjectID);
-                    glDrawElements(GL_TRIANGLES, node->VAOIndexCount, GL_UNSIGNED_INT, nullptr);
-                }
-                else{
-                    glDepthMask(GL_FALSE); //We want the skabox to be all the way in the back
-
-                    //To do away with transelation
-                    auto  view2 = glm::mat4(glm::mat3(view)); // store locally on stack
-                    glUniformMatrix4fv(8, 1, GL_FALSE, glm::value_ptr(view2)); // V without translation
-                    
-                    glBindVertexArray(node->vertexArrayObjectID);
-                    glDrawElements(GL_TRIANGLES, node->VAOIndexCount, GL_UNSIGNED_INT, nullptr);
-                    glDepthMask(GL_TRUE);
-                }
-            }
-            break;
-        case GEOMETRY_2D:
-            if(node->vertexArrayObjectID != -1) {
-                glUniform1i(7, 1); // is_2d
-                glBindVertexArray(node->vertexArrayObjectID);
-                glDrawElements(GL_TRIANGLES, node->VAOIndexCount, GL_UNSIGNED_INT, nullptr);
-            }
-            break;
-        case GEOMETRY_NORMAL_MAPPED:
-            if(node->vertexArrayObjectID != -1 && (dynamicCubeReady || (node == stoneNode && show_stone))) { // I don't render cat when sampeling for dynamic cubemap
-                glUniform1i(7, 0); // is_3d
-                glBindTextureUnit(1, node->normalMapTextureID);
-                glBindVertexArray(node->vertexArrayObjectID);
-
-                glDrawElements(GL_TRIANGLES, node->VAOIndexCount, GL_UNSIGNED_INT, nullptr);
-            }
-            break;
-        case POINT_LIGHT: break;
-        case SPOT_LIGHT: break;
+    GLint viewport[4];
+    glGetIntegerv(GL_VIEWPORT, viewport);
+    for (unsigned int index : pass.visible) {
+        const RenderProxy &proxy = frame.proxies[index];
+        if ((frameCommands.objects[index].passes & passType) && !proxy.isSkybox && proxy.nodeType != GEOMETRY_2D) {
+            requestNodeTextureDetail(proxy, pass, viewport[3]);
+        }
     }
 
-    for(SceneNode* child : node->children) {
-        renderNode(child);
+    replayCommandList(frameCommands, CommandPassConstants{pass.view, pass.projection, unsigned(passType), &pass.visible});
+
+    if (gpuCullingEnabled) {
+        // Everything per object comes from the object buffer, the rest is set here
+        glUniformMatrix4fv(8, 1, GL_FALSE, glm::value_ptr(pass.view)); //V
+        glUniformMatrix4fv(4, 1, GL_FALSE, glm::value_ptr(pass.projection)); //P
+        glUniform1i(7, 0); // is_3d
+        glUniform1i(10, 0); // not the skybox
+        glUniform1i(16, 1); // gpu_driven
+        drawGPUObjects(gpuDrawList);
+        glUniform1i(16, 0);
     }
 }
 
-void renderFrame(GLFWwindow* window) {
-    int windowWidth, windowHeight;
-    glfwGetWindowSize(window, &windowWidth, &windowHeight);
-
+double renderFrame() {
+    FrameSnapshot &frame = snapshots[drawingSnapshot];
 
     // set light uniforms, only applies to currently loaded shader
     /*
@@ -791,33 +1112,54 @@ void renderFrame(GLFWwindow* window) {
     glUniform3fv(shader->getUniformFromName("lights"), 3, glm::value_ptr(lights[0]));
     */
 
-    //Saving original view and projection before copying sides
-    auto original_projection = projection;
-    auto original_view = view;
-    auto original_cameraPosition = cameraPosition;
-
-    dynamicCubeReady = false;
-
-    // Bind our initialized framebuffer
-    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
-    glViewport(0, 0, 2048, 2048); 
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-
-    for (int i; i < 6; i++){
-        getDynamicCubeSides(cubemap, i, &projection, &view, glm::vec3(0.0, -10.0, -80.0)); // cat position (tbh. it's static, so we can hard code) glm::vec3(catNode->currentTransformationMatrix * glm::vec4(0,0,0,1)))
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-        renderNode(rootNode);
+    {
+        PROFILE_SCOPE("prepare");
+        resolveTextures(frame.proxies);
+        updateMaterials();
+        recordFrameCommands(frame);
+    }
+    if (gpuCullingEnabled) {
+        cullFrameObjects(frame);
     }
- 
-    //Reset view and projection afer stealing the sides
-    glViewport(0, 0, windowWidth, windowHeight);
-    projection = original_projection;
-    view = original_view;
-    cameraPosition = original_cameraPosition;
+    glUniform3fv(shader->getUniformFromName("ball_pos"), 1, glm::value_ptr(frame.ballPosition));
+
+    unsigned int pendingTextures = pendingTextureLoads();
+    if (frame.drawCubeMap) {
+        PROFILE_GPU_SCOPE("cube map");
+        // Bind our initialized framebuffer
+        glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+        glViewport(0, 0, 2048, 2048); 
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-    endDynamicCubeMap();
+        for (int i = 0; i < 6; i++){
+            attachDynamicCubeSide(cubemap, i);
+            PROFILE_GPU_SCOPE("cube face");
+            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+            renderPass(frame, frame.cubeFaces[i], COMMAND_PASS_REFLECTION, i + 1);
+        }
+     
+        endDynamicCubeMap();
+    }
+    // Set here rather than in the input callbacks, which run on the simulation thread without the GL context
+    glViewport(0, 0, frame.windowWidth, frame.windowHeight);
+    texturesArriving = pendingTextures > 0 || lastPendingTextureLoads > 0;
+    lastPendingTextureLoads = pendingTextures;
+
+    {
+        PROFILE_GPU_SCOPE("main pass");
+        renderPass(frame, frame.mainPass, COMMAND_PASS_MAIN, 0);
+    }
 
-    dynamicCubeReady = true;
-    renderNode(rootNode);
-    
+    // Live stats go through the streaming text renderer, so updating them every frame is free
+    PROFILE_GPU_SCOPE("text");
+    char fpsText[96];
+    snprintf(fpsText, sizeof(fpsText), "%.0f FPS (%.2f ms), %.1f ms input latency", frame.averageFrameTime > 0 ? 1.0 / frame.averageFrameTime : 0.0,
+             1000.0 * frame.averageFrameTime, inputLatencyMs());
+    drawText(fpsText, 10, frame.windowHeight - 30, 14);
+    drawProfilerOverlay(10, frame.windowHeight - 55, 9);
+    flushText(frame.windowWidth, frame.windowHeight);
+
+    // Nodes destroyed since the snapshot was taken were still drawn above
+    releaseDestroyedNodes();
+    return frame.inputTime;
 }
@@ -3,7 +3,25 @@
 #include <utilities/window.hpp>
 #include "sceneGraph.hpp"
 
-void updateNodeTransformations(SceneNode* node, glm::mat4 transformationThusFar);
+// The simulation and the drawing can run on two threads. The simulation side (initGame(), updateFrame() and
+// prepareFrame()) owns the scene and reads input, and hands each frame over as a snapshot. The render side
+// (acquireFrame() and renderFrame()) owns the GL context and only draws from the snapshots.
+
 void initGame(GLFWwindow* window, CommandLineOptions options);
-void updateFrame(GLFWwindow* window);
-void renderFrame(GLFWwindow* window);
\ No newline at end of file
+// One fixed step of the simulation
+void updateFrame(GLFWwindow* window, double timeStep);
+// frameTime is the real time since the last frame. interpolation is how far (0 to 1) the frame lies between
+// the last tick and the one after it; the world is drawn that far from the tick before to the last tick.
+// inputTime is when the input the frame was made from was read, for the latency measurement.
+void prepareFrame(GLFWwindow* window, double frameTime, float interpolation, double inputTime);
+// Blocks until the render thread has picked up the last frame prepareFrame() handed over, so the simulation
+// does not run further ahead. Call before reading input for the next frame. Returns false once rendering stopped.
+bool waitForRenderer();
+
+// Blocks until prepareFrame() hands over a new frame, and takes it for renderFrame(). Returns false once
+// stopRendering() is called.
+bool acquireFrame();
+// Draws the frame acquireFrame() took. Returns when its input was read.
+double renderFrame();
+// Wakes up both sides for shutting down
+void stopRendering();
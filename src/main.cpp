@@ -7,6 +7,7 @@
 #include <GLFW/glfw3.h>
 
 // Standard headers
+#include <algorithm>
 #include <cstdlib>
 #include <arrrgh.hpp>
 
@@ -18,8 +19,35 @@ static void glfwErrorCallback(int error, const char *description)
 }
 
 
-GLFWwindow* initialise()
+// Benchmark runs happen on build machines without a display, so the window is hidden there, and if no context can
+// be made for it the way GLFW normally does, EGL and then OSMesa (Mesa's software renderer) are tried.
+static GLFWwindow* createHeadlessWindow()
 {
+    glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+    const int contextAPIs[] = {GLFW_NATIVE_CONTEXT_API, GLFW_EGL_CONTEXT_API, GLFW_OSMESA_CONTEXT_API};
+    for (int contextAPI : contextAPIs)
+    {
+        glfwWindowHint(GLFW_CONTEXT_CREATION_API, contextAPI);
+        GLFWwindow* window = glfwCreateWindow(windowWidth, windowHeight, windowTitle.c_str(), nullptr, nullptr);
+        if (window)
+        {
+            return window;
+        }
+    }
+    return nullptr;
+}
+
+
+GLFWwindow* initialise(bool headless)
+{
+#ifdef GLFW_PLATFORM_NULL
+    // Without a display there is nothing to make a window on, GLFW's null platform renders through OSMesa instead
+    if (headless && !getenv("DISPLAY") && !getenv("WAYLAND_DISPLAY"))
+    {
+        glfwInitHint(GLFW_PLATFORM, GLFW_PLATFORM_NULL);
+    }
+#endif
+
     // Initialise GLFW
     if (!glfwInit())
     {
@@ -40,7 +68,8 @@ GLFWwindow* initialise()
     glfwWindowHint(GLFW_SAMPLES, windowSamples);  // MSAA
 
     // Create window using GLFW
-    GLFWwindow* window = glfwCreateWindow(windowWidth, windowHeight, windowTitle.c_str(), nullptr, nullptr);
+    GLFWwindow* window = headless ? createHeadlessWindow()
+                                  : glfwCreateWindow(windowWidth, windowHeight, windowTitle.c_str(), nullptr, nullptr);
 
     // Ensure the window is set up correctly
     if (!window)
@@ -53,6 +82,8 @@ GLFWwindow* initialise()
     // Let the window be the current OpenGL context and initialise glad
     glfwMakeContextCurrent(window);
     gladLoadGL();
+    // Measure the frames, not the display, when headless. Otherwise vsync, which the low latency mode plans around.
+    glfwSwapInterval(headless ? 0 : 1);
 
     // Print various OpenGL information to stdout
     printf("%s: %s\n", glGetString(GL_VENDOR), glGetString(GL_RENDERER));
@@ -70,6 +101,20 @@ int main(int argc, const char* argb[])
     const auto& showHelp       = parser.add<bool>("help", "Show this help message.", 'h', arrrgh::Optional, false);
     const auto& enableMusic    = parser.add<bool>("enable-music", "Play background music while the game is playing", 'm', arrrgh::Optional, false);
     const auto& enableAutoplay = parser.add<bool>("autoplay", "Let the game play itself automatically. Useful for testing.", 'a', arrrgh::Optional, false);
+    const auto& textureCompression = parser.add<std::string>("texture-compression", "GPU texture compression: none, fast (BC1/BC3/BC5) or best (BC7/BC5).", 'c', arrrgh::Optional, "fast");
+    const auto& textureBinding = parser.add<std::string>("texture-binding", "How shaders get at textures: bound (per draw), bindless or arrays.", 'b', arrrgh::Optional, "bound");
+    const auto& scene = parser.add<std::string>("scene", "Scene file to load, as .scene text or compiled .bscene.", 's', arrrgh::Optional, "../res/scenes/glowbox.scene");
+    const auto& benchmark = parser.add<bool>("benchmark", "Render a fixed run in a hidden window and write a performance report, then quit.", 'B', arrrgh::Optional, false);
+    const auto& benchmarkWarmupFrames = parser.add<int>("benchmark-warmup", "Frames to render before measuring starts.", 'W', arrrgh::Optional, 120);
+    const auto& benchmarkFrames = parser.add<int>("benchmark-frames", "Frames to measure.", 'F', arrrgh::Optional, 600);
+    const auto& benchmarkReport = parser.add<std::string>("benchmark-report", "Where to write the benchmark report (JSON).", 'R', arrrgh::Optional, "benchmark.json");
+    const auto& tickRate = parser.add<int>("tick-rate", "Simulation steps per second, independent of the frame rate.", 't', arrrgh::Optional, 60);
+    const auto& lowLatency = parser.add<bool>("low-latency", "Keep the driver from queueing frames, so input shows up on screen sooner. Implies --single-threaded.", 'L', arrrgh::Optional, false);
+    const auto& framesInFlight = parser.add<int>("frames-in-flight", "In low latency mode, how many frames the GPU may be behind.", 'f', arrrgh::Optional, 1);
+    const auto& justInTime = parser.add<bool>("just-in-time", "In low latency mode, start each frame as late as it can still make the next refresh.", 'j', arrrgh::Optional, false);
+    const auto& singleThreaded = parser.add<bool>("single-threaded", "Simulate and draw on one thread, instead of drawing on a render thread of its own.", 'S', arrrgh::Optional, false);
+    const auto& gpuCulling = parser.add<bool>("gpu-culling", "Cull the plain objects in a compute shader and draw them with indirect draws. Needs --texture-binding arrays or bindless.", 'g', arrrgh::Optional, false);
+    const auto& profileTrace = parser.add<std::string>("profile-trace", "Where F4 and quitting write the Chrome trace of the last frames. Empty to only write on F4, to profile.json.", 'p', arrrgh::Optional, "");
 
     // If you want to add more program arguments, define them here,
     // but do not request their value here (they have not been parsed yet at this point).
@@ -94,9 +139,25 @@ int main(int argc, const char* argb[])
     CommandLineOptions options;
     options.enableMusic    = enableMusic.value();
     options.enableAutoplay = enableAutoplay.value();
+    options.textureCompression = textureCompression.value();
+    options.textureBinding = textureBinding.value();
+    options.scene = scene.value();
+    options.profileTrace = profileTrace.value();
+    options.tickRate = std::max(1, tickRate.value());
+    options.lowLatency = lowLatency.value();
+    options.framesInFlight = std::max(1, framesInFlight.value());
+    options.justInTime = justInTime.value();
+    // The frame pacing wait has to come between drawing one frame and reading the input for the next. With a render
+    // thread the simulation reads input while the last frame is still drawing, before the wait, which undoes it.
+    options.singleThreaded = singleThreaded.value() || options.lowLatency;
+    options.gpuCulling = gpuCulling.value();
+    options.benchmark = benchmark.value();
+    options.benchmarkWarmupFrames = std::max(0, benchmarkWarmupFrames.value());
+    options.benchmarkFrames = std::max(1, benchmarkFrames.value());
+    options.benchmarkReport = benchmarkReport.value();
 
     // Initialise window using GLFW
-    GLFWwindow* window = initialise();
+    GLFWwindow* window = initialise(options.benchmark);
 
     // Run an OpenGL application using this window
     runProgram(window, options);
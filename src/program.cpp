@@ -5,7 +5,9 @@
 #include <glm/glm.hpp>
 // glm::translate, glm::rotate, glm::scale, glm::perspective
 #include <glm/gtc/matrix_transform.hpp>
+#include <algorithm>
 #include <iostream>
+#include <thread>
 #include <SFML/Audio.hpp>
 #include <SFML/System/Time.hpp>
 #include <utilities/shapes.h>
@@ -13,6 +15,108 @@
 #include <utilities/shader.hpp>
 #include <glm/gtc/type_ptr.hpp>
 #include <utilities/timeutils.h>
+#include <utilities/textureLoader.h>
+#include <utilities/materials.h>
+#include <utilities/gpuCulling.h>
+#include <utilities/textureAtlas.h>
+#include <utilities/lights.h>
+#include <utilities/profiler.h>
+#include <utilities/frameLatency.h>
+#include <utilities/transformHierarchy.h>
+#include "sceneOctree.hpp"
+#include "benchmark.hpp"
+
+
+// The simulation runs in fixed ticks, as many as the time since the last frame covers. Frames are drawn
+// part way between the last two ticks, by what is left over.
+static double tickLength = 1.0 / 60;
+static const int maxTicksPerFrame = 8; // After a long stall, slow down instead of spending ever longer catching up
+static double tickTime = 0;
+
+// Reads input, runs the ticks that are due, and hands the frame over to be drawn
+static void simulateFrame(GLFWwindow* window)
+{
+    // Input is read right before the simulation uses it, not after the frame before was drawn
+    double inputTime;
+    {
+        PROFILE_SCOPE("events");
+        glfwPollEvents();
+        handleKeyboardInput(window);
+        inputTime = markInputSampled();
+    }
+    double frameTime = getTimeDeltaSeconds();
+    tickTime = std::min(tickTime + frameTime, maxTicksPerFrame * tickLength);
+
+    {
+        PROFILE_SCOPE("update");
+        while (tickTime >= tickLength) {
+            beginTransformTick();
+            updateFrame(window, tickLength);
+            tickTime -= tickLength;
+        }
+    }
+    {
+        PROFILE_SCOPE("prepare frame");
+        prepareFrame(window, frameTime, float(tickTime / tickLength), inputTime);
+    }
+}
+
+// Draws the frame acquireFrame() took, on the thread with the GL context
+static void drawFrame(GLFWwindow* window)
+{
+    // Clear colour and depth buffers
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+    {
+        PROFILE_GPU_SCOPE("texture uploads");
+        pumpTextureUploads();
+    }
+    double inputTime;
+    {
+        PROFILE_GPU_SCOPE("render");
+        inputTime = renderFrame();
+    }
+
+    // Flip buffers
+    {
+        PROFILE_SCOPE("swap buffers");
+        glfwSwapBuffers(window);
+    }
+    endFrameLatency(inputTime);
+}
+
+// The render thread draws frames while the main thread simulates the next one. It stops once the main
+// thread stops it, or when the benchmark is over.
+static void renderLoop(GLFWwindow* window, CommandLineOptions options)
+{
+    glfwMakeContextCurrent(window);
+    nameProfilerThread("render");
+    while (true)
+    {
+        beginProfilerFrame();
+        {
+            PROFILE_SCOPE("frame pacing");
+            waitForFrameStart();
+        }
+        bool acquired;
+        {
+            PROFILE_SCOPE("wait for simulation");
+            acquired = acquireFrame();
+        }
+        if (!acquired) {
+            endProfilerFrame();
+            break;
+        }
+        drawFrame(window);
+        endProfilerFrame();
+
+        if (options.benchmark && !continueBenchmark()) {
+            break;
+        }
+    }
+    stopRendering();
+    glfwMakeContextCurrent(nullptr);
+}
 
 
 void runProgram(GLFWwindow* window, CommandLineOptions options)
@@ -34,29 +138,90 @@ void runProgram(GLFWwindow* window, CommandLineOptions options)
     // Set default colour after clearing the colour buffer
     glClearColor(0.3f, 0.5f, 0.8f, 1.0f);
 
-	initGame(window, options);
-
-    // Rendering Loop
-    while (!glfwWindowShouldClose(window))
-    {
-	    // Clear colour and depth buffers
-	    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-
-
-        updateFrame(window);
-        renderFrame(window);
-
+    // Textures decode in the background while we start rendering
+    TextureCompression compression = TEXTURE_COMPRESSION_FAST;
+    if (options.textureCompression == "none") {
+        compression = TEXTURE_COMPRESSION_NONE;
+    } else if (options.textureCompression == "best") {
+        compression = TEXTURE_COMPRESSION_HIGH_QUALITY;
+    }
+    initTextureLoader(compression);
 
+    MaterialTextureMode textureBinding = MATERIAL_TEXTURES_BOUND;
+    if (options.textureBinding == "bindless") {
+        textureBinding = MATERIAL_TEXTURES_BINDLESS;
+    } else if (options.textureBinding == "arrays") {
+        textureBinding = MATERIAL_TEXTURES_ARRAYS;
+    }
+    initMaterials(textureBinding);
+    initProfiler(options.benchmark ? std::max(600u, options.benchmarkFrames) : 600);
 
+    // Frames are always measured, but only held back in low latency mode
+    GLFWmonitor* monitor = options.benchmark ? nullptr : glfwGetPrimaryMonitor();
+    const GLFWvidmode* videoMode = monitor ? glfwGetVideoMode(monitor) : nullptr;
+    double refreshRate = videoMode ? videoMode->refreshRate : 0;
+    initFrameLatency(options.lowLatency ? options.framesInFlight : 0, options.lowLatency && options.justInTime, refreshRate);
 
+	initGame(window, options);
+    if (options.benchmark) {
+        beginBenchmark(options);
+    }
 
-        // Handle other events
-        glfwPollEvents();
-        handleKeyboardInput(window);
+    tickLength = 1.0 / options.tickRate;
+
+    if (options.singleThreaded) {
+        while (!glfwWindowShouldClose(window))
+        {
+            beginProfilerFrame();
+            {
+                PROFILE_SCOPE("frame pacing");
+                waitForFrameStart();
+            }
+            simulateFrame(window);
+            acquireFrame();
+            drawFrame(window);
+            endProfilerFrame();
+
+            if (options.benchmark && !continueBenchmark()) {
+                break;
+            }
+        }
+    } else {
+        // The render thread takes the context with it, and gives it back when it is done
+        glfwMakeContextCurrent(nullptr);
+        std::thread renderThread(renderLoop, window, options);
+        nameProfilerThread("simulation");
+
+        // Events have to be handled on the main thread, so this one runs the simulation
+        while (!glfwWindowShouldClose(window))
+        {
+            bool rendering;
+            {
+                PROFILE_SCOPE("wait for renderer");
+                rendering = waitForRenderer();
+            }
+            if (!rendering) {
+                break;
+            }
+            simulateFrame(window);
+        }
+        stopRendering();
+        renderThread.join();
+        glfwMakeContextCurrent(window);
+    }
 
-        // Flip buffers
-        glfwSwapBuffers(window);
+    if (!options.profileTrace.empty()) {
+        writeChromeTrace(options.profileTrace);
     }
+    shutdownFrameLatency();
+    shutdownProfiler();
+
+    shutdownGPUCulling();
+    shutdownMaterials();
+    shutdownAtlases();
+    shutdownSceneOctree();
+    shutdownLights();
+    shutdownTextureLoader();
 }
 
 
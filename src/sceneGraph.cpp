@@ -1,13 +1,118 @@
 #include "sceneGraph.hpp"
+#include <algorithm>
 #include <iostream>
+#include <memory>
+#include <new>
+#include <type_traits>
+
+// Nodes are allocated in blocks that are never freed or moved, so pointers to live nodes stay valid. The slots
+// of destroyed nodes go on a free list and are used again before a new block is allocated.
+static const unsigned int nodesPerBlock = 256;
+
+struct NodeSlot {
+	std::aligned_storage<sizeof(SceneNode), alignof(SceneNode)>::type storage;
+	unsigned int generation = 1; // Bumped when the node is destroyed, which invalidates old handles
+	unsigned int nextFree = 0;
+	bool alive = false;
+
+	SceneNode* node() {
+		return reinterpret_cast<SceneNode*>(&storage);
+	}
+};
+
+static std::vector<std::unique_ptr<NodeSlot[]>> blocks;
+static unsigned int slotCount = 0;
+static unsigned int firstFree = ~0u; // ~0 for none
+static size_t liveNodes = 0;
+static void (*destroyedCallback)(SceneNode*) = nullptr;
+
+static NodeSlot& slot(unsigned int index) {
+	return blocks[index / nodesPerBlock][index % nodesPerBlock];
+}
 
 SceneNode* createSceneNode(SceneNodeType type) {
-	return new SceneNode(type);
+	unsigned int index;
+	if (firstFree != ~0u) {
+		index = firstFree;
+		firstFree = slot(index).nextFree;
+	} else {
+		if (slotCount % nodesPerBlock == 0) {
+			blocks.emplace_back(new NodeSlot[nodesPerBlock]);
+		}
+		index = slotCount++;
+	}
+	NodeSlot &nodeSlot = slot(index);
+	SceneNode* node = new (&nodeSlot.storage) SceneNode(type);
+	node->handle.index = index;
+	node->handle.generation = nodeSlot.generation;
+	nodeSlot.alive = true;
+	liveNodes++;
+	return node;
+}
+
+static void destroySubtree(SceneNode* node) {
+	for (SceneNode* child : node->children) {
+		destroySubtree(child);
+	}
+	if (destroyedCallback) {
+		destroyedCallback(node);
+	}
+	destroyTransform(node->transform);
+
+	unsigned int index = node->handle.index;
+	NodeSlot &nodeSlot = slot(index);
+	node->~SceneNode();
+	nodeSlot.alive = false;
+	if (++nodeSlot.generation == 0) {
+		nodeSlot.generation = 1;
+	}
+	nodeSlot.nextFree = firstFree;
+	firstFree = index;
+	liveNodes--;
+}
+
+void destroySceneNode(SceneNode* node) {
+	if (node->parent) {
+		removeChild(node->parent, node);
+	}
+	destroySubtree(node);
+}
+
+void setSceneNodeDestroyedCallback(void (*callback)(SceneNode* node)) {
+	destroyedCallback = callback;
+}
+
+SceneNode* getSceneNode(SceneNodeHandle handle) {
+	if (handle.index >= slotCount) {
+		return nullptr;
+	}
+	NodeSlot &nodeSlot = slot(handle.index);
+	return nodeSlot.alive && nodeSlot.generation == handle.generation ? nodeSlot.node() : nullptr;
+}
+
+size_t sceneNodeCount() {
+	return liveNodes;
 }
 
 // Add a child node to its parent's list of children
 void addChild(SceneNode* parent, SceneNode* child) {
+	if (child->parent) {
+		removeChild(child->parent, child);
+	}
 	parent->children.push_back(child);
+	child->parent = parent;
+	setTransformParent(child->transform, parent->transform);
+}
+
+// The child becomes a root, keeping its local transform
+void removeChild(SceneNode* parent, SceneNode* child) {
+	auto position = std::find(parent->children.begin(), parent->children.end(), child);
+	if (position == parent->children.end()) {
+		return;
+	}
+	parent->children.erase(position); // Keeping the order, since that is the order things are drawn in
+	child->parent = nullptr;
+	setTransformParent(child->transform, -1);
 }
 
 int totalChildren(SceneNode* parent) {
@@ -29,9 +134,8 @@ void printNode(SceneNode* node) {
 		"    VAO ID: %i\n"
 		"}\n",
 		int(node->children.size()),
-		node->rotation.x, node->rotation.y, node->rotation.z,
-		node->position.x, node->position.y, node->position.z,
-		node->referencePoint.x, node->referencePoint.y, node->referencePoint.z, 
+		localRotation(node->transform).x, localRotation(node->transform).y, localRotation(node->transform).z,
+		localPosition(node->transform).x, localPosition(node->transform).y, localPosition(node->transform).z,
+		referencePoint(node->transform).x, referencePoint(node->transform).y, referencePoint(node->transform).z,
 		node->vertexArrayObjectID);
 }
-
@@ -13,24 +13,41 @@
 #include <chrono>
 #include <fstream>
 
+#include <utilities/meshlets.h>
+#include <utilities/transformHierarchy.h>
+
+// Refers to a scene node without keeping a pointer to it. A handle to a node that has been destroyed
+// stays invalid, even after the node's slot is used by a new node.
+struct SceneNodeHandle {
+	unsigned int index = 0;
+	unsigned int generation = 0; // Never 0 for a live node, so a default handle is always invalid
+};
+
 enum SceneNodeType {
-	GEOMETRY, POINT_LIGHT, SPOT_LIGHT, GEOMETRY_2D, GEOMETRY_NORMAL_MAPPED
+	GEOMETRY, POINT_LIGHT, SPOT_LIGHT, GEOMETRY_2D, GEOMETRY_NORMAL_MAPPED, DIRECTIONAL_LIGHT
 };
 
 struct SceneNode {
 	SceneNode(SceneNodeType type) {
-		position = glm::vec3(0, 0, 0);
-		rotation = glm::vec3(0, 0, 0);
-		scale = glm::vec3(1, 1, 1);
-
-        referencePoint = glm::vec3(0, 0, 0);
+		transform = createTransform();
         vertexArrayObjectID = -1;
         VAOIndexCount = 0;
 		textureID = -1;
+		normalMapTextureID = -1;
 		lightID = -1;
 		roughnessMapID = -1;
 		metalRoughnessMapID = -1;
 		isSkybox = false;
+		meshlets = nullptr;
+		gpuMesh = -1;
+		materialID = -1;
+		for (int &handle : textureHandles) {
+			handle = -1;
+		}
+		boundingRadius = 1;
+		uvTransform = glm::vec4(1, 1, 0, 0);
+		parent = nullptr;
+		cullPass = 0;
 
         nodeType = type;
 
@@ -39,31 +56,40 @@ struct SceneNode {
 	// A list of all children that belong to this node.
 	// For instance, in case of the scene graph of a human body shown in the assignment text, the "Upper Torso" node would contain the "Left Arm", "Right Arm", "Head" and "Lower Torso" nodes in its list of children.
 	std::vector<SceneNode*> children;
-	
-	// The node's position and rotation relative to its parent
-	glm::vec3 position;
-	glm::vec3 rotation;
-	glm::vec3 scale;
+	SceneNode* parent;
 
-	// A transformation matrix representing the transformation of the node's location relative to its parent. This matrix is updated every frame.
-	glm::mat4 currentTransformationMatrix;
-
-	// The location of the node's reference point
-	glm::vec3 referencePoint;
+	// Where the node lives in the node pool
+	SceneNodeHandle handle;
+	
+	// The node's position, rotation, scale and reference point relative to its parent, and its world matrix,
+	// live in the transform hierarchy. The world matrix is updated every frame.
+	TransformID transform;
 
 	// The ID of the VAO containing the "appearance" of this SceneNode.
 	int vertexArrayObjectID;
 	unsigned int VAOIndexCount;
 
+	// Radius of a sphere around the node's origin containing its mesh, before scaling
+	float boundingRadius;
+
+	// Optional meshlet clusters of the mesh in the VAO, used to cull parts of the mesh instead of all or nothing
+	const std::vector<Meshlet>* meshlets;
+
+	// The mesh in the GPU culling path's shared buffers, -1 for none
+	int gpuMesh;
+
 	// Node type is used to determine how to handle the contents of a node
 	SceneNodeType nodeType;
 
-	//Index in light struct if node is a light
+	// ID in the light registry (utilities/lights.h) if node is a light
 	int lightID;
 
 	//If node is texture then we must save its ID
 	int textureID;
 
+	// Scale (xy) and offset (zw) applied to the texture coordinates, for textures that are part of an atlas
+	glm::vec4 uvTransform;
+
 	// If node is normal texture we must have id for that as well
 	int normalMapTextureID;
 
@@ -75,10 +101,32 @@ struct SceneNode {
 
 	// If node is skybox, 1 for yes, 0 for no
 	bool isSkybox;
+
+	// Index in the material buffer, only used when textures are not bound per draw
+	int materialID;
+
+	// References to shared textures held by this node, released when it is destroyed. One per texture slot, in the
+	// order of the ID fields above (diffuse, normal map, roughness, metal roughness), -1 for none. Their IDs are
+	// looked up on the render thread, the ID fields only hold textures that never change.
+	int textureHandles[4];
+
+	// The last culling pass that found the node inside the view
+	unsigned int cullPass;
 };
 
+// Nodes come from a pool of fixed size blocks, so creating and destroying them is cheap and their pointers stay
+// valid until they are destroyed. Destroying a node also destroys everything below it.
 SceneNode* createSceneNode(SceneNodeType type);
+void destroySceneNode(SceneNode* node);
+// Called for every node about to be destroyed, to let go of what it holds on to, like textures
+void setSceneNodeDestroyedCallback(void (*callback)(SceneNode* node));
+// nullptr if the node has been destroyed
+SceneNode* getSceneNode(SceneNodeHandle handle);
+size_t sceneNodeCount();
+
+// Moves the child if it already has a parent
 void addChild(SceneNode* parent, SceneNode* child);
+void removeChild(SceneNode* parent, SceneNode* child);
 void printNode(SceneNode* node);
 int totalChildren(SceneNode* parent);
 
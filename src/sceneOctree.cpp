@@ -0,0 +1,416 @@
+#include "sceneOctree.hpp"
+#include <algorithm>
+#include <cmath>
+
+struct OctreeCell {
+    glm::vec3 center;
+    float halfSize;       // Of the cell itself, the loose bounds are twice this
+    int depth;
+    int parent;
+    int children[8];      // -1 where there are no nodes below
+    std::vector<int> items;
+    size_t subtreeItems;  // Items in this cell and every cell below it
+};
+
+struct OctreeItem {
+    SceneNode* node;
+    glm::vec3 center;
+    float radius;
+    int cell;
+    int slot;             // Position in the cell's items
+};
+
+static std::vector<OctreeCell> cells; // Cell 0 is the root
+static std::vector<int> freeCells;
+static std::vector<OctreeItem> items;
+static std::vector<int> itemOfTransform; // Indexed by TransformID, -1 for transforms not in the tree
+static int maxCellDepth = 10;
+static bool listening = false;
+
+
+static int allocateCell(glm::vec3 center, float halfSize, int depth, int parent) {
+    int index;
+    if (!freeCells.empty()) {
+        index = freeCells.back();
+        freeCells.pop_back();
+    } else {
+        index = cells.size();
+        cells.emplace_back();
+    }
+    OctreeCell &cell = cells[index];
+    cell.center = center;
+    cell.halfSize = halfSize;
+    cell.depth = depth;
+    cell.parent = parent;
+    std::fill(cell.children, cell.children + 8, -1);
+    cell.items.clear();
+    cell.subtreeItems = 0;
+    return index;
+}
+
+static void worldSphere(const SceneNode* node, glm::vec3 &center, float &radius) {
+    const glm::mat4 &model = worldMatrix(node->transform);
+    float scale = std::max(glm::length(glm::vec3(model[0])), std::max(glm::length(glm::vec3(model[1])), glm::length(glm::vec3(model[2]))));
+    center = glm::vec3(model[3]);
+    radius = node->boundingRadius * scale;
+}
+
+static bool insideCell(const OctreeCell &cell, glm::vec3 point) {
+    return std::fabs(point.x - cell.center.x) <= cell.halfSize
+        && std::fabs(point.y - cell.center.y) <= cell.halfSize
+        && std::fabs(point.z - cell.center.z) <= cell.halfSize;
+}
+
+// The deepest level whose cells are at least as big as the radius, since the loose bounds then still hold the whole sphere
+static int depthForRadius(float radius) {
+    if (radius <= 0) {
+        return maxCellDepth;
+    }
+    float levels = std::floor(std::log2(cells[0].halfSize / radius));
+    return (int)std::max(0.0f, std::min((float)maxCellDepth, levels));
+}
+
+// Walks down from the root towards the sphere's centre, making cells on the way as needed
+static int cellForSphere(glm::vec3 center, float radius) {
+    if (!insideCell(cells[0], center)) {
+        return 0;
+    }
+    int depth = depthForRadius(radius);
+    int index = 0;
+    for (int level = 0; level < depth; level++) {
+        const OctreeCell &cell = cells[index];
+        int child = (center.x >= cell.center.x ? 1 : 0) | (center.y >= cell.center.y ? 2 : 0) | (center.z >= cell.center.z ? 4 : 0);
+        if (cell.children[child] < 0) {
+            float quarter = cell.halfSize / 2;
+            glm::vec3 childCenter(cell.center.x + (child & 1 ? quarter : -quarter),
+                                  cell.center.y + (child & 2 ? quarter : -quarter),
+                                  cell.center.z + (child & 4 ? quarter : -quarter));
+            int created = allocateCell(childCenter, quarter, level + 1, index);
+            cells[index].children[child] = created; // The allocation may have moved the cells
+        }
+        index = cells[index].children[child];
+    }
+    return index;
+}
+
+static void linkItem(int itemIndex) {
+    OctreeItem &item = items[itemIndex];
+    item.cell = cellForSphere(item.center, item.radius);
+    OctreeCell &cell = cells[item.cell];
+    item.slot = cell.items.size();
+    cell.items.push_back(itemIndex);
+    for (int index = item.cell; index >= 0; index = cells[index].parent) {
+        cells[index].subtreeItems++;
+    }
+}
+
+// Takes the item out of its cell, and lets go of cells left with nothing in or below them
+static void unlinkItem(int itemIndex) {
+    OctreeItem &item = items[itemIndex];
+    OctreeCell &cell = cells[item.cell];
+    int moved = cell.items.back();
+    cell.items[item.slot] = moved;
+    items[moved].slot = item.slot;
+    cell.items.pop_back();
+    for (int index = item.cell; index >= 0; index = cells[index].parent) {
+        cells[index].subtreeItems--;
+    }
+    // Children always empty out before their parent, so an empty cell has no children left
+    int index = item.cell;
+    while (index > 0 && cells[index].subtreeItems == 0) {
+        int parent = cells[index].parent;
+        std::replace(cells[parent].children, cells[parent].children + 8, index, -1);
+        freeCells.push_back(index);
+        index = parent;
+    }
+}
+
+// Moved nodes only change cell if they left their cell or no longer fit its size
+static void updateItem(int itemIndex) {
+    OctreeItem &item = items[itemIndex];
+    worldSphere(item.node, item.center, item.radius);
+    const OctreeCell &cell = cells[item.cell];
+    bool fits = item.cell == 0 ? !insideCell(cell, item.center) || depthForRadius(item.radius) == 0
+                               : insideCell(cell, item.center) && cell.depth == depthForRadius(item.radius);
+    if (!fits) {
+        unlinkItem(itemIndex);
+        linkItem(itemIndex);
+    }
+}
+
+static void transformsChanged(const std::vector<TransformID> &changed, void*) {
+    if (items.empty()) {
+        return;
+    }
+    for (TransformID id : changed) {
+        if (id < (int)itemOfTransform.size() && itemOfTransform[id] >= 0) {
+            updateItem(itemOfTransform[id]);
+        }
+    }
+}
+
+void initSceneOctree(glm::vec3 center, float halfSize, int maxDepth) {
+    shutdownSceneOctree();
+    maxCellDepth = maxDepth;
+    allocateCell(center, halfSize, 0, -1);
+    addTransformListener(transformsChanged);
+    listening = true;
+}
+
+void shutdownSceneOctree() {
+    if (listening) {
+        removeTransformListener(transformsChanged);
+        listening = false;
+    }
+    cells.clear();
+    freeCells.clear();
+    items.clear();
+    itemOfTransform.clear();
+}
+
+void addToOctree(SceneNode* node) {
+    if (isInOctree(node)) {
+        updateItem(itemOfTransform[node->transform]);
+        return;
+    }
+    if (node->transform >= (int)itemOfTransform.size()) {
+        itemOfTransform.resize(node->transform + 1, -1);
+    }
+    int itemIndex = items.size();
+    OctreeItem item;
+    item.node = node;
+    worldSphere(node, item.center, item.radius);
+    items.push_back(item);
+    itemOfTransform[node->transform] = itemIndex;
+    linkItem(itemIndex);
+}
+
+void removeFromOctree(SceneNode* node) {
+    if (!isInOctree(node)) {
+        return;
+    }
+    int itemIndex = itemOfTransform[node->transform];
+    unlinkItem(itemIndex);
+    itemOfTransform[node->transform] = -1;
+
+    // Fill the hole with the last item
+    int last = items.size() - 1;
+    if (itemIndex != last) {
+        items[itemIndex] = items[last];
+        cells[items[itemIndex].cell].items[items[itemIndex].slot] = itemIndex;
+        itemOfTransform[items[itemIndex].node->transform] = itemIndex;
+    }
+    items.pop_back();
+}
+
+bool isInOctree(const SceneNode* node) {
+    return node->transform < (int)itemOfTransform.size() && itemOfTransform[node->transform] >= 0;
+}
+
+size_t octreeNodeCount() {
+    return items.size();
+}
+
+size_t octreeCellCount() {
+    return cells.size() - freeCells.size();
+}
+
+
+// Every query walks the cells from the root, skipping cells whose loose bounds miss the query. The root holds
+// whatever is outside the tree, so it is always visited.
+
+static void addSubtree(int cellIndex, std::vector<SceneNode*> &results) {
+    const OctreeCell &cell = cells[cellIndex];
+    for (int itemIndex : cell.items) {
+        results.push_back(items[itemIndex].node);
+    }
+    for (int child : cell.children) {
+        if (child >= 0) {
+            addSubtree(child, results);
+        }
+    }
+}
+
+static void frustumCells(int cellIndex, const glm::vec4 planes[6], std::vector<SceneNode*> &results) {
+    const OctreeCell &cell = cells[cellIndex];
+    if (cell.subtreeItems == 0) {
+        return;
+    }
+    if (cellIndex != 0) {
+        bool inside = true;
+        float looseSize = 2 * cell.halfSize;
+        for (int i = 0; i < 6; i++) {
+            const glm::vec4 &plane = planes[i];
+            float distance = glm::dot(glm::vec3(plane), cell.center) + plane.w;
+            float extent = looseSize * (std::fabs(plane.x) + std::fabs(plane.y) + std::fabs(plane.z));
+            if (distance < -extent) {
+                return;
+            }
+            inside = inside && distance >= extent;
+        }
+        if (inside) {
+            addSubtree(cellIndex, results); // Nothing below can be outside
+            return;
+        }
+    }
+    for (int itemIndex : cell.items) {
+        const OctreeItem &item = items[itemIndex];
+        bool visible = true;
+        for (int i = 0; i < 6 && visible; i++) {
+            visible = glm::dot(glm::vec3(planes[i]), item.center) + planes[i].w >= -item.radius;
+        }
+        if (visible) {
+            results.push_back(item.node);
+        }
+    }
+    for (int child : cell.children) {
+        if (child >= 0) {
+            frustumCells(child, planes, results);
+        }
+    }
+}
+
+void queryFrustum(const glm::mat4 &viewProjection, std::vector<SceneNode*> &results) {
+    if (cells.empty()) {
+        return;
+    }
+    // World space planes (Gribb & Hartmann), normalised so sphere distances are exact
+    glm::vec4 planes[6];
+    for (int axis = 0; axis < 3; axis++) {
+        glm::vec4 row(viewProjection[0][axis], viewProjection[1][axis], viewProjection[2][axis], viewProjection[3][axis]);
+        glm::vec4 w(viewProjection[0][3], viewProjection[1][3], viewProjection[2][3], viewProjection[3][3]);
+        planes[2 * axis + 0] = w + row;
+        planes[2 * axis + 1] = w - row;
+    }
+    for (glm::vec4 &plane : planes) {
+        plane /= glm::length(glm::vec3(plane));
+    }
+    frustumCells(0, planes, results);
+}
+
+// Squared distance from a point to a box, 0 inside it
+static float distanceSquaredToBox(glm::vec3 point, glm::vec3 min, glm::vec3 max) {
+    float distance = 0;
+    for (int axis = 0; axis < 3; axis++) {
+        float outside = std::max(min[axis] - point[axis], std::max(0.0f, point[axis] - max[axis]));
+        distance += outside * outside;
+    }
+    return distance;
+}
+
+static void sphereCells(int cellIndex, glm::vec3 center, float radius, std::vector<SceneNode*> &results) {
+    const OctreeCell &cell = cells[cellIndex];
+    if (cell.subtreeItems == 0) {
+        return;
+    }
+    glm::vec3 looseSize(2 * cell.halfSize);
+    if (cellIndex != 0 && distanceSquaredToBox(center, cell.center - looseSize, cell.center + looseSize) > radius * radius) {
+        return;
+    }
+    for (int itemIndex : cell.items) {
+        const OctreeItem &item = items[itemIndex];
+        glm::vec3 offset = item.center - center;
+        float reach = radius + item.radius;
+        if (glm::dot(offset, offset) <= reach * reach) {
+            results.push_back(item.node);
+        }
+    }
+    for (int child : cell.children) {
+        if (child >= 0) {
+            sphereCells(child, center, radius, results);
+        }
+    }
+}
+
+void querySphere(glm::vec3 center, float radius, std::vector<SceneNode*> &results) {
+    if (!cells.empty()) {
+        sphereCells(0, center, radius, results);
+    }
+}
+
+static void boxCells(int cellIndex, glm::vec3 min, glm::vec3 max, std::vector<SceneNode*> &results) {
+    const OctreeCell &cell = cells[cellIndex];
+    if (cell.subtreeItems == 0) {
+        return;
+    }
+    float looseSize = 2 * cell.halfSize;
+    if (cellIndex != 0) {
+        for (int axis = 0; axis < 3; axis++) {
+            if (cell.center[axis] + looseSize < min[axis] || cell.center[axis] - looseSize > max[axis]) {
+                return;
+            }
+        }
+    }
+    for (int itemIndex : cell.items) {
+        const OctreeItem &item = items[itemIndex];
+        if (distanceSquaredToBox(item.center, min, max) <= item.radius * item.radius) {
+            results.push_back(item.node);
+        }
+    }
+    for (int child : cell.children) {
+        if (child >= 0) {
+            boxCells(child, min, max, results);
+        }
+    }
+}
+
+void queryBox(glm::vec3 min, glm::vec3 max, std::vector<SceneNode*> &results) {
+    if (!cells.empty()) {
+        boxCells(0, min, max, results);
+    }
+}
+
+// Slab test of the ray against the cell's loose bounds
+static bool rayHitsCell(const OctreeCell &cell, glm::vec3 origin, glm::vec3 inverseDirection, float maxDistance) {
+    float near = 0, far = maxDistance;
+    float looseSize = 2 * cell.halfSize;
+    for (int axis = 0; axis < 3; axis++) {
+        float t0 = (cell.center[axis] - looseSize - origin[axis]) * inverseDirection[axis];
+        float t1 = (cell.center[axis] + looseSize - origin[axis]) * inverseDirection[axis];
+        near = std::max(near, std::min(t0, t1));
+        far = std::min(far, std::max(t0, t1));
+    }
+    return near <= far;
+}
+
+static void rayCells(int cellIndex, glm::vec3 origin, glm::vec3 direction, glm::vec3 inverseDirection, float maxDistance,
+                     std::vector<OctreeRayHit> &hits) {
+    const OctreeCell &cell = cells[cellIndex];
+    if (cell.subtreeItems == 0 || (cellIndex != 0 && !rayHitsCell(cell, origin, inverseDirection, maxDistance))) {
+        return;
+    }
+    for (int itemIndex : cell.items) {
+        const OctreeItem &item = items[itemIndex];
+        glm::vec3 offset = item.center - origin;
+        float along = glm::dot(offset, direction);
+        float missSquared = glm::dot(offset, offset) - along * along;
+        float radiusSquared = item.radius * item.radius;
+        if (missSquared > radiusSquared) {
+            continue;
+        }
+        float entry = along - std::sqrt(radiusSquared - missSquared);
+        float exit = along + std::sqrt(radiusSquared - missSquared);
+        if (exit >= 0 && entry <= maxDistance) {
+            hits.push_back(OctreeRayHit{item.node, std::max(entry, 0.0f)});
+        }
+    }
+    for (int child : cell.children) {
+        if (child >= 0) {
+            rayCells(child, origin, direction, inverseDirection, maxDistance, hits);
+        }
+    }
+}
+
+void queryRay(glm::vec3 origin, glm::vec3 direction, float maxDistance, std::vector<OctreeRayHit> &hits) {
+    if (cells.empty()) {
+        return;
+    }
+    direction = glm::normalize(direction);
+    // Dividing by a zero component gives infinity, which the slab test handles
+    glm::vec3 inverseDirection(1.0f / direction.x, 1.0f / direction.y, 1.0f / direction.z);
+    size_t first = hits.size();
+    rayCells(0, origin, direction, inverseDirection, maxDistance, hits);
+    std::sort(hits.begin() + first, hits.end(), [](const OctreeRayHit &a, const OctreeRayHit &b) {
+        return a.distance < b.distance;
+    });
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include "sceneGraph.hpp"
+#include <glm/glm.hpp>
+#include <vector>
+
+// A loose octree over the world space bounding spheres of scene nodes, for finding what is inside a frustum, near a point
+// or along a ray without going through every node. Each cell's bounds are twice its size, so a node is stored in the
+// one cell at the depth that fits its radius and contains its centre. Adding, moving and removing a node only touches the
+// cells on one path from the root, and queries skip every empty or unreachable cell.
+// The tree keeps itself up to date by listening to the transform hierarchy, so a node only has to be added once.
+
+// The cube the tree is built over. Nodes outside it still work, they just all land in the root cell.
+void initSceneOctree(glm::vec3 center, float halfSize, int maxDepth = 10);
+void shutdownSceneOctree();
+
+// The bounding sphere is node->boundingRadius around the node's origin, scaled with it. Adding a node that is already
+// there picks up a changed boundingRadius. The node must be removed before it is destroyed.
+void addToOctree(SceneNode* node);
+void removeFromOctree(SceneNode* node);
+bool isInOctree(const SceneNode* node);
+
+// Results are appended, in no particular order
+void queryFrustum(const glm::mat4 &viewProjection, std::vector<SceneNode*> &results);
+void querySphere(glm::vec3 center, float radius, std::vector<SceneNode*> &results);
+void queryBox(glm::vec3 min, glm::vec3 max, std::vector<SceneNode*> &results);
+
+struct OctreeRayHit {
+    SceneNode* node;
+    float distance; // Along the ray to where it enters the bounding sphere, 0 if it starts inside
+};
+// Nodes whose bounding sphere the ray passes through within maxDistance, nearest first
+void queryRay(glm::vec3 origin, glm::vec3 direction, float maxDistance, std::vector<OctreeRayHit> &hits);
+
+size_t octreeNodeCount();
+size_t octreeCellCount();
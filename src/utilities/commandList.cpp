@@ -0,0 +1,271 @@
+#include "commandList.h"
+#include "profiler.h"
+#include <glad/glad.h>
+#include <glm/gtc/type_ptr.hpp>
+#include <algorithm>
+#include <cstring>
+#include <numeric>
+
+enum CommandType : uint8_t {
+    // State, kept per slot
+    COMMAND_INT,
+    COMMAND_VEC4,
+    COMMAND_MAT3,
+    COMMAND_MAT4,
+    COMMAND_VIEW,
+    COMMAND_VIEW_ROTATION,
+    COMMAND_PROJECTION,
+    COMMAND_TEXTURE,
+    COMMAND_VERTEX_ARRAY,
+    COMMAND_DEPTH_MASK,
+    // Draws
+    COMMAND_DRAW,
+    COMMAND_DRAW_MESHLETS
+};
+
+// Every command starts with this, followed by its value. Sizes are rounded up to 8 bytes so every
+// command stays aligned for the pointer in a meshlet draw.
+struct CommandHeader {
+    uint8_t type;
+    uint8_t slot;
+    uint16_t size; // Including the header
+    uint32_t padding;
+};
+
+struct MeshletDrawCommand {
+    const std::vector<Meshlet>* meshlets;
+    glm::mat4 model;
+    glm::mat4 inverseModel;
+};
+
+// Uniforms take the slots of their locations, then come the texture units and the rest of the state
+static const int textureSlot = commandUniformSlots;
+static const int vertexArraySlot = textureSlot + commandTextureSlots;
+static const int depthMaskSlot = vertexArraySlot + 1;
+static const int slotCount = depthMaskSlot + 1;
+static_assert(slotCount <= 64, "The dirty slots are kept in a 64 bit mask");
+
+static const uint32_t noCommand = ~0u;
+
+static MeshletDrawList meshletDrawList;
+
+
+static const void* payload(const CommandHeader* command) {
+    return command + 1;
+}
+
+static bool sameCommand(const CommandHeader* a, const CommandHeader* b) {
+    return a->type == b->type && a->size == b->size
+        && std::memcmp(payload(a), payload(b), a->size - sizeof(CommandHeader)) == 0;
+}
+
+static void append(CommandList &list, CommandType type, int slot, const void* value, size_t valueSize) {
+    CommandHeader header = {type, uint8_t(slot), uint16_t((sizeof(CommandHeader) + valueSize + 7) & ~size_t(7)), 0};
+    size_t offset = list.arena.size();
+    list.arena.resize(offset + header.size, 0);
+    std::memcpy(&list.arena[offset], &header, sizeof(header));
+    if (valueSize > 0) {
+        std::memcpy(&list.arena[offset + sizeof(header)], value, valueSize);
+    }
+
+    if (type < COMMAND_DRAW) {
+        // Leave the command out again if the slot is already set to the same thing
+        uint32_t previous = list.recordedAt[slot];
+        const CommandHeader* command = reinterpret_cast<const CommandHeader*>(&list.arena[offset]);
+        if (previous != noCommand && sameCommand(reinterpret_cast<const CommandHeader*>(&list.arena[previous]), command)) {
+            list.arena.resize(offset);
+            return;
+        }
+        list.recordedAt[slot] = offset;
+    }
+    if (!list.objects.empty()) {
+        list.objects.back().end = list.arena.size();
+    }
+}
+
+void beginCommandList(CommandList &list, int viewLocation, int projectionLocation) {
+    list.arena.clear();
+    list.objects.clear();
+    list.recordedAt.assign(slotCount, noCommand);
+    list.viewLocation = viewLocation;
+    list.projectionLocation = projectionLocation;
+}
+
+void beginCommandObject(CommandList &list, unsigned int passes) {
+    uint32_t offset = list.arena.size();
+    list.objects.push_back(CommandObject{offset, offset, passes});
+}
+
+void recordUniform(CommandList &list, int location, int value) {
+    int32_t stored = value;
+    append(list, COMMAND_INT, location, &stored, sizeof(stored));
+}
+
+void recordUniform(CommandList &list, int location, const glm::vec4 &value) {
+    append(list, COMMAND_VEC4, location, glm::value_ptr(value), sizeof(float) * 4);
+}
+
+void recordUniform(CommandList &list, int location, const glm::mat3 &value) {
+    append(list, COMMAND_MAT3, location, glm::value_ptr(value), sizeof(float) * 9);
+}
+
+void recordUniform(CommandList &list, int location, const glm::mat4 &value) {
+    append(list, COMMAND_MAT4, location, glm::value_ptr(value), sizeof(float) * 16);
+}
+
+void recordPassView(CommandList &list, int location, bool withoutTranslation) {
+    append(list, withoutTranslation ? COMMAND_VIEW_ROTATION : COMMAND_VIEW, location, nullptr, 0);
+}
+
+void recordTexture(CommandList &list, int unit, int textureID) {
+    int32_t stored = textureID;
+    append(list, COMMAND_TEXTURE, textureSlot + unit, &stored, sizeof(stored));
+}
+
+void recordVertexArray(CommandList &list, int vertexArrayObjectID) {
+    int32_t stored = vertexArrayObjectID;
+    append(list, COMMAND_VERTEX_ARRAY, vertexArraySlot, &stored, sizeof(stored));
+}
+
+void recordDepthMask(CommandList &list, bool enabled) {
+    int32_t stored = enabled;
+    append(list, COMMAND_DEPTH_MASK, depthMaskSlot, &stored, sizeof(stored));
+}
+
+void recordDraw(CommandList &list, unsigned int indexCount) {
+    uint32_t stored = indexCount;
+    append(list, COMMAND_DRAW, 0, &stored, sizeof(stored));
+}
+
+void recordMeshletDraw(CommandList &list, const std::vector<Meshlet>* meshlets, const glm::mat4 &model, const glm::mat4 &inverseModel) {
+    MeshletDrawCommand draw = {meshlets, model, inverseModel};
+    append(list, COMMAND_DRAW_MESHLETS, 0, &draw, sizeof(draw));
+}
+
+
+// The state the commands so far ask for, and what GL has
+struct ReplayState {
+    const CommandList* list;
+    const CommandPassConstants* constants;
+    glm::mat4 viewRotation;
+    glm::vec3 worldCamera;
+    const CommandHeader* wanted[slotCount];
+    const CommandHeader* applied[slotCount];
+    uint64_t dirty;
+};
+
+static void apply(const ReplayState &state, int slot, const CommandHeader* command) {
+    const void* value = payload(command);
+    int32_t number = 0;
+    if (command->size > sizeof(CommandHeader)) {
+        std::memcpy(&number, value, sizeof(number));
+    }
+    switch (command->type) {
+        case COMMAND_INT: glUniform1i(slot, number); break;
+        case COMMAND_VEC4: glUniform4fv(slot, 1, static_cast<const float*>(value)); break;
+        case COMMAND_MAT3: glUniformMatrix3fv(slot, 1, GL_FALSE, static_cast<const float*>(value)); break;
+        case COMMAND_MAT4: glUniformMatrix4fv(slot, 1, GL_FALSE, static_cast<const float*>(value)); break;
+        case COMMAND_VIEW: glUniformMatrix4fv(slot, 1, GL_FALSE, glm::value_ptr(state.constants->view)); break;
+        case COMMAND_VIEW_ROTATION: glUniformMatrix4fv(slot, 1, GL_FALSE, glm::value_ptr(state.viewRotation)); break;
+        case COMMAND_PROJECTION: glUniformMatrix4fv(slot, 1, GL_FALSE, glm::value_ptr(state.constants->projection)); break;
+        case COMMAND_TEXTURE: glBindTextureUnit(slot - textureSlot, number); break;
+        case COMMAND_VERTEX_ARRAY: glBindVertexArray(number); break;
+        case COMMAND_DEPTH_MASK: glDepthMask(number ? GL_TRUE : GL_FALSE); break;
+    }
+}
+
+// Brings GL up to date with what the commands ask for, right before a draw
+static void flush(ReplayState &state) {
+    for (int slot = 0; state.dirty != 0; slot++, state.dirty >>= 1) {
+        if (!(state.dirty & 1)) {
+            continue;
+        }
+        const CommandHeader* wanted = state.wanted[slot];
+        const CommandHeader* applied = state.applied[slot];
+        if (applied == nullptr || !sameCommand(applied, wanted)) {
+            apply(state, slot, wanted);
+            state.applied[slot] = wanted;
+        }
+    }
+}
+
+static void countDraw(unsigned int indexCount) {
+    addProfileCounter("draw calls", 1);
+    addProfileCounter("triangles", indexCount / 3);
+}
+
+static void draw(ReplayState &state, const CommandHeader* command) {
+    flush(state);
+    if (command->type == COMMAND_DRAW) {
+        uint32_t indexCount;
+        std::memcpy(&indexCount, payload(command), sizeof(indexCount));
+        glDrawElements(GL_TRIANGLES, indexCount, GL_UNSIGNED_INT, nullptr);
+        countDraw(indexCount);
+        return;
+    }
+
+    // Cone culling is done in object space, so move the camera there instead of moving every cone
+    const MeshletDrawCommand* meshletDraw = static_cast<const MeshletDrawCommand*>(payload(command));
+    glm::vec3 objectCamera = glm::vec3(meshletDraw->inverseModel * glm::vec4(state.worldCamera, 1));
+    const CommandPassConstants &constants = *state.constants;
+
+    meshletDrawList.counts.clear();
+    meshletDrawList.offsets.clear();
+    cullMeshlets(*meshletDraw->meshlets, constants.projection * constants.view * meshletDraw->model, objectCamera, meshletDrawList);
+    if (!meshletDrawList.counts.empty()) {
+        glMultiDrawElements(GL_TRIANGLES, meshletDrawList.counts.data(), GL_UNSIGNED_INT,
+                            meshletDrawList.offsets.data(), meshletDrawList.counts.size());
+        countDraw(std::accumulate(meshletDrawList.counts.begin(), meshletDrawList.counts.end(), 0));
+    }
+}
+
+static void replayRange(ReplayState &state, uint32_t begin, uint32_t end, bool drawn) {
+    const unsigned char* arena = state.list->arena.data();
+    for (uint32_t offset = begin; offset < end;) {
+        const CommandHeader* command = reinterpret_cast<const CommandHeader*>(arena + offset);
+        offset += command->size;
+        if (command->type < COMMAND_DRAW) {
+            state.wanted[command->slot] = command;
+            state.dirty |= uint64_t(1) << command->slot;
+        } else if (drawn) {
+            draw(state, command);
+        }
+    }
+}
+
+void replayCommandList(const CommandList &list, const CommandPassConstants &constants) {
+    ReplayState state;
+    state.list = &list;
+    state.constants = &constants;
+    state.viewRotation = glm::mat4(glm::mat3(constants.view));
+    state.worldCamera = glm::vec3(glm::inverse(constants.view)[3]);
+    std::fill(state.wanted, state.wanted + slotCount, nullptr);
+    std::fill(state.applied, state.applied + slotCount, nullptr);
+    state.dirty = 0;
+
+    // The pass's own camera comes first, for the objects to override
+    const CommandHeader passCommands[2] = {
+        {COMMAND_VIEW, uint8_t(list.viewLocation), sizeof(CommandHeader), 0},
+        {COMMAND_PROJECTION, uint8_t(list.projectionLocation), sizeof(CommandHeader), 0}
+    };
+    for (const CommandHeader &command : passCommands) {
+        state.wanted[command.slot] = &command;
+        state.dirty |= uint64_t(1) << command.slot;
+    }
+
+    // Anything recorded before the first object is state for all of them
+    replayRange(state, 0, list.objects.empty() ? list.arena.size() : list.objects.front().begin, false);
+
+    size_t nextVisible = 0;
+    const std::vector<unsigned int> &visible = *constants.visible;
+    for (uint32_t i = 0; i < list.objects.size(); i++) {
+        const CommandObject &object = list.objects[i];
+        bool seen = nextVisible < visible.size() && visible[nextVisible] == i;
+        if (seen) {
+            nextVisible++;
+        }
+        replayRange(state, object.begin, object.end, seen && (object.passes & constants.pass));
+    }
+    // Leave GL as the end of the list has it, so state put back after a draw (the depth mask) is not lost
+    flush(state);
+}
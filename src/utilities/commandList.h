@@ -0,0 +1,74 @@
+#pragma once
+
+#include "meshlets.h"
+#include <glm/glm.hpp>
+#include <cstdint>
+#include <vector>
+
+// Draw commands recorded once per frame and replayed for every pass. Recording goes through the scene and
+// writes what each object needs (uniform values, bound textures, its vertex array and the draw) into one flat
+// array, leaving out state that is the same as for the object before. Replaying only has to walk that array.
+// What differs between passes (the camera, which objects it sees) comes in with the replay.
+
+// Passes an object is drawn in, as bits
+enum CommandPass {
+    COMMAND_PASS_MAIN = 1,
+    COMMAND_PASS_REFLECTION = 2,
+    COMMAND_PASS_ALL = COMMAND_PASS_MAIN | COMMAND_PASS_REFLECTION
+};
+
+// The commands of one object, a range of the arena
+struct CommandObject {
+    uint32_t begin;
+    uint32_t end;
+    unsigned int passes;
+};
+
+// Uniform locations below 32, texture units below 16
+static const int commandUniformSlots = 32;
+static const int commandTextureSlots = 16;
+
+struct CommandList {
+    std::vector<unsigned char> arena;
+    std::vector<CommandObject> objects;
+    int viewLocation;
+    int projectionLocation;
+
+    // The last value recorded for every slot, to leave out ones that do not change
+    std::vector<uint32_t> recordedAt; // Arena offset of the command that set it, or ~0 for none yet
+};
+
+// Clears the list for recording. The pass's view and projection are set at the given uniform locations.
+void beginCommandList(CommandList &list, int viewLocation, int projectionLocation);
+
+// Commands after this belong to a new object, up to the next one. Objects are numbered from 0 in the order
+// they are recorded, which is what the visible lists given to replayCommandList() refer to.
+void beginCommandObject(CommandList &list, unsigned int passes = COMMAND_PASS_ALL);
+
+void recordUniform(CommandList &list, int location, int value);
+void recordUniform(CommandList &list, int location, const glm::vec4 &value);
+void recordUniform(CommandList &list, int location, const glm::mat3 &value);
+void recordUniform(CommandList &list, int location, const glm::mat4 &value);
+// The pass's view matrix, with or without its translation (for the skybox)
+void recordPassView(CommandList &list, int location, bool withoutTranslation);
+void recordTexture(CommandList &list, int unit, int textureID);
+void recordVertexArray(CommandList &list, int vertexArrayObjectID);
+void recordDepthMask(CommandList &list, bool enabled);
+
+void recordDraw(CommandList &list, unsigned int indexCount);
+// Culls the meshlets against the camera of each pass before drawing what is left of them. The list keeps
+// the pointer, so the meshlets have to outlive it. The inverse model matrix moves the camera into object space.
+void recordMeshletDraw(CommandList &list, const std::vector<Meshlet>* meshlets, const glm::mat4 &model, const glm::mat4 &inverseModel);
+
+// What a pass brings to the replay
+struct CommandPassConstants {
+    glm::mat4 view;
+    glm::mat4 projection;
+    unsigned int pass;                     // One of CommandPass
+    const std::vector<unsigned int>* visible; // Objects the pass sees, in increasing order
+};
+
+// Issues the commands of the objects the pass sees. State of the objects it skips still counts, so nothing
+// depends on which objects came before. Nothing is assumed about the GL state beforehand, and GL calls that
+// would set what is already set are left out. Afterwards GL is left with the state at the end of the list.
+void replayCommandList(const CommandList &list, const CommandPassConstants &constants);
@@ -0,0 +1,138 @@
+#include "frameLatency.h"
+#include "profiler.h"
+#include <glad/glad.h>
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+// Frames measured at once, more than a driver left to itself queues up
+static const unsigned int measuredFrames = 8;
+// Starting just in time plans for the slowest of this many recent frames, plus the margin
+static const unsigned int plannedFrames = 16;
+static const double startMarginMs = 1.5;
+
+struct FrameInFlight {
+    GLsync fence;       // Null once the frame is measured
+    GLuint query;       // Timestamp of when the GPU got through the frame
+    double inputTime;
+    double clockOffset; // CPU time minus GPU time when the frame was finished
+};
+
+static bool initialised = false;
+static std::chrono::steady_clock::time_point startTime;
+static std::vector<FrameInFlight> frames; // By frame number modulo their count
+static unsigned long long frameIndex = 0;
+static unsigned int framesInFlightLimit = 0;
+static double refreshPeriod = 0; // Milliseconds, 0 when not starting just in time
+
+static double recentLatencies[plannedFrames];
+static unsigned int latencyCount = 0;
+static double smoothedLatency = 0;
+
+
+static double now() {
+    std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - startTime;
+    return elapsed.count();
+}
+
+// Reads back the latency of a frame once the GPU is done with it. Without waiting, frames still
+// on the GPU are left for later.
+static void finishFrame(FrameInFlight &frame, bool wait) {
+    if (!frame.fence) {
+        return;
+    }
+    GLenum status;
+    do {
+        status = glClientWaitSync(frame.fence, wait ? GL_SYNC_FLUSH_COMMANDS_BIT : 0, wait ? 100000000 : 0);
+    } while (wait && status == GL_TIMEOUT_EXPIRED);
+    if (status == GL_TIMEOUT_EXPIRED) {
+        return;
+    }
+    glDeleteSync(frame.fence);
+    frame.fence = nullptr;
+    if (status == GL_WAIT_FAILED) {
+        return;
+    }
+
+    GLint64 gpuDone = 0;
+    glGetQueryObjecti64v(frame.query, GL_QUERY_RESULT, &gpuDone);
+    double latency = gpuDone / 1e6 + frame.clockOffset - frame.inputTime;
+    recentLatencies[latencyCount++ % plannedFrames] = latency;
+    smoothedLatency = smoothedLatency > 0 ? 0.95 * smoothedLatency + 0.05 * latency : latency;
+    addProfileCounter("input latency (ms)", latency);
+}
+
+void initFrameLatency(unsigned int maxFramesInFlight, bool justInTime, double refreshRate) {
+    startTime = std::chrono::steady_clock::now();
+    refreshPeriod = justInTime && refreshRate > 0 ? 1000.0 / refreshRate : 0;
+    // Planning the start only makes sense right after the frame before is done
+    framesInFlightLimit = refreshPeriod > 0 ? 1 : maxFramesInFlight;
+    frames.assign(std::max(measuredFrames, maxFramesInFlight), FrameInFlight{nullptr, 0, 0, 0});
+    for (FrameInFlight &frame : frames) {
+        glCreateQueries(GL_TIMESTAMP, 1, &frame.query);
+    }
+    frameIndex = 0;
+    latencyCount = 0;
+    smoothedLatency = 0;
+    initialised = true;
+}
+
+void shutdownFrameLatency() {
+    for (FrameInFlight &frame : frames) {
+        if (frame.fence) {
+            glDeleteSync(frame.fence);
+        }
+        glDeleteQueries(1, &frame.query);
+    }
+    frames.clear();
+    initialised = false;
+}
+
+void waitForFrameStart() {
+    if (!initialised) {
+        return;
+    }
+    // The GPU finishes frames in order, so going from the oldest means every wait is for the next one to finish
+    unsigned long long oldest = frameIndex > frames.size() ? frameIndex - frames.size() : 0;
+    for (unsigned long long i = oldest; i < frameIndex; i++) {
+        bool mustBeDone = framesInFlightLimit > 0 && i + framesInFlightLimit <= frameIndex;
+        finishFrame(frames[i % frames.size()], mustBeDone);
+    }
+
+    // The last frame is through, and vsync will hold this one until the next refresh anyway. Rather than
+    // reading input now and having it sit there, wait until there is just enough time left to make it.
+    if (refreshPeriod > 0 && latencyCount >= plannedFrames) {
+        double slowest = *std::max_element(recentLatencies, recentLatencies + plannedFrames);
+        double slack = refreshPeriod - slowest - startMarginMs;
+        if (slack > 0) {
+            std::this_thread::sleep_for(std::chrono::duration<double, std::milli>(slack));
+        }
+    }
+}
+
+double markInputSampled() {
+    return now();
+}
+
+void endFrameLatency(double inputTime) {
+    if (!initialised) {
+        return;
+    }
+    FrameInFlight &frame = frames[frameIndex % frames.size()];
+    if (frame.fence) {
+        // The driver has queued up more frames than we keep track of, this one goes unmeasured
+        glDeleteSync(frame.fence);
+    }
+    GLint64 gpuTime = 0;
+    glGetInteger64v(GL_TIMESTAMP, &gpuTime);
+    frame.clockOffset = now() - gpuTime / 1e6;
+    glQueryCounter(frame.query, GL_TIMESTAMP);
+    frame.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    frame.inputTime = inputTime;
+    frameIndex++;
+}
+
+double inputLatencyMs() {
+    return smoothedLatency;
+}
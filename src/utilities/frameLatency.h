@@ -0,0 +1,25 @@
+#pragma once
+
+// Keeps the time from reading input to the frame showing it short. The driver is otherwise free to queue up
+// several frames, each one drawn from input that is older by the time it reaches the screen. A fence after
+// every frame lets us hold the CPU back until only so many frames are still on the GPU, and the latency of
+// every frame (input read to GPU done, which is as close to the photons as GL gets) is measured with a
+// timestamp query.
+
+// Needs the GL context, and so does everything below apart from markInputSampled(). maxFramesInFlight of 0 leaves the queue to the driver, and only measures.
+// With justInTime, each frame also starts as late as it can while still making the next refresh, by how long
+// the last frames took. That only works with vsync, at the given refresh rate (0 turns it off), and it
+// allows just one frame in flight.
+void initFrameLatency(unsigned int maxFramesInFlight, bool justInTime, double refreshRate);
+void shutdownFrameLatency();
+
+// Call at the start of the frame, right before polling input. Blocks until the frame may start.
+void waitForFrameStart();
+// Call once input is read, the latency of the frame counts from the time this returns. Takes no GL, so it
+// can be called on a thread other than the one drawing.
+double markInputSampled();
+// Call right after swapping buffers, with the time markInputSampled() gave for the input the frame shows
+void endFrameLatency(double inputTime);
+
+// Smoothed input to GPU done latency in milliseconds, 0 until the first frames are measured
+double inputLatencyMs();
@@ -1,6 +1,23 @@
 #include <iostream>
+#include <cstddef>
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/type_ptr.hpp>
 #include "glfont.h"
 
+// Fills in the 4 corners and texture coordinates of the quad for one character
+static void characterQuad(char character, float x, float y, float characterWidth, float characterHeight,
+                          glm::vec3* vertices, glm::vec2* uvs) {
+    vertices[0] = {x, y, 0};
+    vertices[1] = {x + characterWidth, y, 0};
+    vertices[2] = {x + characterWidth, y + characterHeight, 0};
+    vertices[3] = {x, y + characterHeight, 0};
+
+    uvs[0] = {(float)(character/128.0), 0}; // lower left
+    uvs[1] = {(float)((character+1)/128.0), 0}; // lower right
+    uvs[2] = {(float)((character+1)/128.0), 1}; // upper right
+    uvs[3] = {(float)(character/128.0), 1}; // upper left
+}
+
 Mesh generateTextGeometryBuffer(std::string text, float characterHeightOverWidth, float totalTextWidth) {
     float characterWidth = totalTextWidth / float(text.length());
     float characterHeight = characterHeightOverWidth * characterWidth;
@@ -18,27 +35,132 @@ Mesh generateTextGeometryBuffer(std::string text, float characterHeightOverWidth
     {
         float baseXCoordinate = float(i) * characterWidth;
 
-        mesh.vertices.at(4 * i + 0) = {baseXCoordinate, 0, 0};
-        mesh.vertices.at(4 * i + 1) = {baseXCoordinate + characterWidth, 0, 0};
-        mesh.vertices.at(4 * i + 2) = {baseXCoordinate + characterWidth, characterHeight, 0};
+        characterQuad(text[i], baseXCoordinate, 0, characterWidth, characterHeight,
+                      &mesh.vertices[4 * i], &mesh.textureCoordinates[4 * i]);
+
+        mesh.indices[6 * i + 0] = 4 * i + 0;
+        mesh.indices[6 * i + 1] = 4 * i + 1;
+        mesh.indices[6 * i + 2] = 4 * i + 2;
+        mesh.indices[6 * i + 3] = 4 * i + 0;
+        mesh.indices[6 * i + 4] = 4 * i + 2;
+        mesh.indices[6 * i + 5] = 4 * i + 3;
+    }
+
+    return mesh;
+}
+
 
-        mesh.vertices.at(4 * i + 0) = {baseXCoordinate, 0, 0};
-        mesh.vertices.at(4 * i + 2) = {baseXCoordinate + characterWidth, characterHeight, 0};
-        mesh.vertices.at(4 * i + 3) = {baseXCoordinate, characterHeight, 0};
+// The streaming buffer is split in a ring of regions, one per frame in flight.
+// A fence per region makes sure we never overwrite text the GPU has not drawn yet.
+static const unsigned int textRingRegions = 3;
 
+struct TextVertex {
+    glm::vec3 position;
+    glm::vec2 textureCoordinates;
+};
 
-        mesh.indices.at(6 * i + 0) = 4 * i + 0;
-        mesh.indices.at(6 * i + 1) = 4 * i + 1;
-        mesh.indices.at(6 * i + 2) = 4 * i + 2;
-        mesh.indices.at(6 * i + 3) = 4 * i + 0;
-        mesh.indices.at(6 * i + 4) = 4 * i + 2;
-        mesh.indices.at(6 * i + 5) = 4 * i + 3;
+static GLuint textVAO = 0;
+static GLuint textCharmapID = 0;
+static TextVertex* textMappedVertices = nullptr;
+static GLsync textRegionFences[textRingRegions] = {};
+static unsigned int textMaxCharacters = 0;
+static unsigned int textCurrentRegion = 0;
+static unsigned int textCharacterCount = 0;
+static bool textRegionReady = false;
 
-        mesh.textureCoordinates.at(4 * i + 0) = {(float)(text[i]/128.0), 0}; // lower left
-        mesh.textureCoordinates.at(4 * i + 1) = {(float)((text[i]+1)/128.0), 0}; // lower right
-        mesh.textureCoordinates.at(4 * i + 2) = {(float)((text[i]+1)/128.0), 1}; // upper left
-        mesh.textureCoordinates.at(4 * i + 3) = {(float)(text[i]/128.0), 1}; // upper right
+void initTextRenderer(GLuint charmapTextureID, unsigned int maxCharactersPerFrame) {
+    textCharmapID = charmapTextureID;
+    textMaxCharacters = maxCharactersPerFrame;
+
+    glGenVertexArrays(1, &textVAO);
+    glBindVertexArray(textVAO);
+
+    GLuint vertexBufferID;
+    glGenBuffers(1, &vertexBufferID);
+    glBindBuffer(GL_ARRAY_BUFFER, vertexBufferID);
+    GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+    GLsizeiptr bufferSize = textRingRegions * 4 * maxCharactersPerFrame * sizeof(TextVertex);
+    glBufferStorage(GL_ARRAY_BUFFER, bufferSize, nullptr, flags);
+    textMappedVertices = (TextVertex*)glMapBufferRange(GL_ARRAY_BUFFER, 0, bufferSize, flags);
+
+    // Same layout as generateBuffer(), so the text goes through the regular 2D path of the shader
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(TextVertex), (void*)offsetof(TextVertex, position));
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(TextVertex), (void*)offsetof(TextVertex, textureCoordinates));
+    glEnableVertexAttribArray(2);
+
+    // The index pattern never changes, so it is uploaded once and shared by every region through the base vertex
+    std::vector<unsigned int> indices(6 * maxCharactersPerFrame);
+    for (unsigned int i = 0; i < maxCharactersPerFrame; i++) {
+        indices[6 * i + 0] = 4 * i + 0;
+        indices[6 * i + 1] = 4 * i + 1;
+        indices[6 * i + 2] = 4 * i + 2;
+        indices[6 * i + 3] = 4 * i + 0;
+        indices[6 * i + 4] = 4 * i + 2;
+        indices[6 * i + 5] = 4 * i + 3;
     }
+    GLuint indexBufferID;
+    glGenBuffers(1, &indexBufferID);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBufferID);
+    glBufferStorage(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), indices.data(), 0);
 
-    return mesh;
-}
\ No newline at end of file
+    glBindVertexArray(0);
+}
+
+void drawText(const char* text, float x, float y, float characterWidth, float characterHeightOverWidth) {
+    if (textMappedVertices == nullptr) {
+        return;
+    }
+
+    // Wait until the GPU is done with the region before writing the first character of the frame into it
+    if (!textRegionReady) {
+        GLsync fence = textRegionFences[textCurrentRegion];
+        if (fence) {
+            glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, GLuint64(1000000000));
+            glDeleteSync(fence);
+            textRegionFences[textCurrentRegion] = nullptr;
+        }
+        textRegionReady = true;
+    }
+
+    TextVertex* region = textMappedVertices + textCurrentRegion * 4 * textMaxCharacters;
+    float characterHeight = characterHeightOverWidth * characterWidth;
+    for (const char* c = text; *c != '\0' && textCharacterCount < textMaxCharacters; c++) {
+        glm::vec3 vertices[4];
+        glm::vec2 uvs[4];
+        characterQuad(*c, x, y, characterWidth, characterHeight, vertices, uvs);
+
+        TextVertex* quad = region + 4 * textCharacterCount;
+        for (int i = 0; i < 4; i++) {
+            quad[i].position = vertices[i];
+            quad[i].textureCoordinates = uvs[i];
+        }
+        x += characterWidth;
+        textCharacterCount++;
+    }
+}
+
+void flushText(int windowWidth, int windowHeight) {
+    if (textCharacterCount == 0) {
+        return;
+    }
+
+    // The 2D path of the shader skips V and P, so M takes us from pixels straight to clip space
+    glm::mat4 pixelsToClip = glm::ortho(0.0f, float(windowWidth), 0.0f, float(windowHeight), -1.0f, 1.0f);
+    glUniformMatrix4fv(3, 1, GL_FALSE, glm::value_ptr(pixelsToClip)); // M
+    glUniform1i(6, 1); // do_texture
+    glUniform1i(7, 1); // is_2d
+    glUniform4f(15, 1, 1, 0, 0); // uv_transform, whatever the last node drew with its atlas region
+    glBindTextureUnit(0, textCharmapID);
+
+    glDisable(GL_DEPTH_TEST);
+    glBindVertexArray(textVAO);
+    glDrawElementsBaseVertex(GL_TRIANGLES, 6 * textCharacterCount, GL_UNSIGNED_INT, nullptr,
+                             textCurrentRegion * 4 * textMaxCharacters);
+    glEnable(GL_DEPTH_TEST);
+
+    textRegionFences[textCurrentRegion] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    textCurrentRegion = (textCurrentRegion + 1) % textRingRegions;
+    textCharacterCount = 0;
+    textRegionReady = false;
+}
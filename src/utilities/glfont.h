@@ -1,6 +1,18 @@
 #pragma once
 
 #include <string>
+#include <glad/glad.h>
 #include "mesh.h"
 
-Mesh generateTextGeometryBuffer(std::string text, float characterHeightOverWidth, float totalTextWidth);
\ No newline at end of file
+Mesh generateTextGeometryBuffer(std::string text, float characterHeightOverWidth, float totalTextWidth);
+
+// Streaming text renderer for text that changes every frame (FPS counters and such).
+// Every drawText() call in a frame is written straight into a persistently mapped buffer,
+// and flushText() draws all of it with a single draw call. Nothing is allocated per frame.
+void initTextRenderer(GLuint charmapTextureID, unsigned int maxCharactersPerFrame = 4096);
+
+// x and y are the lower left corner of the text, in pixels from the lower left corner of the window
+void drawText(const char* text, float x, float y, float characterWidth, float characterHeightOverWidth = 39.0f / 29.0f);
+
+// Draws everything queued since the last flush. Expects the basic shader to be active.
+void flushText(int windowWidth, int windowHeight);
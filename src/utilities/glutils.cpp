@@ -5,8 +5,13 @@
 #include <glad/glad.h>
 #include <program.hpp>
 #include "glutils.h"
+#include "imageOps.h"
+#include "textureCompression.h"
+#include <algorithm>
+#include <thread>
 #include <vector>
 #include <iostream>
+#include <sys/stat.h>
 #define STB_IMAGE_IMPLEMENTATION
 #include <stb_image.h>
 
@@ -102,34 +107,96 @@ unsigned int generateBuffer(Mesh &mesh) {
     return vaoID;
 }
 
-// I borrowed this from the opencl tutorial, if I need to reimplement it myself I can do that as well
-void loadCubeMap(GLuint *unbound_int, std::vector<std::string> faces){
-    glGenTextures(1, unbound_int);
-    glBindTexture(GL_TEXTURE_CUBE_MAP, *unbound_int);
+static long long modificationTime(const std::string &fileName) {
+    struct stat info;
+    if (stat(fileName.c_str(), &info) != 0) {
+        return -1;
+    }
+    return (long long)info.st_mtime;
+}
 
-    int width, height, nrChannels; // (Cubemap width and height is 2048)
-    for (unsigned int i = 0; i < faces.size(); i++)
-    {
-        unsigned char *data = stbi_load(faces[i].c_str(), &width, &height, &nrChannels, 0);
-        if (data)
-        {
-            glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 
-                         0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, data
-            );
+// Decodes and block compresses the six faces on one thread each, and packs them into one texture
+static bool buildCubeMap(const std::vector<std::string> &faces, BlockFormat format, CompressedTexture &cube) {
+    std::vector<CompressedTexture> compressedFaces(faces.size());
+    std::vector<char> loaded(faces.size(), false); // Not vector<bool>, the threads write it concurrently
+    std::vector<std::thread> workers;
+    for (unsigned int i = 0; i < faces.size(); i++) {
+        workers.emplace_back([&, i] {
+            // Whatever number of channels the file has is expanded to RGBA
+            int width, height, nrChannels;
+            unsigned char *data = stbi_load(faces[i].c_str(), &width, &height, &nrChannels, 0);
+            if (!data) {
+                std::cout << "Cubemap tex failed to load at path: " << faces[i] << std::endl;
+                return;
+            }
+            std::vector<unsigned char> rgba(4 * (size_t)width * height);
+            expandToRGBA(data, nrChannels, (size_t)width * height, rgba.data());
             stbi_image_free(data);
+            compressedFaces[i] = compressTexture(rgba.data(), width, height, format);
+            loaded[i] = true;
+        });
+    }
+    for (std::thread &worker : workers) {
+        worker.join();
+    }
+
+    for (unsigned int i = 0; i < faces.size(); i++) {
+        if (!loaded[i] || compressedFaces[i].width != compressedFaces[0].width || compressedFaces[i].height != compressedFaces[0].height) {
+            return false;
         }
-        else
-        {
-            std::cout << "Cubemap tex failed to load at path: " << faces[i] << std::endl;
-            stbi_image_free(data);
+    }
+
+    cube.format = format;
+    cube.width = compressedFaces[0].width;
+    cube.height = compressedFaces[0].height;
+    cube.faceCount = faces.size();
+    cube.levels.assign(compressedFaces[0].levels.size(), {});
+    for (unsigned int level = 0; level < cube.levels.size(); level++) {
+        for (const CompressedTexture &face : compressedFaces) {
+            cube.levels[level].insert(cube.levels[level].end(), face.levels[level].begin(), face.levels[level].end());
         }
     }
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);  
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);  
+    return true;
+}
+
+// The first load writes all faces and mips to cubemap.ktx2 next to the faces, later loads only read that file
+void loadCubeMap(GLuint *unbound_int, std::vector<std::string> faces){
+    std::string directory = faces[0].substr(0, faces[0].rfind('/') + 1);
+    std::string cacheFileName = directory + "cubemap.ktx2";
+    BlockFormat format = GLAD_GL_EXT_texture_compression_s3tc ? BLOCK_BC1 : BLOCK_BC7;
 
+    long long newestFace = -1;
+    for (const std::string &face : faces) {
+        newestFace = std::max(newestFace, modificationTime(face));
+    }
+
+    CompressedTexture cube;
+    bool cached = modificationTime(cacheFileName) >= newestFace && readKTX2(cacheFileName, cube)
+                  && cube.faceCount == faces.size() && cube.format == format;
+    if (!cached) {
+        if (!buildCubeMap(faces, format, cube)) {
+            *unbound_int = 0;
+            return;
+        }
+        if (!writeKTX2(cacheFileName, cube)) {
+            std::cout << "Could not write cubemap cache " << cacheFileName << std::endl;
+        }
+    }
+
+    GLenum internalFormat = glInternalFormat(cube.format);
+    glCreateTextures(GL_TEXTURE_CUBE_MAP, 1, unbound_int);
+    glTextureStorage2D(*unbound_int, cube.levels.size(), internalFormat, cube.width, cube.height);
+    for (unsigned int level = 0; level < cube.levels.size(); level++) {
+        // Cube map faces are layers to the DSA functions, so every level is one upload
+        glCompressedTextureSubImage3D(*unbound_int, level, 0, 0, 0,
+                                      std::max(1u, cube.width >> level), std::max(1u, cube.height >> level), cube.faceCount,
+                                      internalFormat, cube.levels[level].size(), cube.levels[level].data());
+    }
+    glTextureParameteri(*unbound_int, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTextureParameteri(*unbound_int, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTextureParameteri(*unbound_int, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTextureParameteri(*unbound_int, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTextureParameteri(*unbound_int, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
 }
 
 
@@ -172,10 +239,12 @@ void initDynamicCube(GLuint *cubemap, GLuint *framebuffer, GLuint *depthbuffer){
 }
 
 
-void getDynamicCubeSides(GLuint cubemap, int face, glm::mat4 *projection, glm::mat4 *view, glm::vec3 cameraPosition){
+void attachDynamicCubeSide(GLuint cubemap, int face){
     // attach new texture and renderbuffer to fbo 
     glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, (GL_TEXTURE_CUBE_MAP_POSITIVE_X + (int)face), cubemap, 0);
-        
+}
+
+void getDynamicCubeSides(int face, glm::mat4 *projection, glm::mat4 *view, glm::vec3 cameraPosition){
     //Change aspect ratio into nice squares
     *projection =  glm::perspective(glm::radians(90.0f), 1.0f, 0.1f, 350.f); 
 
@@ -4,7 +4,13 @@
 #include <vector>
 
 unsigned int generateBuffer(Mesh &mesh);
+// One tangent and bitangent per vertex, for the normal maps
+void computeTangentBasis(std::vector<glm::vec3> &vertices, std::vector<glm::vec2> &uvs, std::vector<glm::vec3> &normals,
+                         std::vector<glm::vec3> &tangents, std::vector<glm::vec3> &bitangents);
 void loadCubeMap(GLuint *unbound_int, std::vector<std::string> faces);
 void initDynamicCube(GLuint *cubemap, GLuint *framebuffer, GLuint *depthbuffer);
-void getDynamicCubeSides(GLuint cubemap, int face, glm::mat4 *projection, glm::mat4 *view, glm::vec3 cameraPosition);
+// The camera of one face of the dynamic cube map, no GL involved
+void getDynamicCubeSides(int face, glm::mat4 *projection, glm::mat4 *view, glm::vec3 cameraPosition);
+// Points the bound framebuffer at one face of the cube map
+void attachDynamicCubeSide(GLuint cubemap, int face);
 void endDynamicCubeMap();
\ No newline at end of file
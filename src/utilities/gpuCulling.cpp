@@ -0,0 +1,283 @@
+#include "gpuCulling.h"
+#include "profiler.h"
+#include "shader.hpp"
+#include "glutils.h"
+#include <glad/glad.h>
+#include <glm/gtc/type_ptr.hpp>
+#include <algorithm>
+#include <cstdint>
+#include <numeric>
+#include <vector>
+
+// Same as in cull.comp and simple.vert
+static const GLuint objectBufferBinding = 4;
+static const GLuint meshBufferBinding = 5;
+static const GLuint drawBufferBinding = 6;
+static const GLuint drawCountBufferBinding = 7;
+static const GLuint objectIndexAttribute = 5;
+static const unsigned int cullGroupSize = 64;
+
+struct GPUObject {
+    glm::mat4 model;
+    glm::vec4 normalMatrix[3]; // Columns, padded the way std430 pads a mat3
+    glm::vec4 uvTransform;
+    glm::vec4 sphere;          // Center and radius
+    uint32_t mesh;
+    int32_t materialID;
+    uint32_t flags;
+    uint32_t passes;
+};
+
+struct GPUMesh {
+    uint32_t indexCount;
+    uint32_t firstIndex;
+    int32_t baseVertex;
+    uint32_t padding;
+};
+
+// What glMultiDrawElementsIndirect() reads for every draw
+struct DrawElementsCommand {
+    uint32_t count;
+    uint32_t instanceCount;
+    uint32_t firstIndex;
+    int32_t baseVertex;
+    uint32_t baseInstance; // The object, which the per instance object index picks up
+};
+
+// The meshes are collected here until initGPUCulling() uploads them
+static std::vector<glm::vec3> poolPositions;
+static std::vector<glm::vec3> poolNormals;
+static std::vector<glm::vec2> poolTextureCoordinates;
+static std::vector<glm::vec3> poolTangents;
+static std::vector<glm::vec3> poolBitangents;
+static std::vector<unsigned int> poolIndices;
+static std::vector<GPUMesh> meshes;
+
+static GLuint vertexArrayID = 0;
+static std::vector<GLuint> meshBufferIDs; // The vertex and index buffers of the VAO, and the mesh table
+static GLuint meshBufferID = 0;
+static GLuint drawCountBufferID = 0;
+static Gloom::Shader* cullShader = nullptr;
+static bool haveDrawCount = false;
+
+static std::vector<GPUObject> objects;
+static size_t objectCapacity = 0;
+static GLuint objectBufferID = 0;
+static GLuint objectIndexBufferID = 0; // 0, 1, 2, ... so every draw's base instance reaches the shader
+static GLuint drawBufferID = 0;        // A list of objectCapacity draws for every pass
+static size_t culledObjectCount = 0;   // The draw lists are this far apart, as culled
+
+
+template <class T>
+static void appendAttribute(std::vector<T> &pool, const std::vector<T> &data, size_t vertexCount) {
+    // Attributes a mesh does not have are left zero, so every attribute stays indexed the same
+    size_t start = pool.size();
+    pool.resize(start + vertexCount, T(0));
+    std::copy_n(data.begin(), std::min(vertexCount, data.size()), pool.begin() + start);
+}
+
+int addGPUMesh(Mesh &mesh) {
+    size_t vertexCount = mesh.vertices.size();
+    std::vector<glm::vec3> tangents;
+    std::vector<glm::vec3> bitangents;
+    if (mesh.normals.size() > 0 && mesh.textureCoordinates.size() > 0) {
+        computeTangentBasis(mesh.vertices, mesh.textureCoordinates, mesh.normals, tangents, bitangents);
+    }
+
+    GPUMesh gpuMesh = {uint32_t(mesh.indices.size()), uint32_t(poolIndices.size()), int32_t(poolPositions.size()), 0};
+    appendAttribute(poolPositions, mesh.vertices, vertexCount);
+    appendAttribute(poolNormals, mesh.normals, vertexCount);
+    appendAttribute(poolTextureCoordinates, mesh.textureCoordinates, vertexCount);
+    appendAttribute(poolTangents, tangents, vertexCount);
+    appendAttribute(poolBitangents, bitangents, vertexCount);
+    poolIndices.insert(poolIndices.end(), mesh.indices.begin(), mesh.indices.end());
+    meshes.push_back(gpuMesh);
+    return meshes.size() - 1;
+}
+
+template <class T>
+static GLuint createStaticBuffer(const std::vector<T> &data) {
+    GLuint bufferID;
+    glCreateBuffers(1, &bufferID);
+    glNamedBufferStorage(bufferID, std::max<size_t>(data.size() * sizeof(T), 1), data.data(), 0);
+    meshBufferIDs.push_back(bufferID);
+    return bufferID;
+}
+
+// Same attribute locations as generateBuffer()
+template <class T>
+static void addVertexAttribute(GLuint index, GLint elementsPerEntry, const std::vector<T> &data, bool normalize) {
+    glVertexArrayVertexBuffer(vertexArrayID, index, createStaticBuffer(data), 0, sizeof(T));
+    glVertexArrayAttribFormat(vertexArrayID, index, elementsPerEntry, GL_FLOAT, normalize ? GL_TRUE : GL_FALSE, 0);
+    glVertexArrayAttribBinding(vertexArrayID, index, index);
+    glEnableVertexArrayAttrib(vertexArrayID, index);
+}
+
+template <class T>
+static void freeVector(std::vector<T> &data) {
+    std::vector<T>().swap(data);
+}
+
+void initGPUCulling() {
+    // Without a draw count read from a buffer, every draw of the list is issued and the unused ones draw nothing
+    haveDrawCount = GLAD_GL_VERSION_4_6 || GLAD_GL_ARB_indirect_parameters;
+
+    glCreateVertexArrays(1, &vertexArrayID);
+    addVertexAttribute(0, 3, poolPositions, false);
+    addVertexAttribute(1, 3, poolNormals, true);
+    addVertexAttribute(2, 2, poolTextureCoordinates, false);
+    addVertexAttribute(3, 3, poolTangents, true);
+    addVertexAttribute(4, 3, poolBitangents, true);
+    glVertexArrayElementBuffer(vertexArrayID, createStaticBuffer(poolIndices));
+    meshBufferID = createStaticBuffer(meshes);
+
+    // The buffer comes with the objects, see reserveObjects()
+    glVertexArrayAttribIFormat(vertexArrayID, objectIndexAttribute, 1, GL_UNSIGNED_INT, 0);
+    glVertexArrayAttribBinding(vertexArrayID, objectIndexAttribute, objectIndexAttribute);
+    glVertexArrayBindingDivisor(vertexArrayID, objectIndexAttribute, 1);
+    glEnableVertexArrayAttrib(vertexArrayID, objectIndexAttribute);
+
+    glCreateBuffers(1, &drawCountBufferID);
+    glNamedBufferStorage(drawCountBufferID, gpuCullingPassLimit * sizeof(GLuint), nullptr, 0);
+
+    cullShader = new Gloom::Shader();
+    cullShader->attach("../res/shaders/cull.comp");
+    cullShader->link();
+
+    freeVector(poolPositions);
+    freeVector(poolNormals);
+    freeVector(poolTextureCoordinates);
+    freeVector(poolTangents);
+    freeVector(poolBitangents);
+    freeVector(poolIndices);
+}
+
+void shutdownGPUCulling() {
+    if (cullShader) {
+        cullShader->destroy();
+        delete cullShader;
+        cullShader = nullptr;
+    }
+    glDeleteBuffers(meshBufferIDs.size(), meshBufferIDs.data());
+    meshBufferIDs.clear();
+    GLuint buffers[] = {drawCountBufferID, objectBufferID, objectIndexBufferID, drawBufferID};
+    glDeleteBuffers(4, buffers);
+    glDeleteVertexArrays(1, &vertexArrayID);
+    vertexArrayID = meshBufferID = drawCountBufferID = objectBufferID = objectIndexBufferID = drawBufferID = 0;
+    objectCapacity = 0;
+    culledObjectCount = 0;
+    meshes.clear();
+    objects.clear();
+}
+
+void beginGPUObjects() {
+    objects.clear();
+}
+
+void addGPUObject(int mesh, const glm::mat4 &model, const glm::mat3 &normalMatrix, const glm::vec4 &uvTransform,
+                  int materialID, unsigned int flags, const glm::vec3 &center, float radius, unsigned int passes) {
+    GPUObject object;
+    object.model = model;
+    for (int i = 0; i < 3; i++) {
+        object.normalMatrix[i] = glm::vec4(normalMatrix[i], 0);
+    }
+    object.uvTransform = uvTransform;
+    object.sphere = glm::vec4(center, radius);
+    object.mesh = mesh;
+    object.materialID = materialID;
+    object.flags = flags;
+    object.passes = passes;
+    objects.push_back(object);
+}
+
+static void reserveObjects(size_t count) {
+    if (count <= objectCapacity) {
+        return;
+    }
+    GLuint oldBuffers[] = {objectBufferID, objectIndexBufferID, drawBufferID};
+    glDeleteBuffers(3, oldBuffers);
+    objectCapacity = std::max(count, 2 * objectCapacity);
+
+    glCreateBuffers(1, &objectBufferID);
+    glNamedBufferStorage(objectBufferID, objectCapacity * sizeof(GPUObject), nullptr, GL_DYNAMIC_STORAGE_BIT);
+
+    std::vector<uint32_t> objectIndices(objectCapacity);
+    std::iota(objectIndices.begin(), objectIndices.end(), 0);
+    glCreateBuffers(1, &objectIndexBufferID);
+    glNamedBufferStorage(objectIndexBufferID, objectCapacity * sizeof(uint32_t), objectIndices.data(), 0);
+    glVertexArrayVertexBuffer(vertexArrayID, objectIndexAttribute, objectIndexBufferID, 0, sizeof(uint32_t));
+
+    glCreateBuffers(1, &drawBufferID);
+    glNamedBufferStorage(drawBufferID, gpuCullingPassLimit * objectCapacity * sizeof(DrawElementsCommand), nullptr, 0);
+}
+
+void cullGPUObjects(const GPUCullPass* cullPasses, int count) {
+    reserveObjects(objects.size());
+    culledObjectCount = objects.size();
+    if (objects.empty()) {
+        return;
+    }
+    glNamedBufferSubData(objectBufferID, 0, objects.size() * sizeof(GPUObject), objects.data());
+
+    GLuint zero = 0;
+    glClearNamedBufferData(drawCountBufferID, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, &zero);
+    if (!haveDrawCount) {
+        glClearNamedBufferData(drawBufferID, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, &zero);
+    }
+
+    GLint previousProgram = 0;
+    glGetIntegerv(GL_CURRENT_PROGRAM, &previousProgram);
+    cullShader->activate();
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, objectBufferBinding, objectBufferID);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, meshBufferBinding, meshBufferID);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, drawBufferBinding, drawBufferID);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, drawCountBufferBinding, drawCountBufferID);
+    glUniform1ui(6, objects.size()); // object_count
+
+    for (int pass = 0; pass < std::min(count, gpuCullingPassLimit); pass++) {
+        // World space planes (Gribb & Hartmann), normalised so sphere distances are exact
+        const glm::mat4 &viewProjection = cullPasses[pass].viewProjection;
+        glm::vec4 planes[6];
+        glm::vec4 w(viewProjection[0][3], viewProjection[1][3], viewProjection[2][3], viewProjection[3][3]);
+        for (int axis = 0; axis < 3; axis++) {
+            glm::vec4 row(viewProjection[0][axis], viewProjection[1][axis], viewProjection[2][axis], viewProjection[3][axis]);
+            planes[2 * axis + 0] = w + row;
+            planes[2 * axis + 1] = w - row;
+        }
+        for (glm::vec4 &plane : planes) {
+            plane /= glm::length(glm::vec3(plane));
+        }
+
+        glUniform4fv(0, 6, glm::value_ptr(planes[0])); // planes
+        glUniform1ui(7, cullPasses[pass].passes);      // pass_mask
+        glUniform1ui(8, pass);                         // pass_slot
+        glDispatchCompute((objects.size() + cullGroupSize - 1) / cullGroupSize, 1, 1);
+    }
+
+    // The draws and their counts are read as draw parameters from here on
+    glMemoryBarrier(GL_COMMAND_BARRIER_BIT);
+    glUseProgram(previousProgram);
+}
+
+void drawGPUObjects(int pass) {
+    if (culledObjectCount == 0) {
+        return;
+    }
+    glBindVertexArray(vertexArrayID);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, objectBufferBinding, objectBufferID);
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, drawBufferID);
+    const void* firstDraw = reinterpret_cast<const void*>(pass * culledObjectCount * sizeof(DrawElementsCommand));
+    if (haveDrawCount) {
+        glBindBuffer(GL_PARAMETER_BUFFER, drawCountBufferID);
+        if (GLAD_GL_VERSION_4_6) {
+            glMultiDrawElementsIndirectCount(GL_TRIANGLES, GL_UNSIGNED_INT, firstDraw, pass * sizeof(GLuint), culledObjectCount, 0);
+        } else {
+            glMultiDrawElementsIndirectCountARB(GL_TRIANGLES, GL_UNSIGNED_INT, firstDraw, pass * sizeof(GLuint), culledObjectCount, 0);
+        }
+    } else {
+        glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, firstDraw, culledObjectCount, 0);
+    }
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+    // The triangles are only known on the GPU, so only the draw call is counted
+    addProfileCounter("draw calls", 1);
+}
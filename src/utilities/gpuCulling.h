@@ -0,0 +1,46 @@
+#pragma once
+
+#include "mesh.h"
+#include <glm/glm.hpp>
+
+// Draws plain objects without the CPU going through them for every pass. Their transforms and bounds are
+// uploaded once per frame, a compute shader frustum culls them for each pass and appends an indirect draw for
+// every one left, and the pass then draws them all with one glMultiDrawElementsIndirectCount(). For that the
+// meshes share one set of buffers, and the shader reads what would otherwise be per-draw uniforms from the
+// object buffer when gpu_driven is set. Textures have to come through the material buffer.
+
+// Passes culled in one frame: the six cube map faces and the main view
+static const int gpuCullingPassLimit = 7;
+
+// The per-object switches of the fragment shader, which the CPU path sets as uniforms
+enum GPUObjectFlags {
+    GPU_OBJECT_TEXTURED = 1,
+    GPU_OBJECT_ROUGHNESS = 2,
+    GPU_OBJECT_METAL_ROUGHNESS = 4,
+    GPU_OBJECT_NORMAL_MAP = 8
+};
+
+// Copies the mesh into the shared buffers and returns its index. Add every mesh before initGPUCulling().
+int addGPUMesh(Mesh &mesh);
+
+// Uploads the meshes and builds the culling shader
+void initGPUCulling();
+void shutdownGPUCulling();
+
+// The objects of a frame, replacing those of the frame before. passes are the CommandPass bits of the passes
+// that draw the object, the bounding sphere is in world space.
+void beginGPUObjects();
+void addGPUObject(int mesh, const glm::mat4 &model, const glm::mat3 &normalMatrix, const glm::vec4 &uvTransform,
+                  int materialID, unsigned int flags, const glm::vec3 &center, float radius, unsigned int passes);
+
+struct GPUCullPass {
+    glm::mat4 viewProjection;
+    unsigned int passes; // Objects sharing none of these bits are left out
+};
+
+// Uploads the objects and culls them for every pass at once, so the GPU switches to compute only once per
+// frame. The draws of cullPasses[i] are kept for drawGPUObjects(i) until the next call.
+void cullGPUObjects(const GPUCullPass* cullPasses, int count);
+
+// Draws the objects pass i kept, with the program and uniforms in use
+void drawGPUObjects(int pass);
@@ -1,4 +1,5 @@
 #include "imageLoader.hpp"
+#include "imageOps.h"
 #include <iostream>
 
 // Original source: https://raw.githubusercontent.com/lvandeve/lodepng/master/examples/example_decode.cpp
@@ -13,23 +14,18 @@ PNGImage loadPNGFile(std::string fileName)
 	if(!error) error = lodepng::decode(pixels, width, height, png);
 
 	//if there's an error, display it
-	if(error) std::cout << "decoder error " << error << ": " << lodepng_error_text(error) << std::endl;
+	if(error) {
+		std::cout << "decoder error " << error << " in " << fileName << ": " << lodepng_error_text(error) << std::endl;
+		return PNGImage{0, 0, {}};
+	}
 
 	//the pixels are now in the vector "image", 4 bytes per pixel, ordered RGBARGBA..., use it as texture, draw it, ...
 
 	// Unfortunately, images usually have their origin at the top left.
 	// OpenGL instead defines the origin to be on the _bottom_ left instead, so
-	// here's the world's most inefficient way to flip the image vertically.
-
-	// You're welcome :)
+	// here's the image flipped vertically, a vector register of bytes at a time.
 
-	unsigned int widthBytes = 4 * width;
-
-	for(unsigned int row = 0; row < (height / 2); row++) {
-		for(unsigned int col = 0; col < widthBytes; col++) {
-			std::swap(pixels[row * widthBytes + col], pixels[(height - 1 - row) * widthBytes + col]);
-		}
-	}
+	flipRows(pixels.data(), 4 * width, height);
 
 	PNGImage image;
 	image.width = width;
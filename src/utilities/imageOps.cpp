@@ -0,0 +1,439 @@
+#include "imageOps.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__AVX2__)
+#define IMAGE_OPS_AVX2
+#include <immintrin.h>
+#endif
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define IMAGE_OPS_SSE2
+#include <emmintrin.h>
+#endif
+#if defined(__SSSE3__) || defined(__AVX2__)
+#define IMAGE_OPS_SSSE3
+#include <tmmintrin.h>
+#endif
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define IMAGE_OPS_NEON
+#include <arm_neon.h>
+#endif
+
+// Every function runs its vector loop over as much as it can, and the plain loop over the rest.
+// With the vector loops switched off, the plain loop does everything.
+static bool vectorized = true;
+
+void setImageOpsVectorized(bool enabled) {
+    vectorized = enabled;
+}
+
+const char* imageOpsInstructionSet() {
+#if defined(IMAGE_OPS_AVX2)
+    return "AVX2";
+#elif defined(IMAGE_OPS_SSE2)
+    return "SSE2";
+#elif defined(IMAGE_OPS_NEON)
+    return "NEON";
+#else
+    return "none";
+#endif
+}
+
+// c * a / 255, rounded to nearest. Exact for every 8 bit c and a.
+static inline unsigned char multiplyAlpha(unsigned int c, unsigned int a) {
+    unsigned int t = c * a + 128;
+    return (unsigned char)((t + (t >> 8)) >> 8);
+}
+
+
+void flipRows(unsigned char* pixels, size_t rowBytes, unsigned int height) {
+    for (unsigned int row = 0; row < height / 2; row++) {
+        unsigned char* top = pixels + row * rowBytes;
+        unsigned char* bottom = pixels + (height - 1 - row) * rowBytes;
+        size_t i = 0;
+        if (vectorized) {
+#if defined(IMAGE_OPS_AVX2)
+            for (; i + 32 <= rowBytes; i += 32) {
+                __m256i a = _mm256_loadu_si256((const __m256i*)(top + i));
+                __m256i b = _mm256_loadu_si256((const __m256i*)(bottom + i));
+                _mm256_storeu_si256((__m256i*)(top + i), b);
+                _mm256_storeu_si256((__m256i*)(bottom + i), a);
+            }
+#endif
+#if defined(IMAGE_OPS_SSE2)
+            for (; i + 16 <= rowBytes; i += 16) {
+                __m128i a = _mm_loadu_si128((const __m128i*)(top + i));
+                __m128i b = _mm_loadu_si128((const __m128i*)(bottom + i));
+                _mm_storeu_si128((__m128i*)(top + i), b);
+                _mm_storeu_si128((__m128i*)(bottom + i), a);
+            }
+#elif defined(IMAGE_OPS_NEON)
+            for (; i + 16 <= rowBytes; i += 16) {
+                uint8x16_t a = vld1q_u8(top + i);
+                uint8x16_t b = vld1q_u8(bottom + i);
+                vst1q_u8(top + i, b);
+                vst1q_u8(bottom + i, a);
+            }
+#endif
+        }
+        for (; i < rowBytes; i++) {
+            std::swap(top[i], bottom[i]);
+        }
+    }
+}
+
+
+void expandToRGBA(const unsigned char* source, unsigned int channels, size_t pixelCount, unsigned char* rgba) {
+    if (channels == 4) {
+        std::memcpy(rgba, source, 4 * pixelCount);
+        return;
+    }
+    if (channels == 1) {
+        const unsigned char* const grey[4] = {source, source, source, nullptr};
+        packChannels(grey, pixelCount, rgba);
+        return;
+    }
+
+    size_t i = 0;
+    if (channels == 2) {
+        if (vectorized) {
+#if defined(IMAGE_OPS_SSE2)
+            // A grey and alpha pair is one 16 bit word, g | g << 8 next to it makes the RGBA pixel
+            const __m128i lowBytes = _mm_set1_epi16(0x00FF);
+            for (; i + 8 <= pixelCount; i += 8) {
+                __m128i pairs = _mm_loadu_si128((const __m128i*)(source + 2 * i));
+                __m128i grey = _mm_and_si128(pairs, lowBytes);
+                __m128i greyGrey = _mm_or_si128(grey, _mm_slli_epi16(grey, 8));
+                _mm_storeu_si128((__m128i*)(rgba + 4 * i), _mm_unpacklo_epi16(greyGrey, pairs));
+                _mm_storeu_si128((__m128i*)(rgba + 4 * i + 16), _mm_unpackhi_epi16(greyGrey, pairs));
+            }
+#elif defined(IMAGE_OPS_NEON)
+            for (; i + 16 <= pixelCount; i += 16) {
+                uint8x16x2_t in = vld2q_u8(source + 2 * i);
+                uint8x16x4_t out = {{in.val[0], in.val[0], in.val[0], in.val[1]}};
+                vst4q_u8(rgba + 4 * i, out);
+            }
+#endif
+        }
+        for (; i < pixelCount; i++) {
+            rgba[4 * i + 0] = rgba[4 * i + 1] = rgba[4 * i + 2] = source[2 * i];
+            rgba[4 * i + 3] = source[2 * i + 1];
+        }
+        return;
+    }
+
+    if (vectorized) {
+#if defined(IMAGE_OPS_SSSE3)
+        // Plain SSE2 has no byte shuffle, so RGB needs SSSE3 (any AVX2 build has it)
+        const __m128i spread = _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+        const __m128i alpha = _mm_set1_epi32((int)0xFF000000);
+        for (; i + 6 <= pixelCount; i += 4) {
+            __m128i in = _mm_loadu_si128((const __m128i*)(source + 3 * i));
+            _mm_storeu_si128((__m128i*)(rgba + 4 * i), _mm_or_si128(_mm_shuffle_epi8(in, spread), alpha));
+        }
+#elif defined(IMAGE_OPS_NEON)
+        for (; i + 16 <= pixelCount; i += 16) {
+            uint8x16x3_t in = vld3q_u8(source + 3 * i);
+            uint8x16x4_t out = {{in.val[0], in.val[1], in.val[2], vdupq_n_u8(255)}};
+            vst4q_u8(rgba + 4 * i, out);
+        }
+#endif
+    }
+    for (; i < pixelCount; i++) {
+        rgba[4 * i + 0] = source[3 * i + 0];
+        rgba[4 * i + 1] = source[3 * i + 1];
+        rgba[4 * i + 2] = source[3 * i + 2];
+        rgba[4 * i + 3] = 255;
+    }
+}
+
+
+void extractChannel(const unsigned char* rgba, size_t pixelCount, unsigned int channel, unsigned char* out) {
+    size_t i = 0;
+    if (vectorized) {
+#if defined(IMAGE_OPS_AVX2)
+        {
+            // The packs work within 128 bit lanes, the final permute puts the groups of 4 back in order
+            const __m128i shift = _mm_cvtsi32_si128(8 * channel);
+            const __m256i mask = _mm256_set1_epi32(0xFF);
+            const __m256i order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+            for (; i + 32 <= pixelCount; i += 32) {
+                __m256i v[4];
+                for (int j = 0; j < 4; j++) {
+                    v[j] = _mm256_loadu_si256((const __m256i*)(rgba + 4 * i + 32 * j));
+                    v[j] = _mm256_and_si256(_mm256_srl_epi32(v[j], shift), mask);
+                }
+                __m256i bytes = _mm256_packus_epi16(_mm256_packs_epi32(v[0], v[1]), _mm256_packs_epi32(v[2], v[3]));
+                _mm256_storeu_si256((__m256i*)(out + i), _mm256_permutevar8x32_epi32(bytes, order));
+            }
+        }
+#endif
+#if defined(IMAGE_OPS_SSE2)
+        const __m128i shift = _mm_cvtsi32_si128(8 * channel);
+        const __m128i mask = _mm_set1_epi32(0xFF);
+        for (; i + 16 <= pixelCount; i += 16) {
+            __m128i v[4];
+            for (int j = 0; j < 4; j++) {
+                v[j] = _mm_loadu_si128((const __m128i*)(rgba + 4 * i + 16 * j));
+                v[j] = _mm_and_si128(_mm_srl_epi32(v[j], shift), mask);
+            }
+            __m128i bytes = _mm_packus_epi16(_mm_packs_epi32(v[0], v[1]), _mm_packs_epi32(v[2], v[3]));
+            _mm_storeu_si128((__m128i*)(out + i), bytes);
+        }
+#elif defined(IMAGE_OPS_NEON)
+        for (; i + 16 <= pixelCount; i += 16) {
+            uint8x16x4_t in = vld4q_u8(rgba + 4 * i);
+            vst1q_u8(out + i, in.val[channel]);
+        }
+#endif
+    }
+    for (; i < pixelCount; i++) {
+        out[i] = rgba[4 * i + channel];
+    }
+}
+
+
+void packChannels(const unsigned char* const channels[4], size_t pixelCount, unsigned char* rgba) {
+    size_t i = 0;
+    if (vectorized) {
+#if defined(IMAGE_OPS_AVX2)
+        // Spread the 64 bit quarters so the in-lane unpacks produce whole runs of pixels
+        for (; i + 32 <= pixelCount; i += 32) {
+            __m256i in[4];
+            for (int c = 0; c < 4; c++) {
+                in[c] = channels[c] ? _mm256_loadu_si256((const __m256i*)(channels[c] + i)) : _mm256_set1_epi8(c == 3 ? -1 : 0);
+                in[c] = _mm256_permute4x64_epi64(in[c], 0xD8);
+            }
+            __m256i rgLow = _mm256_unpacklo_epi8(in[0], in[1]), rgHigh = _mm256_unpackhi_epi8(in[0], in[1]);
+            __m256i baLow = _mm256_unpacklo_epi8(in[2], in[3]), baHigh = _mm256_unpackhi_epi8(in[2], in[3]);
+            __m256i a = _mm256_unpacklo_epi16(rgLow, baLow), b = _mm256_unpackhi_epi16(rgLow, baLow);
+            __m256i c = _mm256_unpacklo_epi16(rgHigh, baHigh), d = _mm256_unpackhi_epi16(rgHigh, baHigh);
+            unsigned char* out = rgba + 4 * i;
+            _mm256_storeu_si256((__m256i*)(out + 0), _mm256_permute2x128_si256(a, b, 0x20));
+            _mm256_storeu_si256((__m256i*)(out + 32), _mm256_permute2x128_si256(a, b, 0x31));
+            _mm256_storeu_si256((__m256i*)(out + 64), _mm256_permute2x128_si256(c, d, 0x20));
+            _mm256_storeu_si256((__m256i*)(out + 96), _mm256_permute2x128_si256(c, d, 0x31));
+        }
+#endif
+#if defined(IMAGE_OPS_SSE2)
+        for (; i + 16 <= pixelCount; i += 16) {
+            __m128i in[4];
+            for (int c = 0; c < 4; c++) {
+                in[c] = channels[c] ? _mm_loadu_si128((const __m128i*)(channels[c] + i)) : _mm_set1_epi8(c == 3 ? -1 : 0);
+            }
+            __m128i rgLow = _mm_unpacklo_epi8(in[0], in[1]), rgHigh = _mm_unpackhi_epi8(in[0], in[1]);
+            __m128i baLow = _mm_unpacklo_epi8(in[2], in[3]), baHigh = _mm_unpackhi_epi8(in[2], in[3]);
+            unsigned char* out = rgba + 4 * i;
+            _mm_storeu_si128((__m128i*)(out + 0), _mm_unpacklo_epi16(rgLow, baLow));
+            _mm_storeu_si128((__m128i*)(out + 16), _mm_unpackhi_epi16(rgLow, baLow));
+            _mm_storeu_si128((__m128i*)(out + 32), _mm_unpacklo_epi16(rgHigh, baHigh));
+            _mm_storeu_si128((__m128i*)(out + 48), _mm_unpackhi_epi16(rgHigh, baHigh));
+        }
+#elif defined(IMAGE_OPS_NEON)
+        for (; i + 16 <= pixelCount; i += 16) {
+            uint8x16x4_t out;
+            for (int c = 0; c < 4; c++) {
+                out.val[c] = channels[c] ? vld1q_u8(channels[c] + i) : vdupq_n_u8(c == 3 ? 255 : 0);
+            }
+            vst4q_u8(rgba + 4 * i, out);
+        }
+#endif
+    }
+    for (; i < pixelCount; i++) {
+        for (int c = 0; c < 4; c++) {
+            rgba[4 * i + c] = channels[c] ? channels[c][i] : (c == 3 ? 255 : 0);
+        }
+    }
+}
+
+
+void swizzleChannels(unsigned char* rgba, size_t pixelCount, const unsigned int order[4]) {
+    size_t i = 0;
+    if (vectorized) {
+#if defined(IMAGE_OPS_SSE2) || defined(IMAGE_OPS_AVX2)
+        // Without a byte shuffle in SSE2, every output channel is its source channel shifted into place and masked.
+        // Constant channels are or'ed in at the end.
+        uint32_t constant = 0;
+        int shifts[4];
+        for (int c = 0; c < 4; c++) {
+            shifts[c] = order[c] < 4 ? 8 * ((int)order[c] - c) : 0;
+            if (order[c] == IMAGE_CHANNEL_ONE) {
+                constant |= 0xFFu << (8 * c);
+            }
+        }
+#endif
+#if defined(IMAGE_OPS_AVX2)
+        for (; i + 8 <= pixelCount; i += 8) {
+            __m256i in = _mm256_loadu_si256((const __m256i*)(rgba + 4 * i));
+            __m256i out = _mm256_set1_epi32((int)constant);
+            for (int c = 0; c < 4; c++) {
+                if (order[c] >= 4) continue;
+                __m256i moved = shifts[c] >= 0 ? _mm256_srl_epi32(in, _mm_cvtsi32_si128(shifts[c]))
+                                               : _mm256_sll_epi32(in, _mm_cvtsi32_si128(-shifts[c]));
+                out = _mm256_or_si256(out, _mm256_and_si256(moved, _mm256_set1_epi32((int)(0xFFu << (8 * c)))));
+            }
+            _mm256_storeu_si256((__m256i*)(rgba + 4 * i), out);
+        }
+#endif
+#if defined(IMAGE_OPS_SSE2)
+        for (; i + 4 <= pixelCount; i += 4) {
+            __m128i in = _mm_loadu_si128((const __m128i*)(rgba + 4 * i));
+            __m128i out = _mm_set1_epi32((int)constant);
+            for (int c = 0; c < 4; c++) {
+                if (order[c] >= 4) continue;
+                __m128i moved = shifts[c] >= 0 ? _mm_srl_epi32(in, _mm_cvtsi32_si128(shifts[c]))
+                                               : _mm_sll_epi32(in, _mm_cvtsi32_si128(-shifts[c]));
+                out = _mm_or_si128(out, _mm_and_si128(moved, _mm_set1_epi32((int)(0xFFu << (8 * c)))));
+            }
+            _mm_storeu_si128((__m128i*)(rgba + 4 * i), out);
+        }
+#elif defined(IMAGE_OPS_NEON)
+        for (; i + 16 <= pixelCount; i += 16) {
+            uint8x16x4_t in = vld4q_u8(rgba + 4 * i);
+            uint8x16x4_t out;
+            for (int c = 0; c < 4; c++) {
+                out.val[c] = order[c] < 4 ? in.val[order[c]] : vdupq_n_u8(order[c] == IMAGE_CHANNEL_ONE ? 255 : 0);
+            }
+            vst4q_u8(rgba + 4 * i, out);
+        }
+#endif
+    }
+    for (; i < pixelCount; i++) {
+        unsigned char* pixel = rgba + 4 * i;
+        unsigned char in[4] = {pixel[0], pixel[1], pixel[2], pixel[3]};
+        for (int c = 0; c < 4; c++) {
+            pixel[c] = order[c] < 4 ? in[order[c]] : (order[c] == IMAGE_CHANNEL_ONE ? 255 : 0);
+        }
+    }
+}
+
+
+void premultiplyAlpha(unsigned char* rgba, size_t pixelCount) {
+    size_t i = 0;
+    if (vectorized) {
+#if defined(IMAGE_OPS_AVX2)
+        {
+            const __m256i zero = _mm256_setzero_si256();
+            const __m256i half = _mm256_set1_epi16(128);
+            const __m256i alphaMask = _mm256_set1_epi32((int)0xFF000000);
+            for (; i + 8 <= pixelCount; i += 8) {
+                __m256i in = _mm256_loadu_si256((const __m256i*)(rgba + 4 * i));
+                __m256i words[2] = {_mm256_unpacklo_epi8(in, zero), _mm256_unpackhi_epi8(in, zero)};
+                for (__m256i &w : words) {
+                    __m256i alpha = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(w, 0xFF), 0xFF);
+                    __m256i t = _mm256_add_epi16(_mm256_mullo_epi16(w, alpha), half);
+                    w = _mm256_srli_epi16(_mm256_add_epi16(t, _mm256_srli_epi16(t, 8)), 8);
+                }
+                __m256i out = _mm256_packus_epi16(words[0], words[1]);
+                out = _mm256_or_si256(_mm256_andnot_si256(alphaMask, out), _mm256_and_si256(alphaMask, in));
+                _mm256_storeu_si256((__m256i*)(rgba + 4 * i), out);
+            }
+        }
+#endif
+#if defined(IMAGE_OPS_SSE2)
+        // Two pixels per register as 16 bit words, with alpha copied to all four words of its pixel
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i half = _mm_set1_epi16(128);
+        const __m128i alphaMask = _mm_set1_epi32((int)0xFF000000);
+        for (; i + 4 <= pixelCount; i += 4) {
+            __m128i in = _mm_loadu_si128((const __m128i*)(rgba + 4 * i));
+            __m128i words[2] = {_mm_unpacklo_epi8(in, zero), _mm_unpackhi_epi8(in, zero)};
+            for (__m128i &w : words) {
+                __m128i alpha = _mm_shufflehi_epi16(_mm_shufflelo_epi16(w, 0xFF), 0xFF);
+                __m128i t = _mm_add_epi16(_mm_mullo_epi16(w, alpha), half);
+                w = _mm_srli_epi16(_mm_add_epi16(t, _mm_srli_epi16(t, 8)), 8);
+            }
+            __m128i out = _mm_packus_epi16(words[0], words[1]);
+            out = _mm_or_si128(_mm_andnot_si128(alphaMask, out), _mm_and_si128(alphaMask, in));
+            _mm_storeu_si128((__m128i*)(rgba + 4 * i), out);
+        }
+#elif defined(IMAGE_OPS_NEON)
+        const uint16x8_t half = vdupq_n_u16(128);
+        for (; i + 16 <= pixelCount; i += 16) {
+            uint8x16x4_t pixels = vld4q_u8(rgba + 4 * i);
+            for (int c = 0; c < 3; c++) {
+                uint16x8_t low = vaddq_u16(vmull_u8(vget_low_u8(pixels.val[c]), vget_low_u8(pixels.val[3])), half);
+                uint16x8_t high = vaddq_u16(vmull_u8(vget_high_u8(pixels.val[c]), vget_high_u8(pixels.val[3])), half);
+                pixels.val[c] = vcombine_u8(vshrn_n_u16(vaddq_u16(low, vshrq_n_u16(low, 8)), 8),
+                                            vshrn_n_u16(vaddq_u16(high, vshrq_n_u16(high, 8)), 8));
+            }
+            vst4q_u8(rgba + 4 * i, pixels);
+        }
+#endif
+    }
+    for (; i < pixelCount; i++) {
+        unsigned char* pixel = rgba + 4 * i;
+        for (int c = 0; c < 3; c++) {
+            pixel[c] = multiplyAlpha(pixel[c], pixel[3]);
+        }
+    }
+}
+
+
+void downsample2x2(const unsigned char* source, unsigned int width, unsigned int height, unsigned char* target) {
+    unsigned int targetWidth = std::max(1u, width / 2);
+    unsigned int targetHeight = std::max(1u, height / 2);
+
+    for (unsigned int y = 0; y < targetHeight; y++) {
+        const unsigned char* row0 = source + 4 * size_t(width) * std::min(2 * y, height - 1);
+        const unsigned char* row1 = source + 4 * size_t(width) * std::min(2 * y + 1, height - 1);
+        unsigned char* out = target + 4 * size_t(targetWidth) * y;
+
+        // The vector loops never have to clamp, since 2 * targetWidth <= width whenever width > 1
+        unsigned int x = 0;
+        if (vectorized && width > 1) {
+#if defined(IMAGE_OPS_AVX2)
+            {
+                const __m256i zero = _mm256_setzero_si256();
+                const __m256i two = _mm256_set1_epi16(2);
+                for (; x + 4 <= targetWidth; x += 4) {
+                    __m256i a = _mm256_loadu_si256((const __m256i*)(row0 + 8 * x));
+                    __m256i b = _mm256_loadu_si256((const __m256i*)(row1 + 8 * x));
+                    __m256i low = _mm256_add_epi16(_mm256_unpacklo_epi8(a, zero), _mm256_unpacklo_epi8(b, zero));
+                    __m256i high = _mm256_add_epi16(_mm256_unpackhi_epi8(a, zero), _mm256_unpackhi_epi8(b, zero));
+                    low = _mm256_add_epi16(low, _mm256_srli_si256(low, 8));
+                    high = _mm256_add_epi16(high, _mm256_srli_si256(high, 8));
+                    __m256i sums = _mm256_srli_epi16(_mm256_add_epi16(_mm256_unpacklo_epi64(low, high), two), 2);
+                    __m256i packed = _mm256_permute4x64_epi64(_mm256_packus_epi16(sums, sums), 0x08);
+                    _mm_storeu_si128((__m128i*)(out + 4 * x), _mm256_castsi256_si128(packed));
+                }
+            }
+#endif
+#if defined(IMAGE_OPS_SSE2)
+            // Four source pixels per row give two target pixels: add the rows as 16 bit words,
+            // then add each pixel to its right neighbour, which sits 8 bytes further along
+            const __m128i zero = _mm_setzero_si128();
+            const __m128i two = _mm_set1_epi16(2);
+            for (; x + 2 <= targetWidth; x += 2) {
+                __m128i a = _mm_loadu_si128((const __m128i*)(row0 + 8 * x));
+                __m128i b = _mm_loadu_si128((const __m128i*)(row1 + 8 * x));
+                __m128i low = _mm_add_epi16(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero));
+                __m128i high = _mm_add_epi16(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero));
+                low = _mm_add_epi16(low, _mm_srli_si128(low, 8));
+                high = _mm_add_epi16(high, _mm_srli_si128(high, 8));
+                __m128i sums = _mm_srli_epi16(_mm_add_epi16(_mm_unpacklo_epi64(low, high), two), 2);
+                _mm_storel_epi64((__m128i*)(out + 4 * x), _mm_packus_epi16(sums, sums));
+            }
+#elif defined(IMAGE_OPS_NEON)
+            for (; x + 8 <= targetWidth; x += 8) {
+                uint8x16x4_t a = vld4q_u8(row0 + 8 * x);
+                uint8x16x4_t b = vld4q_u8(row1 + 8 * x);
+                uint8x8x4_t result;
+                for (int c = 0; c < 4; c++) {
+                    uint16x8_t sums = vpadalq_u8(vpaddlq_u8(a.val[c]), b.val[c]);
+                    result.val[c] = vrshrn_n_u16(sums, 2);
+                }
+                vst4_u8(out + 4 * x, result);
+            }
+#endif
+        }
+        for (; x < targetWidth; x++) {
+            unsigned int x0 = std::min(2 * x, width - 1), x1 = std::min(2 * x + 1, width - 1);
+            for (int c = 0; c < 4; c++) {
+                int sum = row0[4 * x0 + c] + row0[4 * x1 + c] + row1[4 * x0 + c] + row1[4 * x1 + c];
+                out[4 * x + c] = (unsigned char)((sum + 2) / 4);
+            }
+        }
+    }
+}
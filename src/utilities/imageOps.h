@@ -0,0 +1,36 @@
+#pragma once
+
+#include <cstddef>
+
+// Pixel work done while loading images. Everything is 8 bits per channel, tightly packed.
+// Each function has an SSE2, AVX2 (when built with it) and NEON version, with a plain loop for the rest.
+
+// Channel sources for swizzleChannels() that are not channels of the input
+const unsigned int IMAGE_CHANNEL_ZERO = 4;
+const unsigned int IMAGE_CHANNEL_ONE = 5;
+
+// Swaps the rows of an image top to bottom, in place
+void flipRows(unsigned char* pixels, size_t rowBytes, unsigned int height);
+
+// Converts 1 (grey), 2 (grey and alpha), 3 (RGB) or 4 channel pixels to RGBA
+void expandToRGBA(const unsigned char* source, unsigned int channels, size_t pixelCount, unsigned char* rgba);
+
+// Copies one channel of RGBA pixels out as a single channel image
+void extractChannel(const unsigned char* rgba, size_t pixelCount, unsigned int channel, unsigned char* out);
+
+// Interleaves up to four single channel images into RGBA. Missing colour channels become 0, missing alpha 255.
+void packChannels(const unsigned char* const channels[4], size_t pixelCount, unsigned char* rgba);
+
+// Reorders RGBA pixels in place: channel i becomes what was in channel order[i], or IMAGE_CHANNEL_ZERO/ONE
+void swizzleChannels(unsigned char* rgba, size_t pixelCount, const unsigned int order[4]);
+
+void premultiplyAlpha(unsigned char* rgba, size_t pixelCount);
+
+// Halves an RGBA image with a 2x2 box filter, rounding to nearest. The target is max(1, width / 2) by max(1, height / 2).
+void downsample2x2(const unsigned char* source, unsigned int width, unsigned int height, unsigned char* target);
+
+// Switches the vector versions off, so they can be checked and timed against the plain loops
+void setImageOpsVectorized(bool enabled);
+
+// Which vector instructions the functions were built with
+const char* imageOpsInstructionSet();
@@ -0,0 +1,218 @@
+#include "lights.h"
+#include <glad/glad.h>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+// One light as the shader sees it (std430), 64 bytes
+struct GPULight {
+    float position[3];
+    int32_t type;
+    float color[3];
+    float range;
+    float direction[3];
+    float cosInnerAngle;
+    float cosOuterAngle;
+    float padding[3];
+};
+static_assert(sizeof(GPULight) == 64, "GPULight has to match the Light struct in the shader");
+
+// The buffer starts with the light count, padded to where the array starts in std430
+static const size_t lightBufferHeaderSize = 16;
+static const GLuint lightBufferBinding = 3;
+
+// One entry per light, removing a light moves the last one into its place so the arrays stay packed
+static std::vector<TransformID> transforms;
+static std::vector<LightType> types;
+static std::vector<glm::vec3> colors;
+static std::vector<float> ranges;
+static std::vector<glm::vec2> spotCosines; // Inner and outer angle
+static std::vector<int> lightOfIndex;
+
+// Filled by gatherLights()
+static std::vector<glm::vec3> worldPositions;
+static std::vector<glm::vec3> worldDirections;
+static std::vector<glm::vec4> cullSpheres; // Centre and radius of what the light can reach, radius < 0 for everywhere
+
+// Light IDs stay the same while other lights come and go
+static std::vector<int> indexOfLight; // -1 for destroyed lights
+static std::vector<int> freeLights;
+
+static GLuint lightBufferID = 0;
+static size_t lightBufferCapacity = 0;
+
+
+int createLight(TransformID transform, LightType type, glm::vec3 color, float range) {
+    int light;
+    if (freeLights.empty()) {
+        light = indexOfLight.size();
+        indexOfLight.push_back(0);
+    } else {
+        light = freeLights.back();
+        freeLights.pop_back();
+    }
+    indexOfLight[light] = transforms.size();
+    transforms.push_back(transform);
+    types.push_back(type);
+    colors.push_back(color);
+    ranges.push_back(range);
+    spotCosines.push_back(glm::vec2(std::cos(0.3f), std::cos(0.5f)));
+    lightOfIndex.push_back(light);
+    return light;
+}
+
+void destroyLight(int light) {
+    int index = indexOfLight[light];
+    if (index < 0) {
+        return;
+    }
+    int last = transforms.size() - 1;
+    transforms[index] = transforms[last];
+    types[index] = types[last];
+    colors[index] = colors[last];
+    ranges[index] = ranges[last];
+    spotCosines[index] = spotCosines[last];
+    lightOfIndex[index] = lightOfIndex[last];
+    indexOfLight[lightOfIndex[index]] = index;
+    if (cullSpheres.size() == transforms.size()) {
+        // Keep what the last gatherLights() found lined up with the lights until the next one
+        worldPositions[index] = worldPositions[last];
+        worldDirections[index] = worldDirections[last];
+        cullSpheres[index] = cullSpheres[last];
+        worldPositions.pop_back();
+        worldDirections.pop_back();
+        cullSpheres.pop_back();
+    }
+
+    transforms.pop_back();
+    types.pop_back();
+    colors.pop_back();
+    ranges.pop_back();
+    spotCosines.pop_back();
+    lightOfIndex.pop_back();
+    indexOfLight[light] = -1;
+    freeLights.push_back(light);
+}
+
+void setLightColor(int light, glm::vec3 color) {
+    colors[indexOfLight[light]] = color;
+}
+
+void setLightRange(int light, float range) {
+    ranges[indexOfLight[light]] = range;
+}
+
+void setSpotAngles(int light, float innerAngle, float outerAngle) {
+    spotCosines[indexOfLight[light]] = glm::vec2(std::cos(innerAngle), std::cos(outerAngle));
+}
+
+size_t lightCount() {
+    return transforms.size();
+}
+
+void gatherLights() {
+    size_t count = transforms.size();
+    worldPositions.resize(count);
+    worldDirections.resize(count);
+    cullSpheres.resize(count);
+    for (size_t i = 0; i < count; i++) {
+        const glm::mat4 &world = worldMatrix(transforms[i]);
+        worldPositions[i] = glm::vec3(world[3]);
+        worldDirections[i] = -glm::normalize(glm::vec3(world[2]));
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        float range = ranges[i];
+        if (types[i] == LIGHT_DIRECTIONAL || range <= 0) {
+            cullSpheres[i] = glm::vec4(worldPositions[i], -1);
+            continue;
+        }
+        // The smallest sphere around the cone of a spot light, either through its tip and the rim of its end or,
+        // for wide cones, just around the rim
+        float cosOuter = spotCosines[i].y;
+        if (types[i] == LIGHT_SPOT && cosOuter > 0) {
+            float sinOuter = std::sqrt(1 - cosOuter * cosOuter);
+            float distance = cosOuter > sinOuter ? range / (2 * cosOuter) : range * cosOuter;
+            float radius = cosOuter > sinOuter ? distance : range * sinOuter;
+            cullSpheres[i] = glm::vec4(worldPositions[i] + worldDirections[i] * distance, radius);
+        } else {
+            cullSpheres[i] = glm::vec4(worldPositions[i], range);
+        }
+    }
+}
+
+size_t packVisibleLights(const glm::mat4 &viewProjection, std::vector<char> &lightData) {
+    // World space planes (Gribb & Hartmann), normalised so sphere distances are exact
+    glm::vec4 planes[6];
+    glm::vec4 w(viewProjection[0][3], viewProjection[1][3], viewProjection[2][3], viewProjection[3][3]);
+    for (int axis = 0; axis < 3; axis++) {
+        glm::vec4 row(viewProjection[0][axis], viewProjection[1][axis], viewProjection[2][axis], viewProjection[3][axis]);
+        planes[2 * axis + 0] = w + row;
+        planes[2 * axis + 1] = w - row;
+    }
+    for (glm::vec4 &plane : planes) {
+        plane /= glm::length(glm::vec3(plane));
+    }
+
+    lightData.resize(lightBufferHeaderSize + transforms.size() * sizeof(GPULight));
+    GPULight* visible = reinterpret_cast<GPULight*>(lightData.data() + lightBufferHeaderSize);
+    int32_t visibleCount = 0;
+    size_t gathered = std::min(cullSpheres.size(), transforms.size()); // Lights created since gatherLights() wait for the next one
+    for (size_t i = 0; i < gathered; i++) {
+        const glm::vec4 &sphere = cullSpheres[i];
+        bool inside = true;
+        for (int p = 0; p < 6 && inside && sphere.w >= 0; p++) {
+            inside = glm::dot(glm::vec3(planes[p]), glm::vec3(sphere)) + planes[p].w >= -sphere.w;
+        }
+        if (!inside) {
+            continue;
+        }
+        GPULight &light = visible[visibleCount++];
+        std::memcpy(light.position, &worldPositions[i], sizeof(light.position));
+        light.type = types[i];
+        std::memcpy(light.color, &colors[i], sizeof(light.color));
+        light.range = ranges[i];
+        std::memcpy(light.direction, &worldDirections[i], sizeof(light.direction));
+        light.cosInnerAngle = spotCosines[i].x;
+        light.cosOuterAngle = spotCosines[i].y;
+    }
+    std::memcpy(lightData.data(), &visibleCount, sizeof(visibleCount));
+    lightData.resize(lightBufferHeaderSize + visibleCount * sizeof(GPULight));
+    return visibleCount;
+}
+
+void uploadLights(const std::vector<char> &lightData) {
+    size_t size = std::max(lightData.size(), lightBufferHeaderSize);
+    if (size > lightBufferCapacity) {
+        glDeleteBuffers(1, &lightBufferID);
+        lightBufferCapacity = std::max(size, 2 * lightBufferCapacity);
+        glCreateBuffers(1, &lightBufferID);
+        glNamedBufferStorage(lightBufferID, lightBufferCapacity, nullptr, GL_DYNAMIC_STORAGE_BIT);
+    }
+    if (lightData.size() < lightBufferHeaderSize) {
+        const char noLights[lightBufferHeaderSize] = {};
+        glNamedBufferSubData(lightBufferID, 0, lightBufferHeaderSize, noLights);
+    } else {
+        glNamedBufferSubData(lightBufferID, 0, lightData.size(), lightData.data());
+    }
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, lightBufferBinding, lightBufferID);
+}
+
+void shutdownLights() {
+    glDeleteBuffers(1, &lightBufferID);
+    lightBufferID = 0;
+    lightBufferCapacity = 0;
+    transforms.clear();
+    types.clear();
+    colors.clear();
+    ranges.clear();
+    spotCosines.clear();
+    lightOfIndex.clear();
+    indexOfLight.clear();
+    freeLights.clear();
+    worldPositions.clear();
+    worldDirections.clear();
+    cullSpheres.clear();
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include "transformHierarchy.h"
+#include <glm/glm.hpp>
+#include <cstddef>
+#include <vector>
+
+// Every light in the scene, kept in flat arrays so a frame can gather their world positions in one go and every pass
+// can cull them against its own view. The lights that survive are written to a shader storage buffer (binding 3), so
+// there is no limit on how many there are other than memory.
+
+enum LightType {
+    LIGHT_POINT, LIGHT_SPOT, LIGHT_DIRECTIONAL
+};
+
+// The light sits at the origin of the transform and spot and directional lights shine along its -z axis.
+// A range of 0 means the light reaches everywhere and is never culled. Returns an ID for the functions below.
+int createLight(TransformID transform, LightType type, glm::vec3 color, float range = 0);
+void destroyLight(int light);
+
+void setLightColor(int light, glm::vec3 color);
+void setLightRange(int light, float range);
+// Angles from the spot direction in radians, full brightness inside the inner one and fading out to the outer one
+void setSpotAngles(int light, float innerAngle, float outerAngle);
+
+size_t lightCount();
+
+// Reads the world positions and directions of all lights from their transforms. Call once per frame after
+// updateWorldTransforms() or interpolateWorldTransforms().
+void gatherLights();
+
+// Culls the lights against the frustum and packs the ones that can reach it into data, the way the shader reads
+// them. Takes no GL, so passes can be prepared away from the thread drawing them. Returns how many lights it packed.
+size_t packVisibleLights(const glm::mat4 &viewProjection, std::vector<char> &data);
+
+// Writes lights packed by packVisibleLights() to the light buffer and binds it. Call for every pass before drawing.
+void uploadLights(const std::vector<char> &data);
+
+void shutdownLights();
@@ -0,0 +1,115 @@
+#ifndef LOCKFREEQUEUE_HPP
+#define LOCKFREEQUEUE_HPP
+#pragma once
+
+// Standard headers
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+
+namespace Gloom
+{
+    /* Bounded multi-producer multi-consumer queue without locks (Dmitry Vyukov's design).
+       Every slot has a sequence number telling whether it is ready to be written or read,
+       so producers and consumers only ever contend on a single atomic each. */
+    template <class T>
+    class LockFreeQueue
+    {
+    public:
+        /* Capacity is rounded up to a power of two */
+        explicit LockFreeQueue(size_t capacity = 1024)
+        {
+            size_t size = 2;
+            while (size < capacity) size *= 2;
+
+            mSlots = std::vector<Slot>(size);
+            mMask = size - 1;
+            for (size_t i = 0; i < size; i++)
+            {
+                mSlots[i].sequence.store(i, std::memory_order_relaxed);
+            }
+            mEnqueuePosition.store(0, std::memory_order_relaxed);
+            mDequeuePosition.store(0, std::memory_order_relaxed);
+        }
+
+        /* Returns false if the queue is full */
+        bool push(T const &value)
+        {
+            size_t position = mEnqueuePosition.load(std::memory_order_relaxed);
+            for (;;)
+            {
+                Slot &slot = mSlots[position & mMask];
+                size_t sequence = slot.sequence.load(std::memory_order_acquire);
+                intptr_t difference = (intptr_t)sequence - (intptr_t)position;
+                if (difference == 0)
+                {
+                    if (mEnqueuePosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+                    {
+                        slot.value = value;
+                        slot.sequence.store(position + 1, std::memory_order_release);
+                        return true;
+                    }
+                }
+                else if (difference < 0)
+                {
+                    return false;
+                }
+                else
+                {
+                    position = mEnqueuePosition.load(std::memory_order_relaxed);
+                }
+            }
+        }
+
+        /* Returns false if the queue is empty */
+        bool pop(T &value)
+        {
+            size_t position = mDequeuePosition.load(std::memory_order_relaxed);
+            for (;;)
+            {
+                Slot &slot = mSlots[position & mMask];
+                size_t sequence = slot.sequence.load(std::memory_order_acquire);
+                intptr_t difference = (intptr_t)sequence - (intptr_t)(position + 1);
+                if (difference == 0)
+                {
+                    if (mDequeuePosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+                    {
+                        value = slot.value;
+                        slot.sequence.store(position + mMask + 1, std::memory_order_release);
+                        return true;
+                    }
+                }
+                else if (difference < 0)
+                {
+                    return false;
+                }
+                else
+                {
+                    position = mDequeuePosition.load(std::memory_order_relaxed);
+                }
+            }
+        }
+
+    private:
+        // Disable copying and assignment
+        LockFreeQueue(LockFreeQueue const &) = delete;
+        LockFreeQueue & operator =(LockFreeQueue const &) = delete;
+
+        struct Slot
+        {
+            std::atomic<size_t> sequence;
+            T value;
+        };
+
+        std::vector<Slot> mSlots;
+        size_t mMask;
+
+        // Keep the two ends on separate cache lines, so producers and consumers do not false share
+        alignas(64) std::atomic<size_t> mEnqueuePosition;
+        alignas(64) std::atomic<size_t> mDequeuePosition;
+    };
+}
+
+#endif
@@ -0,0 +1,379 @@
+#include "materials.h"
+#include "textureLoader.h"
+#include <algorithm>
+#include <iostream>
+#include <unordered_map>
+#include <vector>
+
+// One material as the shader sees it (std430), 96 bytes
+struct GPUMaterial {
+    GLuint handles[MATERIAL_SLOT_COUNT][2]; // Bindless sampler handles, read as uvec2
+    GLint layers[MATERIAL_SLOT_COUNT][4];   // Texture array, layer in it and its finest level copied in, -1 for no texture
+};
+
+struct Material {
+    int textures[MATERIAL_SLOT_COUNT];
+    int currentIDs[MATERIAL_SLOT_COUNT];
+};
+
+// All textures of one size and format share an array, so the shader can pick any of them without rebinding.
+// Streamed textures go by their full size, and their resident levels are copied into the same levels of the layer,
+// so streaming never moves them to another array. Arrays start out small and grow as textures are added, and are
+// deleted again once their last texture is gone.
+struct TextureArray {
+    GLuint id = 0; // 0 while the slot is not in use
+    GLsizei width;
+    GLsizei height;
+    GLsizei levels;
+    GLenum format;
+    size_t layerBytes;  // All mip levels of one layer
+    int capacity;       // Layers allocated
+    int usedLayers;
+    std::vector<int> freeLayers;
+};
+struct ArrayLayer {
+    int array;
+    int layer;
+    int baseLevel; // Finer levels of the layer hold nothing, or what was there before the texture was streamed out
+};
+
+static const int firstArrayLayers = 4;
+static const int layersPerArray = 64;    // Arrays grow up to this many layers
+static const int maxTextureArrays = 8;   // Units 8-15, the shader declares the same
+static const GLuint firstArrayUnit = 8;
+static const GLuint materialBufferBinding = 2;
+
+static MaterialTextureMode textureMode = MATERIAL_TEXTURES_BOUND;
+static std::vector<Material> materials;
+static std::vector<GPUMaterial> gpuMaterials;
+static std::vector<int> freeMaterials;
+static GLuint materialBufferID = 0;
+static size_t materialBufferCapacity = 0;
+static bool materialsDirty = false;
+
+static std::unordered_map<GLuint, GLuint64> bindlessHandles;
+static std::unordered_map<GLuint, ArrayLayer> arrayLayers;
+static std::vector<TextureArray> textureArrays;
+static size_t arrayBytes = 0; // Counted in the texture loader's memory budget, the arrays are copies of its textures
+static bool warnedArraysFull = false;
+
+
+static void freeArray(TextureArray &array) {
+    glDeleteTextures(1, &array.id);
+    arrayBytes -= array.capacity * array.layerBytes;
+    setExtraTextureMemory(arrayBytes);
+    array = TextureArray();
+}
+
+
+// The texture loader tells us before it deletes a texture, so a reused name never gets the old handle or layer
+static void forgetTexture(GLuint id) {
+    auto handle = bindlessHandles.find(id);
+    if (handle != bindlessHandles.end()) {
+        glMakeTextureHandleNonResidentARB(handle->second);
+        bindlessHandles.erase(handle);
+    }
+    // Empty arrays are only deleted after the next updateMaterials(), a streamed texture replacing this one takes
+    // the layer back before that
+    auto layer = arrayLayers.find(id);
+    if (layer != arrayLayers.end()) {
+        textureArrays[layer->second.array].freeLayers.push_back(layer->second.layer);
+        arrayLayers.erase(layer);
+    }
+}
+
+MaterialTextureMode initMaterials(MaterialTextureMode mode) {
+    if (mode == MATERIAL_TEXTURES_BINDLESS && !GLAD_GL_ARB_bindless_texture) {
+        std::cout << "Bindless textures are not supported, using texture arrays instead" << std::endl;
+        mode = MATERIAL_TEXTURES_ARRAYS;
+    }
+    textureMode = mode;
+    setTextureEvictionCallback(forgetTexture);
+
+    // Material 0 has no textures, for nodes without a material of their own
+    if (textureMode != MATERIAL_TEXTURES_BOUND) {
+        createMaterial();
+    }
+    return textureMode;
+}
+
+MaterialTextureMode materialTextureMode() {
+    return textureMode;
+}
+
+std::string materialShaderDefines() {
+    switch (textureMode) {
+        case MATERIAL_TEXTURES_BINDLESS: return "#define MATERIAL_TEXTURES\n#define MATERIAL_BINDLESS\n";
+        case MATERIAL_TEXTURES_ARRAYS: return "#define MATERIAL_TEXTURES\n";
+        default: return "";
+    }
+}
+
+static GPUMaterial emptyGPUMaterial() {
+    GPUMaterial gpuMaterial = {};
+    for (int slot = 0; slot < MATERIAL_SLOT_COUNT; slot++) {
+        gpuMaterial.layers[slot][0] = -1;
+        gpuMaterial.layers[slot][1] = -1;
+    }
+    return gpuMaterial;
+}
+
+int createMaterial() {
+    Material material = {{-1, -1, -1, -1}, {-1, -1, -1, -1}};
+    materialsDirty = true;
+    if (!freeMaterials.empty()) {
+        int id = freeMaterials.back();
+        freeMaterials.pop_back();
+        materials[id] = material;
+        gpuMaterials[id] = emptyGPUMaterial();
+        return id;
+    }
+    materials.push_back(material);
+    gpuMaterials.push_back(emptyGPUMaterial());
+    return materials.size() - 1;
+}
+
+void releaseMaterial(int material) {
+    // Material 0 is the shared one without textures
+    if (material <= 0 || material >= (int)materials.size()) {
+        return;
+    }
+    materials[material] = Material{{-1, -1, -1, -1}, {-1, -1, -1, -1}};
+    gpuMaterials[material] = emptyGPUMaterial();
+    freeMaterials.push_back(material);
+    materialsDirty = true;
+}
+
+void setMaterialTextures(int material, const int textureIDs[MATERIAL_SLOT_COUNT]) {
+    std::copy(textureIDs, textureIDs + MATERIAL_SLOT_COUNT, materials[material].textures);
+}
+
+static GLuint64 bindlessHandle(GLuint id) {
+    auto existing = bindlessHandles.find(id);
+    if (existing != bindlessHandles.end()) {
+        return existing->second;
+    }
+    GLuint64 handle = glGetTextureHandleARB(id);
+    glMakeTextureHandleResidentARB(handle);
+    bindlessHandles[id] = handle;
+    return handle;
+}
+
+static GLuint allocateArray(const TextureArray &array, int layers) {
+    GLuint id;
+    glCreateTextures(GL_TEXTURE_2D_ARRAY, 1, &id);
+    glTextureStorage3D(id, array.levels, array.format, array.width, array.height, layers);
+    glTextureParameteri(id, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTextureParameteri(id, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    return id;
+}
+
+// Reallocates a full array with twice the layers, and copies the ones in use over on the GPU
+static void growArray(TextureArray &array) {
+    int capacity = std::min(2 * array.capacity, layersPerArray);
+    GLuint id = allocateArray(array, capacity);
+    for (GLint level = 0; level < array.levels; level++) {
+        glCopyImageSubData(array.id, GL_TEXTURE_2D_ARRAY, level, 0, 0, 0, id, GL_TEXTURE_2D_ARRAY, level, 0, 0, 0,
+                           std::max(1, array.width >> level), std::max(1, array.height >> level), array.usedLayers);
+    }
+    glDeleteTextures(1, &array.id);
+    arrayBytes += (capacity - array.capacity) * array.layerBytes;
+    setExtraTextureMemory(arrayBytes);
+    array.id = id;
+    array.capacity = capacity;
+}
+
+// Size of all levels of a texture at full detail, the compressed ones as the driver reports them and the rest
+// as RGBA8, which is all the loader makes. The GL texture holds the levels from baseLevel on, each finer one is
+// four times the size of the one after it.
+static size_t textureBytes(GLuint id, GLint width, GLint height, GLint levels, GLint baseLevel) {
+    size_t size = 0;
+    size_t baseSize = 0;
+    for (GLint level = baseLevel; level < levels; level++) {
+        GLint compressed = GL_FALSE;
+        glGetTextureLevelParameteriv(id, level - baseLevel, GL_TEXTURE_COMPRESSED, &compressed);
+        size_t levelSize = 4 * size_t(std::max(1, width >> level)) * std::max(1, height >> level);
+        if (compressed) {
+            GLint compressedSize = 0;
+            glGetTextureLevelParameteriv(id, level - baseLevel, GL_TEXTURE_COMPRESSED_IMAGE_SIZE, &compressedSize);
+            levelSize = compressedSize;
+        }
+        size += levelSize;
+        if (level == baseLevel) {
+            baseSize = levelSize;
+        }
+    }
+    for (GLint level = baseLevel - 1; level >= 0; level--) {
+        baseSize *= 4;
+        size += baseSize;
+    }
+    return size;
+}
+
+// Copies every mip level of a texture into a free layer of an array with the same size and format
+static ArrayLayer arrayLayer(GLuint id) {
+    auto existing = arrayLayers.find(id);
+    if (existing != arrayLayers.end()) {
+        return existing->second;
+    }
+
+    GLint width, height, format, levels;
+    GLint baseLevel = 0;
+    glGetTextureLevelParameteriv(id, 0, GL_TEXTURE_INTERNAL_FORMAT, &format);
+    TextureLevels streamed;
+    if (streamedTextureLevels(id, streamed)) {
+        width = streamed.width;
+        height = streamed.height;
+        levels = streamed.levelCount;
+        baseLevel = streamed.residentBase;
+    } else {
+        glGetTextureLevelParameteriv(id, 0, GL_TEXTURE_WIDTH, &width);
+        glGetTextureLevelParameteriv(id, 0, GL_TEXTURE_HEIGHT, &height);
+        glGetTextureParameteriv(id, GL_TEXTURE_IMMUTABLE_LEVELS, &levels);
+    }
+    if (levels == 0) {
+        // Mutable textures from glTexImage2D, assume the full mip chain was generated
+        levels = 1;
+        while ((std::max(width, height) >> levels) > 0) {
+            levels++;
+        }
+    }
+
+    ArrayLayer location = {-1, -1, baseLevel};
+    for (unsigned int i = 0; i < textureArrays.size(); i++) {
+        TextureArray &array = textureArrays[i];
+        if (array.id == 0 || array.width != width || array.height != height || array.levels != levels || array.format != (GLenum)format) {
+            continue;
+        }
+        if (!array.freeLayers.empty()) {
+            location.array = i;
+            location.layer = array.freeLayers.back();
+            array.freeLayers.pop_back();
+            break;
+        }
+        if (array.usedLayers < layersPerArray) {
+            if (array.usedLayers == array.capacity) {
+                growArray(array);
+            }
+            location.array = i;
+            location.layer = array.usedLayers++;
+            break;
+        }
+    }
+
+    if (location.array < 0) {
+        // The shader knows the arrays by unit, so a new one takes the place of one that was deleted
+        unsigned int slot = 0;
+        while (slot < textureArrays.size() && textureArrays[slot].id != 0) {
+            slot++;
+        }
+        if (slot == maxTextureArrays) {
+            if (!warnedArraysFull) {
+                std::cout << "Out of texture arrays, some materials will be drawn without textures" << std::endl;
+                warnedArraysFull = true;
+            }
+            return location;
+        }
+        if (slot == textureArrays.size()) {
+            textureArrays.emplace_back();
+        }
+        TextureArray &array = textureArrays[slot];
+        array.width = width;
+        array.height = height;
+        array.levels = levels;
+        array.format = format;
+        array.layerBytes = textureBytes(id, width, height, levels, baseLevel);
+        array.capacity = firstArrayLayers;
+        array.usedLayers = 1;
+        array.id = allocateArray(array, array.capacity);
+        arrayBytes += array.capacity * array.layerBytes;
+        setExtraTextureMemory(arrayBytes);
+        location.array = slot;
+        location.layer = 0;
+    }
+
+    for (GLint level = baseLevel; level < levels; level++) {
+        glCopyImageSubData(id, GL_TEXTURE_2D, level - baseLevel, 0, 0, 0,
+                           textureArrays[location.array].id, GL_TEXTURE_2D_ARRAY, level, 0, 0, location.layer,
+                           std::max(1, width >> level), std::max(1, height >> level), 1);
+    }
+    arrayLayers[id] = location;
+    return location;
+}
+
+void updateMaterials() {
+    if (textureMode == MATERIAL_TEXTURES_BOUND) {
+        return;
+    }
+
+    for (unsigned int i = 0; i < materials.size(); i++) {
+        Material &material = materials[i];
+        for (int slot = 0; slot < MATERIAL_SLOT_COUNT; slot++) {
+            int id = material.textures[slot];
+            if (id == material.currentIDs[slot]) {
+                continue;
+            }
+            material.currentIDs[slot] = id;
+            materialsDirty = true;
+
+            GPUMaterial &gpuMaterial = gpuMaterials[i];
+            if (id < 0) {
+                gpuMaterial.handles[slot][0] = gpuMaterial.handles[slot][1] = 0;
+                gpuMaterial.layers[slot][0] = gpuMaterial.layers[slot][1] = -1;
+                gpuMaterial.layers[slot][2] = 0;
+            } else if (textureMode == MATERIAL_TEXTURES_BINDLESS) {
+                GLuint64 handle = bindlessHandle(id);
+                gpuMaterial.handles[slot][0] = GLuint(handle & 0xFFFFFFFF);
+                gpuMaterial.handles[slot][1] = GLuint(handle >> 32);
+            } else {
+                ArrayLayer location = arrayLayer(id);
+                gpuMaterial.layers[slot][0] = location.array;
+                gpuMaterial.layers[slot][1] = location.layer;
+                gpuMaterial.layers[slot][2] = location.baseLevel;
+            }
+        }
+    }
+
+    for (TextureArray &array : textureArrays) {
+        if (array.id != 0 && (int)array.freeLayers.size() == array.usedLayers) {
+            freeArray(array);
+        }
+    }
+
+    if (materialsDirty && !gpuMaterials.empty()) {
+        size_t size = gpuMaterials.size() * sizeof(GPUMaterial);
+        if (size > materialBufferCapacity) {
+            glDeleteBuffers(1, &materialBufferID);
+            materialBufferCapacity = std::max(size, 2 * materialBufferCapacity);
+            glCreateBuffers(1, &materialBufferID);
+            glNamedBufferStorage(materialBufferID, materialBufferCapacity, nullptr, GL_DYNAMIC_STORAGE_BIT);
+        }
+        glNamedBufferSubData(materialBufferID, 0, size, gpuMaterials.data());
+        materialsDirty = false;
+    }
+
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, materialBufferBinding, materialBufferID);
+    for (unsigned int i = 0; i < textureArrays.size(); i++) {
+        glBindTextureUnit(firstArrayUnit + i, textureArrays[i].id);
+    }
+}
+
+void shutdownMaterials() {
+    for (auto &handle : bindlessHandles) {
+        glMakeTextureHandleNonResidentARB(handle.second);
+    }
+    bindlessHandles.clear();
+    for (TextureArray &array : textureArrays) {
+        glDeleteTextures(1, &array.id);
+    }
+    textureArrays.clear();
+    arrayLayers.clear();
+    arrayBytes = 0;
+    setExtraTextureMemory(0);
+    glDeleteBuffers(1, &materialBufferID);
+    materialBufferID = 0;
+    materialBufferCapacity = 0;
+    materials.clear();
+    gpuMaterials.clear();
+    freeMaterials.clear();
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <string>
+
+// How the shader gets at the textures of a node
+enum MaterialTextureMode {
+    MATERIAL_TEXTURES_BOUND,    // Bound to units 0-4 before every draw
+    MATERIAL_TEXTURES_BINDLESS, // GL_ARB_bindless_texture handles in the material buffer
+    MATERIAL_TEXTURES_ARRAYS    // Copied into GL_TEXTURE_2D_ARRAY layers, one array per texture size
+};
+
+// The texture slots of a material, in the same order as the shader reads them
+enum MaterialSlot {
+    MATERIAL_DIFFUSE, MATERIAL_NORMAL_MAP, MATERIAL_ROUGHNESS, MATERIAL_METAL_ROUGHNESS, MATERIAL_SLOT_COUNT
+};
+
+// Falls back to texture arrays if bindless textures are asked for but not supported. Returns the mode in use.
+MaterialTextureMode initMaterials(MaterialTextureMode mode);
+MaterialTextureMode materialTextureMode();
+
+// Defines to put in front of the shaders so they read textures the same way
+std::string materialShaderDefines();
+
+// Materials belong to the GL thread, so call all of these there.
+
+// A new material without textures
+int createMaterial();
+// Frees the material's slot for the next createMaterial()
+void releaseMaterial(int material);
+
+// The texture IDs of the material's slots, -1 for slots it does not use. The texture loader replaces placeholders
+// after the material is made, so set them every frame, only the ones that changed are uploaded.
+void setMaterialTextures(int material, const int textureIDs[MATERIAL_SLOT_COUNT]);
+
+// Uploads the texture IDs that changed since the last frame and binds the material buffer (and arrays) for drawing.
+// Call once per frame before the first draw.
+void updateMaterials();
+
+void shutdownMaterials();
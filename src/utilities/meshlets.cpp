@@ -0,0 +1,243 @@
+#include "meshlets.h"
+#include <unordered_map>
+#include <algorithm>
+#include <cstring>
+#include <cmath>
+
+namespace {
+
+struct PositionHash {
+    size_t operator()(const glm::vec3 &p) const {
+        unsigned int bits[3];
+        std::memcpy(bits, &p, sizeof(bits));
+        return (bits[0] * 73856093u) ^ (bits[1] * 19349663u) ^ (bits[2] * 83492791u);
+    }
+};
+
+struct PositionEqual {
+    bool operator()(const glm::vec3 &a, const glm::vec3 &b) const {
+        return a.x == b.x && a.y == b.y && a.z == b.z;
+    }
+};
+
+void computeBounds(const Mesh &mesh, const std::vector<glm::vec3> &faceNormals, const std::vector<unsigned int> &triangles, Meshlet &meshlet) {
+    glm::vec3 minCorner(INFINITY);
+    glm::vec3 maxCorner(-INFINITY);
+    for (unsigned int triangle : triangles) {
+        for (int corner = 0; corner < 3; corner++) {
+            const glm::vec3 &p = mesh.vertices[mesh.indices[3 * triangle + corner]];
+            minCorner = glm::min(minCorner, p);
+            maxCorner = glm::max(maxCorner, p);
+        }
+    }
+
+    meshlet.center = (minCorner + maxCorner) * 0.5f;
+    meshlet.radius = 0;
+    for (unsigned int triangle : triangles) {
+        for (int corner = 0; corner < 3; corner++) {
+            const glm::vec3 &p = mesh.vertices[mesh.indices[3 * triangle + corner]];
+            meshlet.radius = std::max(meshlet.radius, glm::length(p - meshlet.center));
+        }
+    }
+
+    glm::vec3 axis(0);
+    for (unsigned int triangle : triangles) {
+        axis += faceNormals[triangle];
+    }
+
+    float axisLength = glm::length(axis);
+    meshlet.coneAxis = glm::vec3(0);
+    meshlet.coneCutoff = 1;
+    if (axisLength == 0) {
+        return;
+    }
+    axis /= axisLength;
+
+    float minDot = 1;
+    for (unsigned int triangle : triangles) {
+        minDot = std::min(minDot, glm::dot(axis, faceNormals[triangle]));
+    }
+
+    // A cone of 90 degrees or more contains triangles facing every direction
+    if (minDot <= 0) {
+        return;
+    }
+    meshlet.coneAxis = axis;
+    meshlet.coneCutoff = std::sqrt(1 - minDot * minDot);
+}
+
+}
+
+std::vector<Meshlet> buildMeshlets(Mesh &mesh, unsigned int maxVertices, unsigned int maxTriangles) {
+    std::vector<Meshlet> meshlets;
+    unsigned int triangleCount = mesh.indices.size() / 3;
+    if (triangleCount == 0) {
+        return meshlets;
+    }
+
+    // Weld vertices by position so adjacency also works for unindexed meshes
+    std::unordered_map<glm::vec3, unsigned int, PositionHash, PositionEqual> weldMap;
+    std::vector<unsigned int> welded(mesh.vertices.size());
+    for (unsigned int i = 0; i < mesh.vertices.size(); i++) {
+        welded[i] = weldMap.emplace(mesh.vertices[i], weldMap.size()).first->second;
+    }
+    unsigned int weldedCount = weldMap.size();
+
+    // Triangles touching each welded vertex, as offsets into one flat array
+    std::vector<unsigned int> adjacencyOffsets(weldedCount + 1, 0);
+    for (unsigned int index : mesh.indices) {
+        adjacencyOffsets[welded[index] + 1]++;
+    }
+    for (unsigned int i = 0; i < weldedCount; i++) {
+        adjacencyOffsets[i + 1] += adjacencyOffsets[i];
+    }
+    std::vector<unsigned int> adjacency(adjacencyOffsets.back());
+    std::vector<unsigned int> fill(adjacencyOffsets.begin(), adjacencyOffsets.end() - 1);
+    for (unsigned int triangle = 0; triangle < triangleCount; triangle++) {
+        for (int corner = 0; corner < 3; corner++) {
+            adjacency[fill[welded[mesh.indices[3 * triangle + corner]]]++] = triangle;
+        }
+    }
+
+    std::vector<glm::vec3> faceNormals(triangleCount);
+    for (unsigned int triangle = 0; triangle < triangleCount; triangle++) {
+        const glm::vec3 &v0 = mesh.vertices[mesh.indices[3 * triangle + 0]];
+        const glm::vec3 &v1 = mesh.vertices[mesh.indices[3 * triangle + 1]];
+        const glm::vec3 &v2 = mesh.vertices[mesh.indices[3 * triangle + 2]];
+        glm::vec3 normal = glm::cross(v1 - v0, v2 - v0);
+        float area = glm::length(normal);
+        faceNormals[triangle] = area > 0 ? normal / area : glm::vec3(0);
+    }
+
+    std::vector<bool> assigned(triangleCount, false);
+    std::vector<unsigned int> reordered;
+    reordered.reserve(mesh.indices.size());
+
+    std::vector<unsigned int> clusterVertices;
+    std::vector<unsigned int> clusterTriangles;
+    std::vector<unsigned int> candidates;
+
+    auto newVertexCount = [&](unsigned int triangle) {
+        unsigned int count = 0;
+        for (int corner = 0; corner < 3; corner++) {
+            unsigned int vertex = welded[mesh.indices[3 * triangle + corner]];
+            if (std::find(clusterVertices.begin(), clusterVertices.end(), vertex) == clusterVertices.end()) {
+                count++;
+            }
+        }
+        return count;
+    };
+
+    unsigned int seed = 0;
+    while (true) {
+        while (seed < triangleCount && assigned[seed]) {
+            seed++;
+        }
+        if (seed == triangleCount) {
+            break;
+        }
+
+        clusterVertices.clear();
+        clusterTriangles.clear();
+        candidates.clear();
+        candidates.push_back(seed);
+
+        // Grow the cluster greedily, always taking the neighbour that adds the fewest new vertices
+        while (clusterTriangles.size() < maxTriangles) {
+            int best = -1;
+            unsigned int bestCost = 4;
+            for (unsigned int i = 0; i < candidates.size(); i++) {
+                if (assigned[candidates[i]]) {
+                    continue;
+                }
+                unsigned int cost = newVertexCount(candidates[i]);
+                if (cost < bestCost) {
+                    best = i;
+                    bestCost = cost;
+                }
+            }
+            if (best == -1 || clusterVertices.size() + bestCost > maxVertices) {
+                break;
+            }
+
+            unsigned int triangle = candidates[best];
+            assigned[triangle] = true;
+            clusterTriangles.push_back(triangle);
+            for (int corner = 0; corner < 3; corner++) {
+                unsigned int vertex = welded[mesh.indices[3 * triangle + corner]];
+                if (std::find(clusterVertices.begin(), clusterVertices.end(), vertex) != clusterVertices.end()) {
+                    continue;
+                }
+                clusterVertices.push_back(vertex);
+                for (unsigned int a = adjacencyOffsets[vertex]; a < adjacencyOffsets[vertex + 1]; a++) {
+                    if (!assigned[adjacency[a]]) {
+                        candidates.push_back(adjacency[a]);
+                    }
+                }
+            }
+
+            // Drop candidates that were taken in the meantime so the list stays short
+            candidates.erase(std::remove_if(candidates.begin(), candidates.end(),
+                                            [&](unsigned int t) { return assigned[t]; }),
+                             candidates.end());
+        }
+
+        Meshlet meshlet;
+        meshlet.indexOffset = reordered.size();
+        meshlet.indexCount = 3 * clusterTriangles.size();
+        computeBounds(mesh, faceNormals, clusterTriangles, meshlet);
+        for (unsigned int triangle : clusterTriangles) {
+            reordered.push_back(mesh.indices[3 * triangle + 0]);
+            reordered.push_back(mesh.indices[3 * triangle + 1]);
+            reordered.push_back(mesh.indices[3 * triangle + 2]);
+        }
+        meshlets.push_back(meshlet);
+    }
+
+    mesh.indices = reordered;
+    return meshlets;
+}
+
+void cullMeshlets(const std::vector<Meshlet> &meshlets, const glm::mat4 &MVP, glm::vec3 objectSpaceCamera, MeshletDrawList &drawList) {
+    // Frustum planes in object space (Gribb & Hartmann), normalised so sphere distances are exact
+    glm::vec4 planes[6];
+    for (int axis = 0; axis < 3; axis++) {
+        glm::vec4 row(MVP[0][axis], MVP[1][axis], MVP[2][axis], MVP[3][axis]);
+        glm::vec4 w(MVP[0][3], MVP[1][3], MVP[2][3], MVP[3][3]);
+        planes[2 * axis + 0] = w + row;
+        planes[2 * axis + 1] = w - row;
+    }
+    for (glm::vec4 &plane : planes) {
+        plane /= glm::length(glm::vec3(plane));
+    }
+
+    bool extending = false;
+    for (const Meshlet &meshlet : meshlets) {
+        bool visible = true;
+        for (const glm::vec4 &plane : planes) {
+            if (glm::dot(glm::vec3(plane), meshlet.center) + plane.w < -meshlet.radius) {
+                visible = false;
+                break;
+            }
+        }
+
+        // Back-facing test against the normal cone, valid for every point inside the bounding sphere
+        glm::vec3 toCenter = meshlet.center - objectSpaceCamera;
+        if (visible && glm::dot(toCenter, meshlet.coneAxis) >= meshlet.coneCutoff * glm::length(toCenter) + meshlet.radius) {
+            visible = false;
+        }
+
+        if (!visible) {
+            extending = false;
+            continue;
+        }
+
+        if (extending) {
+            drawList.counts.back() += meshlet.indexCount;
+        } else {
+            drawList.counts.push_back(meshlet.indexCount);
+            drawList.offsets.push_back((const void*)(meshlet.indexOffset * sizeof(unsigned int)));
+            extending = true;
+        }
+    }
+}
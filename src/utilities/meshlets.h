@@ -0,0 +1,39 @@
+#pragma once
+
+#include "mesh.h"
+#include <glad/glad.h>
+#include <glm/mat4x4.hpp>
+#include <vector>
+
+// A small cluster of neighbouring triangles that is culled as a unit.
+// Bounds are in object space, so the mesh can be shared between several nodes.
+struct Meshlet {
+    // Range in the (reordered) index buffer of the mesh
+    unsigned int indexOffset;
+    unsigned int indexCount;
+
+    // Bounding sphere
+    glm::vec3 center;
+    float radius;
+
+    // Normal cone. Every triangle normal lies within the cone around coneAxis,
+    // coneCutoff is the sine of its half angle (1 means the cone is too wide to ever cull)
+    glm::vec3 coneAxis;
+    float coneCutoff;
+};
+
+// Scratch arrays for glMultiDrawElements, reused between draws so culling does not allocate
+struct MeshletDrawList {
+    std::vector<GLsizei> counts;
+    std::vector<const void*> offsets;
+};
+
+// Partitions the triangles of the mesh into meshlets. This reorders mesh.indices so every
+// meshlet is a contiguous range, so call it before generateBuffer().
+// Vertices are counted after welding identical positions, so the unindexed data from
+// loadObj() still gets full sized clusters.
+std::vector<Meshlet> buildMeshlets(Mesh &mesh, unsigned int maxVertices = 64, unsigned int maxTriangles = 124);
+
+// Appends the index ranges of all meshlets that are inside the frustum and not facing away
+// from the camera to the draw list. Neighbouring survivors are merged into one range.
+void cullMeshlets(const std::vector<Meshlet> &meshlets, const glm::mat4 &MVP, glm::vec3 objectSpaceCamera, MeshletDrawList &drawList);
@@ -0,0 +1,446 @@
+#include "profiler.h"
+#include "glfont.h"
+#include <glad/glad.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+
+// Queries are read back this many frames after they are issued, by which time the GPU is long done with them
+static const unsigned int framesInFlight = 4;
+
+// The GPU scopes of one frame. Each scope has a query for its start and one for its end.
+struct PendingQueries {
+    unsigned long long frame;
+    std::vector<GLuint> queries;
+    std::vector<int> events; // The event of every query pair
+    size_t used;
+};
+
+// Smoothed times for the overlay, one per place in the scope tree
+struct ProfileStat {
+    const char* name;
+    int depth;
+    std::vector<int> children;
+    double cpu;
+    double gpu;
+    double frameCpu;
+    double frameGpu;
+    bool hasGpu;
+};
+
+// A scope that has begun on this thread, and the frame it went into
+struct OpenScope {
+    unsigned long long frame;
+    int event;
+};
+
+// Guards the open frame, which every thread adds to. Frames that have ended only change on the thread running them.
+static std::mutex profilerMutex;
+static bool initialised = false;
+static std::chrono::steady_clock::time_point startTime;
+static std::vector<ProfileFrame> history;
+static unsigned long long frameIndex = 0;
+static bool frameOpen = false;
+
+static thread_local std::vector<OpenScope> openScopes;
+static thread_local int threadNumber = -1;
+static thread_local const char* threadName = nullptr;
+static int threadCount = 1; // 0 is kept for the thread running the frames
+static std::vector<const char*> threadNames;
+
+static PendingQueries pending[framesInFlight];
+static double gpuClockOffset[framesInFlight]; // CPU time minus GPU time when the frame began
+
+static std::vector<ProfileStat> stats; // stats[0] is the whole frame
+static std::vector<int> statOfEvent;
+static std::vector<ProfileCounter> counterStats;
+static std::atomic<bool> overlayVisible(false);
+
+
+static double now() {
+    std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - startTime;
+    return elapsed.count();
+}
+
+static ProfileFrame &currentFrame() {
+    return history[frameIndex % history.size()];
+}
+
+static void numberThread(int number) {
+    threadNumber = number;
+    if (threadNames.size() <= (size_t)number) {
+        threadNames.resize(number + 1, nullptr);
+    }
+    threadNames[number] = threadName;
+}
+
+void initProfiler(unsigned int historyFrames) {
+    startTime = std::chrono::steady_clock::now();
+    history.assign(std::max(historyFrames, framesInFlight), ProfileFrame());
+    for (ProfileFrame &frame : history) {
+        frame.index = ~0ull;
+    }
+    for (PendingQueries &frame : pending) {
+        frame.frame = ~0ull;
+        frame.used = 0;
+    }
+    stats.assign(1, ProfileStat{"frame", 0, {}, 0, 0, 0, 0, false});
+    frameIndex = 0;
+    frameOpen = false;
+    initialised = true;
+}
+
+void shutdownProfiler() {
+    for (PendingQueries &frame : pending) {
+        if (!frame.queries.empty()) {
+            glDeleteQueries(frame.queries.size(), frame.queries.data());
+        }
+        frame.queries.clear();
+        frame.events.clear();
+    }
+    history.clear();
+    stats.clear();
+    counterStats.clear();
+    initialised = false;
+}
+
+static int findStat(int parent, const char* name) {
+    for (int child : stats[parent].children) {
+        if (stats[child].name == name) {
+            return child;
+        }
+    }
+    stats.push_back(ProfileStat{name, stats[parent].depth + 1, {}, 0, 0, 0, 0, false});
+    stats[parent].children.push_back(stats.size() - 1);
+    return stats.size() - 1;
+}
+
+// Adds a finished frame to the overlay's averages. Scopes that run several times in a frame are summed.
+static void addToStats(const ProfileFrame &frame) {
+    statOfEvent.resize(frame.events.size());
+    stats[0].frameCpu = frame.cpuEnd - frame.cpuStart;
+    for (size_t i = 0; i < frame.events.size(); i++) {
+        const ProfileEvent &event = frame.events[i];
+        int stat = findStat(event.parent < 0 ? 0 : statOfEvent[event.parent], event.name);
+        statOfEvent[i] = stat;
+        stats[stat].frameCpu += event.cpuEnd - event.cpuStart;
+        if (event.gpuStart >= 0) {
+            stats[stat].frameGpu += event.gpuEnd - event.gpuStart;
+            stats[stat].hasGpu = true;
+        }
+    }
+    for (ProfileStat &stat : stats) {
+        stat.cpu = 0.95 * stat.cpu + 0.05 * stat.frameCpu;
+        stat.gpu = 0.95 * stat.gpu + 0.05 * stat.frameGpu;
+        stat.frameCpu = 0;
+        stat.frameGpu = 0;
+    }
+
+    for (ProfileCounter &stat : counterStats) {
+        stat.value *= 0.95;
+    }
+    for (const ProfileCounter &counter : frame.counters) {
+        auto stat = std::find_if(counterStats.begin(), counterStats.end(), [&](const ProfileCounter &stat) { return stat.name == counter.name; });
+        if (stat == counterStats.end()) {
+            counterStats.push_back(ProfileCounter{counter.name, 0});
+            stat = counterStats.end() - 1;
+        }
+        stat->value += 0.05 * counter.value;
+    }
+}
+
+// Reads the queries of the frame that used this slot last. If the GPU is somehow still not done with them, that
+// frame just goes without GPU times rather than making us wait.
+static void resolveQueries(unsigned int slot) {
+    PendingQueries &queries = pending[slot];
+    if (queries.frame == ~0ull) {
+        return;
+    }
+    ProfileFrame &frame = history[queries.frame % history.size()];
+    if (frame.index != queries.frame) {
+        queries.used = 0;
+        return; // Already pushed out of the history
+    }
+    GLuint available = queries.used == 0;
+    if (queries.used > 0) {
+        glGetQueryObjectuiv(queries.queries[2 * queries.used - 1], GL_QUERY_RESULT_AVAILABLE, &available);
+    }
+    if (available) {
+        for (size_t i = 0; i < queries.used; i++) {
+            GLuint64 start = 0, end = 0;
+            glGetQueryObjectui64v(queries.queries[2 * i], GL_QUERY_RESULT, &start);
+            glGetQueryObjectui64v(queries.queries[2 * i + 1], GL_QUERY_RESULT, &end);
+            ProfileEvent &event = frame.events[queries.events[i]];
+            event.gpuStart = start / 1e6 + gpuClockOffset[slot];
+            event.gpuEnd = end / 1e6 + gpuClockOffset[slot];
+        }
+    }
+    addToStats(frame);
+    queries.used = 0;
+}
+
+void beginProfilerFrame() {
+    std::lock_guard<std::mutex> lock(profilerMutex);
+    if (!initialised) {
+        return;
+    }
+    if (threadNumber != 0) {
+        numberThread(0);
+    }
+    unsigned int slot = frameIndex % framesInFlight;
+    resolveQueries(slot);
+    pending[slot].frame = frameIndex;
+
+    ProfileFrame &frame = currentFrame();
+    frame.index = frameIndex;
+    frame.events.clear();
+    frame.counters.clear();
+    frame.cpuStart = now();
+    frame.cpuEnd = frame.cpuStart;
+    GLint64 gpuTime = 0;
+    glGetInteger64v(GL_TIMESTAMP, &gpuTime);
+    gpuClockOffset[slot] = frame.cpuStart - gpuTime / 1e6;
+    openScopes.clear();
+    frameOpen = true;
+}
+
+static void endScope() {
+    OpenScope scope = openScopes.back();
+    openScopes.pop_back();
+    if (!frameOpen || scope.frame != frameIndex) {
+        return; // Cut off at the end of its frame already
+    }
+    ProfileFrame &frame = currentFrame();
+    frame.events[scope.event].cpuEnd = now();
+    if (threadNumber != 0) {
+        return;
+    }
+
+    // GPU scopes are kept in the order they began, so going backwards this scope comes before any that began earlier
+    PendingQueries &queries = pending[frameIndex % framesInFlight];
+    for (size_t i = queries.used; i-- > 0;) {
+        if (queries.events[i] == scope.event) {
+            glQueryCounter(queries.queries[2 * i + 1], GL_TIMESTAMP);
+            break;
+        }
+        if (queries.events[i] < scope.event) {
+            break;
+        }
+    }
+}
+
+void endProfilerFrame() {
+    std::lock_guard<std::mutex> lock(profilerMutex);
+    if (!frameOpen) {
+        return;
+    }
+    while (!openScopes.empty()) {
+        endScope();
+    }
+    // Scopes other threads still have open end here
+    ProfileFrame &frame = currentFrame();
+    frame.cpuEnd = now();
+    for (ProfileEvent &event : frame.events) {
+        if (event.thread != 0 && event.cpuEnd == event.cpuStart) {
+            event.cpuEnd = frame.cpuEnd;
+        }
+    }
+    frameOpen = false;
+    frameIndex++;
+}
+
+void beginProfileScope(const char* name, bool gpu) {
+    std::lock_guard<std::mutex> lock(profilerMutex);
+    if (!frameOpen) {
+        return;
+    }
+    if (threadNumber < 0) {
+        numberThread(threadCount++);
+    }
+    ProfileFrame &frame = currentFrame();
+    ProfileEvent event;
+    event.name = name;
+    // A parent left behind in an earlier frame does not count
+    event.parent = openScopes.empty() || openScopes.back().frame != frameIndex ? -1 : openScopes.back().event;
+    event.thread = threadNumber;
+    event.cpuStart = now();
+    event.cpuEnd = event.cpuStart;
+    event.gpuStart = event.gpuEnd = -1;
+    frame.events.push_back(event);
+    openScopes.push_back(OpenScope{frameIndex, int(frame.events.size() - 1)});
+
+    if (gpu && threadNumber == 0) {
+        PendingQueries &queries = pending[frameIndex % framesInFlight];
+        if (2 * queries.used == queries.queries.size()) {
+            queries.queries.resize(queries.queries.size() + 2);
+            glGenQueries(2, &queries.queries[queries.queries.size() - 2]);
+        }
+        if (queries.events.size() == queries.used) {
+            queries.events.push_back(0);
+        }
+        queries.events[queries.used] = frame.events.size() - 1;
+        glQueryCounter(queries.queries[2 * queries.used], GL_TIMESTAMP);
+        queries.used++;
+    }
+}
+
+void endProfileScope() {
+    std::lock_guard<std::mutex> lock(profilerMutex);
+    if (!openScopes.empty()) {
+        endScope();
+    }
+}
+
+void addProfileCounter(const char* name, double amount) {
+    std::lock_guard<std::mutex> lock(profilerMutex);
+    if (!frameOpen) {
+        return;
+    }
+    std::vector<ProfileCounter> &counters = currentFrame().counters;
+    for (ProfileCounter &counter : counters) {
+        if (counter.name == name) {
+            counter.value += amount;
+            return;
+        }
+    }
+    counters.push_back(ProfileCounter{name, amount});
+}
+
+void nameProfilerThread(const char* name) {
+    std::lock_guard<std::mutex> lock(profilerMutex);
+    threadName = name;
+    if (threadNumber >= 0) {
+        threadNames[threadNumber] = name;
+    }
+}
+
+void finishProfiler() {
+    std::lock_guard<std::mutex> lock(profilerMutex);
+    if (!initialised) {
+        return;
+    }
+    glFinish();
+    for (unsigned long long i = 0; i < framesInFlight; i++) {
+        unsigned int slot = (frameIndex + i) % framesInFlight; // Oldest first, the stats are smoothed in order
+        resolveQueries(slot);
+        pending[slot].frame = ~0ull;
+    }
+}
+
+static std::vector<const ProfileFrame*> endedFrames() {
+    std::vector<const ProfileFrame*> frames;
+    unsigned long long first = frameIndex > history.size() ? frameIndex - history.size() : 0;
+    for (unsigned long long i = first; i < frameIndex; i++) {
+        const ProfileFrame &frame = history[i % history.size()];
+        if (frame.index == i) {
+            frames.push_back(&frame);
+        }
+    }
+    return frames;
+}
+
+std::vector<const ProfileFrame*> profileHistory() {
+    std::lock_guard<std::mutex> lock(profilerMutex);
+    return endedFrames();
+}
+
+static void drawStat(int statIndex, float x, float &y, float characterWidth, float lineHeight) {
+    const ProfileStat &stat = stats[statIndex];
+    char line[96];
+    int indent = std::min(2 * stat.depth, 20);
+    if (stat.hasGpu) {
+        snprintf(line, sizeof(line), "%*s%-*s cpu %6.2f  gpu %6.2f", indent, "", 24 - indent, stat.name, stat.cpu, stat.gpu);
+    } else {
+        snprintf(line, sizeof(line), "%*s%-*s cpu %6.2f", indent, "", 24 - indent, stat.name, stat.cpu);
+    }
+    drawText(line, x, y, characterWidth);
+    y -= lineHeight;
+    for (int child : stat.children) {
+        drawStat(child, x, y, characterWidth, lineHeight);
+    }
+}
+
+void drawProfilerOverlay(float x, float y, float characterWidth) {
+    if (!overlayVisible || stats.empty()) {
+        return;
+    }
+    float lineHeight = characterWidth * 39.0f / 29.0f * 1.2f;
+    drawText("scope (ms)", x, y, characterWidth);
+    y -= lineHeight;
+    drawStat(0, x, y, characterWidth, lineHeight);
+    for (const ProfileCounter &counter : counterStats) {
+        char line[64];
+        snprintf(line, sizeof(line), "%-24s %10.0f", counter.name, counter.value);
+        drawText(line, x, y, characterWidth);
+        y -= lineHeight;
+    }
+}
+
+void setProfilerOverlayVisible(bool visible) {
+    overlayVisible = visible;
+}
+
+bool profilerOverlayVisible() {
+    return overlayVisible;
+}
+
+static void writeTraceEvent(std::ofstream &file, bool &first, const char* name, int thread, double start, double end) {
+    file << (first ? "\n" : ",\n");
+    first = false;
+    file << "{\"name\":\"";
+    for (const char* c = name; *c; c++) {
+        if (*c == '"' || *c == '\\') {
+            file << '\\';
+        }
+        file << *c;
+    }
+    file << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << thread << ",\"ts\":" << start * 1000 << ",\"dur\":" << (end - start) * 1000 << "}";
+}
+
+// The GPU gets the second thread in the trace, after the one running the frames
+static int traceThread(int thread) {
+    return thread == 0 ? 1 : thread + 2;
+}
+
+static void writeThreadName(std::ofstream &file, int thread, const char* name) {
+    file << ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << thread << ",\"args\":{\"name\":\"" << name << "\"}}";
+}
+
+bool writeChromeTrace(const std::string &fileName) {
+    // Other threads may still be profiling, this keeps the frames still while they are written
+    std::lock_guard<std::mutex> lock(profilerMutex);
+    std::ofstream file(fileName);
+    if (!file) {
+        std::cout << "Could not write the profile to " << fileName << std::endl;
+        return false;
+    }
+    file.precision(3);
+    file << std::fixed << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+    file << "\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":2,\"args\":{\"name\":\"GPU\"}}";
+    for (size_t thread = 0; thread < std::max<size_t>(threadNames.size(), 1); thread++) {
+        char name[32];
+        snprintf(name, sizeof(name), thread == 0 ? "CPU" : "CPU %d", int(thread));
+        writeThreadName(file, traceThread(thread), thread < threadNames.size() && threadNames[thread] ? threadNames[thread] : name);
+    }
+    bool first = false;
+    for (const ProfileFrame* frame : endedFrames()) {
+        writeTraceEvent(file, first, "frame", 1, frame->cpuStart, frame->cpuEnd);
+        for (const ProfileCounter &counter : frame->counters) {
+            file << ",\n{\"name\":\"" << counter.name << "\",\"ph\":\"C\",\"pid\":1,\"ts\":" << frame->cpuStart * 1000
+                 << ",\"args\":{\"value\":" << counter.value << "}}";
+        }
+        for (const ProfileEvent &event : frame->events) {
+            writeTraceEvent(file, first, event.name, traceThread(event.thread), event.cpuStart, event.cpuEnd);
+            if (event.gpuStart >= 0) {
+                writeTraceEvent(file, first, event.name, 2, event.gpuStart, event.gpuEnd);
+            }
+        }
+    }
+    file << "\n]}\n";
+    std::cout << "Wrote the profile to " << fileName << std::endl;
+    return bool(file);
+}
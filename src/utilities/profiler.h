@@ -0,0 +1,81 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+// Scoped CPU timers, nested into a tree per frame, with GPU timers on the scopes that issue GL work.
+// The GPU times come from timestamp queries that are read back a few frames later, so the profiler never
+// waits for the GPU. The last frames are kept in memory, to show on screen or to write out as a Chrome trace
+// (open it in chrome://tracing or ui.perfetto.dev).
+
+// Needs the GL context. historyFrames is how many frames are kept for the trace.
+void initProfiler(unsigned int historyFrames = 600);
+void shutdownProfiler();
+
+// Everything profiled between these belongs to one frame. The thread calling these is the one with the GL context.
+void beginProfilerFrame();
+void endProfilerFrame();
+
+// Scopes nest in the order they begin on their thread, and have to end in the opposite order. The name is kept
+// as a pointer, so use string literals. A GPU scope also measures the GL commands issued inside it, on the thread
+// running the frames; elsewhere it is timed on the CPU only.
+// Other threads can profile too. Their scopes go into the frame that is open when they begin (between frames
+// they are dropped), and are cut off where that frame ends.
+void beginProfileScope(const char* name, bool gpu = false);
+void endProfileScope();
+
+struct ProfileScope {
+    ProfileScope(const char* name, bool gpu = false) { beginProfileScope(name, gpu); }
+    ~ProfileScope() { endProfileScope(); }
+};
+#define PROFILE_CONCAT_(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_(a, b)
+#define PROFILE_SCOPE(name) ProfileScope PROFILE_CONCAT(profileScope, __LINE__)(name)
+#define PROFILE_GPU_SCOPE(name) ProfileScope PROFILE_CONCAT(profileScope, __LINE__)(name, true)
+
+// Adds to a per frame total, like draw calls or triangles. The name is kept as a pointer here too.
+void addProfileCounter(const char* name, double amount);
+
+// What the calling thread is called in the Chrome trace. The name is kept as a pointer.
+void nameProfilerThread(const char* name);
+
+// Times are milliseconds since initProfiler(). GPU times are moved onto the same clock.
+struct ProfileEvent {
+    const char* name;
+    int parent;        // Index in the frame's events, -1 at the top
+    int thread;        // 0 for the thread running the frames, the others are numbered as they first profile
+    double cpuStart;
+    double cpuEnd;
+    double gpuStart;   // Negative for CPU only scopes, and until the queries are read back
+    double gpuEnd;
+};
+
+struct ProfileCounter {
+    const char* name;
+    double value;
+};
+
+struct ProfileFrame {
+    unsigned long long index;
+    double cpuStart;
+    double cpuEnd;
+    std::vector<ProfileEvent> events; // In the order they began, so parents come before their children
+    std::vector<ProfileCounter> counters;
+};
+
+// The frames in the history that have ended, oldest first. Call from the thread running the frames; frames
+// that have ended are only changed by that thread.
+std::vector<const ProfileFrame*> profileHistory();
+
+// Waits for the GPU and reads back every query still out, so the whole history has its GPU times.
+// Call from the thread running the frames.
+void finishProfiler();
+
+// Smoothed times of every scope as an indented list, drawn with drawText() below the given point (pixels
+// from the lower left corner). Call before flushText().
+void drawProfilerOverlay(float x, float y, float characterWidth);
+void setProfilerOverlayVisible(bool visible);
+bool profilerOverlayVisible();
+
+// Writes the history in the Chrome trace event format, with the GPU scopes as a thread of their own
+bool writeChromeTrace(const std::string &fileName);
@@ -0,0 +1,376 @@
+#include "sceneFile.h"
+#include <cctype>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <sys/stat.h>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+struct SceneFileHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t nodeCount;
+    uint32_t nodesOffset;
+    uint32_t stringsOffset;
+    uint32_t stringsSize;
+};
+
+static const char sceneMagic[4] = {'G', 'S', 'C', 'N'};
+static const uint32_t sceneVersion = 2;
+
+// In the same order as SceneNodeType
+static const char* const nodeTypeNames[] = {"GEOMETRY", "POINT_LIGHT", "SPOT_LIGHT", "GEOMETRY_2D", "GEOMETRY_NORMAL_MAPPED", "DIRECTIONAL_LIGHT"};
+static const uint32_t nodeTypeCount = sizeof(nodeTypeNames) / sizeof(nodeTypeNames[0]);
+
+static long long modificationTime(const std::string &fileName) {
+    struct stat info;
+    if (stat(fileName.c_str(), &info) != 0) {
+        return -1;
+    }
+    return (long long)info.st_mtime;
+}
+
+// Every distinct string once, so nodes sharing a mesh or texture also share the offset
+struct StringTable {
+    std::vector<char> data = std::vector<char>(1, '\0');
+    std::unordered_map<std::string, uint32_t> offsets;
+
+    uint32_t add(const std::string &value) {
+        if (value.empty()) {
+            return 0;
+        }
+        auto existing = offsets.find(value);
+        if (existing != offsets.end()) {
+            return existing->second;
+        }
+        uint32_t offset = data.size();
+        data.insert(data.end(), value.begin(), value.end());
+        data.push_back('\0');
+        offsets[value] = offset;
+        return offset;
+    }
+};
+
+static bool readVector(std::istringstream &words, float vector[3]) {
+    return bool(words >> vector[0] >> vector[1] >> vector[2]);
+}
+
+static bool readRestOfLine(std::istringstream &words, std::string &value) {
+    std::getline(words >> std::ws, value);
+    while (!value.empty() && std::isspace((unsigned char)value.back())) {
+        value.pop_back();
+    }
+    return !value.empty();
+}
+
+// Parses the text form into the bytes of the binary form
+static bool parseScene(const std::string &fileName, std::vector<char> &binary) {
+    std::ifstream file(fileName);
+    if (!file) {
+        std::cout << "Could not open scene " << fileName << std::endl;
+        return false;
+    }
+
+    std::vector<SceneFileNode> nodes;
+    StringTable strings;
+    std::unordered_map<std::string, int> nodeByName;
+    std::string line;
+    int lineNumber = 0;
+    while (std::getline(file, line)) {
+        lineNumber++;
+        size_t comment = line.find('#');
+        if (comment != std::string::npos) {
+            line.erase(comment);
+        }
+        std::istringstream words(line);
+        std::string keyword;
+        if (!(words >> keyword)) {
+            continue;
+        }
+
+        std::string error;
+        SceneFileNode* node = nodes.empty() ? nullptr : &nodes.back();
+        std::string value;
+        if (keyword == "node") {
+            std::string name, type, parent;
+            words >> name >> type >> parent;
+            SceneFileNode newNode = {};
+            newNode.parent = -1;
+            newNode.scale[0] = newNode.scale[1] = newNode.scale[2] = 1;
+            newNode.spotAngles[0] = 0.3f;
+            newNode.spotAngles[1] = 0.5f;
+            newNode.type = nodeTypeCount;
+            for (uint32_t i = 0; i < nodeTypeCount; i++) {
+                if (type == nodeTypeNames[i]) {
+                    newNode.type = i;
+                }
+            }
+            if (name.empty() || newNode.type == nodeTypeCount) {
+                error = "expected \"node <name> <type> [parent]\"";
+            } else if (nodeByName.count(name)) {
+                error = "there is already a node called " + name;
+            } else if (!parent.empty() && !nodeByName.count(parent)) {
+                error = "the parent " + parent + " has to come before its children";
+            } else {
+                newNode.name = strings.add(name);
+                newNode.parent = parent.empty() ? -1 : nodeByName[parent];
+                nodeByName[name] = nodes.size();
+                nodes.push_back(newNode);
+            }
+        } else if (!node) {
+            error = "expected a node first";
+        } else if (keyword == "position") {
+            error = readVector(words, node->position) ? "" : "expected three numbers";
+        } else if (keyword == "rotation") {
+            error = readVector(words, node->rotation) ? "" : "expected three numbers";
+        } else if (keyword == "scale") {
+            error = readVector(words, node->scale) ? "" : "expected three numbers";
+        } else if (keyword == "reference") {
+            error = readVector(words, node->referencePoint) ? "" : "expected three numbers";
+        } else if (keyword == "light") {
+            error = readVector(words, node->lightColor) ? "" : "expected \"light <r> <g> <b> [range]\"";
+            words >> node->lightRange;
+        } else if (keyword == "spot") {
+            error = words >> node->spotAngles[0] >> node->spotAngles[1] ? "" : "expected \"spot <inner angle> <outer angle>\"";
+        } else if (keyword == "skybox") {
+            node->flags |= SCENE_NODE_SKYBOX;
+        } else if (!readRestOfLine(words, value)) {
+            error = "expected " + keyword + " to be followed by a name";
+        } else if (keyword == "mesh") {
+            node->mesh = strings.add(value);
+        } else if (keyword == "texture") {
+            node->texture = strings.add(value);
+        } else if (keyword == "normalmap") {
+            node->normalMap = strings.add(value);
+        } else if (keyword == "roughnessmap") {
+            node->roughnessMap = strings.add(value);
+        } else if (keyword == "metalroughnessmap") {
+            node->metalRoughnessMap = strings.add(value);
+        } else {
+            error = "unknown keyword " + keyword;
+        }
+
+        if (!error.empty()) {
+            std::cout << fileName << ":" << lineNumber << ": " << error << std::endl;
+            return false;
+        }
+    }
+
+    SceneFileHeader header;
+    std::memcpy(header.magic, sceneMagic, sizeof(sceneMagic));
+    header.version = sceneVersion;
+    header.nodeCount = nodes.size();
+    header.nodesOffset = sizeof(SceneFileHeader);
+    header.stringsOffset = header.nodesOffset + nodes.size() * sizeof(SceneFileNode);
+    header.stringsSize = strings.data.size();
+    binary.resize(header.stringsOffset + header.stringsSize);
+    std::memcpy(binary.data(), &header, sizeof(header));
+    if (!nodes.empty()) {
+        std::memcpy(binary.data() + header.nodesOffset, nodes.data(), nodes.size() * sizeof(SceneFileNode));
+    }
+    std::memcpy(binary.data() + header.stringsOffset, strings.data.data(), strings.data.size());
+    return true;
+}
+
+static bool writeFile(const std::string &fileName, const std::vector<char> &bytes) {
+    std::ofstream file(fileName, std::ios::binary);
+    file.write(bytes.data(), bytes.size());
+    return bool(file);
+}
+
+bool compileScene(const std::string &textFileName, const std::string &binaryFileName) {
+    std::vector<char> binary;
+    if (!parseScene(textFileName, binary)) {
+        return false;
+    }
+    if (!writeFile(binaryFileName, binary)) {
+        std::cout << "Could not write scene " << binaryFileName << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// Checks every offset and index once when opening, so nothing needs checking while instantiating
+static bool checkScene(SceneFile &scene, const std::string &fileName) {
+    SceneFileHeader header;
+    bool valid = scene.size >= sizeof(header);
+    if (valid) {
+        std::memcpy(&header, scene.data, sizeof(header));
+        valid = std::memcmp(header.magic, sceneMagic, sizeof(sceneMagic)) == 0 && header.version == sceneVersion
+             && header.nodesOffset % alignof(SceneFileNode) == 0
+             && header.nodesOffset + (uint64_t)header.nodeCount * sizeof(SceneFileNode) <= scene.size
+             && header.stringsSize > 0 && (uint64_t)header.stringsOffset + header.stringsSize <= scene.size
+             && scene.data[header.stringsOffset + header.stringsSize - 1] == '\0';
+    }
+    if (valid) {
+        scene.nodeCount = header.nodeCount;
+        scene.nodes = reinterpret_cast<const SceneFileNode*>(scene.data + header.nodesOffset);
+        scene.strings = scene.data + header.stringsOffset;
+        for (uint32_t i = 0; i < scene.nodeCount && valid; i++) {
+            const SceneFileNode &node = scene.nodes[i];
+            valid = node.parent >= -1 && node.parent < (int32_t)i && node.type < nodeTypeCount
+                 && node.name < header.stringsSize && node.mesh < header.stringsSize && node.texture < header.stringsSize
+                 && node.normalMap < header.stringsSize && node.roughnessMap < header.stringsSize
+                 && node.metalRoughnessMap < header.stringsSize;
+        }
+    }
+    if (!valid) {
+        std::cout << "Scene " << fileName << " is damaged or from another version" << std::endl;
+    }
+    return valid;
+}
+
+static bool mapFile(const std::string &fileName, SceneFile &scene) {
+#ifndef _WIN32
+    int file = open(fileName.c_str(), O_RDONLY);
+    struct stat info;
+    if (file >= 0 && fstat(file, &info) == 0 && info.st_size > 0) {
+        void* data = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+        close(file);
+        if (data == MAP_FAILED) {
+            return false;
+        }
+        scene.data = static_cast<const char*>(data);
+        scene.size = info.st_size;
+        scene.isMapped = true;
+        return true;
+    }
+    if (file >= 0) {
+        close(file);
+    }
+    return false;
+#else
+    // Read in whole where there is no mmap
+    std::ifstream file(fileName, std::ios::binary | std::ios::ate);
+    if (!file) {
+        return false;
+    }
+    scene.buffer.resize((size_t)file.tellg());
+    file.seekg(0);
+    file.read(scene.buffer.data(), scene.buffer.size());
+    scene.data = scene.buffer.data();
+    scene.size = scene.buffer.size();
+    return bool(file);
+#endif
+}
+
+// Compiles the text scene into scene.buffer and writes it out for next time
+static bool compileScene(const std::string &fileName, const std::string &binaryFileName, SceneFile &scene) {
+    if (!parseScene(fileName, scene.buffer)) {
+        return false;
+    }
+    if (!writeFile(binaryFileName, scene.buffer)) {
+        std::cout << "Could not write scene " << binaryFileName << ", it will be compiled again next time" << std::endl;
+    }
+    // Already in memory, so no need to map what was just written
+    scene.data = scene.buffer.data();
+    scene.size = scene.buffer.size();
+    return checkScene(scene, fileName);
+}
+
+bool openScene(const std::string &fileName, SceneFile &scene) {
+    closeScene(scene);
+    std::string binaryFileName = fileName;
+    size_t dot = fileName.rfind('.');
+    bool hasText = dot == std::string::npos || fileName.substr(dot) != ".bscene";
+    if (hasText) {
+        binaryFileName = fileName.substr(0, dot) + ".bscene";
+        long long binaryTime = modificationTime(binaryFileName);
+        if (binaryTime < 0 || binaryTime < modificationTime(fileName)) {
+            return compileScene(fileName, binaryFileName, scene);
+        }
+    }
+    if (!mapFile(binaryFileName, scene)) {
+        std::cout << "Could not open scene " << binaryFileName << std::endl;
+        return false;
+    }
+    if (!checkScene(scene, binaryFileName)) {
+        closeScene(scene);
+        // Left over from another version, so build it again from the text
+        return hasText && compileScene(fileName, binaryFileName, scene);
+    }
+    return true;
+}
+
+void closeScene(SceneFile &scene) {
+#ifndef _WIN32
+    if (scene.isMapped) {
+        munmap(const_cast<char*>(scene.data), scene.size);
+    }
+#endif
+    scene = SceneFile();
+}
+
+int findSceneFileNode(const SceneFile &scene, const std::string &name) {
+    for (uint32_t i = 0; i < scene.nodeCount; i++) {
+        if (name == scene.string(scene.nodes[i].name)) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static glm::vec3 toVec3(const float vector[3]) {
+    return glm::vec3(vector[0], vector[1], vector[2]);
+}
+
+std::vector<SceneNode*> instantiateScene(const SceneFile &scene, SceneNode* parent, const SceneResources &resources) {
+    std::vector<SceneNode*> nodes;
+    nodes.reserve(scene.nodeCount);
+    reserveTransforms(transformCount() + scene.nodeCount);
+    // Equal strings have equal offsets, so each mesh name is only looked up once
+    std::unordered_map<uint32_t, const SceneMesh*> meshByOffset;
+
+    for (uint32_t i = 0; i < scene.nodeCount; i++) {
+        const SceneFileNode &fileNode = scene.nodes[i];
+        SceneNode* node = createSceneNode((SceneNodeType)fileNode.type);
+        SceneNode* nodeParent = fileNode.parent < 0 ? parent : nodes[fileNode.parent];
+        if (nodeParent) {
+            addChild(nodeParent, node);
+        }
+        setLocalPosition(node->transform, toVec3(fileNode.position));
+        setLocalRotation(node->transform, toVec3(fileNode.rotation));
+        setLocalScale(node->transform, toVec3(fileNode.scale));
+        setReferencePoint(node->transform, toVec3(fileNode.referencePoint));
+        node->isSkybox = (fileNode.flags & SCENE_NODE_SKYBOX) != 0;
+
+        if (fileNode.mesh) {
+            auto cached = meshByOffset.find(fileNode.mesh);
+            if (cached == meshByOffset.end()) {
+                auto mesh = resources.meshes.find(scene.string(fileNode.mesh));
+                if (mesh == resources.meshes.end()) {
+                    std::cout << "The scene asks for the mesh " << scene.string(fileNode.mesh) << ", which was not loaded" << std::endl;
+                }
+                cached = meshByOffset.emplace(fileNode.mesh, mesh == resources.meshes.end() ? nullptr : &mesh->second).first;
+            }
+            if (cached->second) {
+                node->vertexArrayObjectID = cached->second->vertexArrayObjectID;
+                node->VAOIndexCount = cached->second->indexCount;
+                node->meshlets = cached->second->meshlets;
+                node->boundingRadius = cached->second->boundingRadius;
+                node->gpuMesh = cached->second->gpuMesh;
+            }
+        }
+
+        if (resources.loadTexture) {
+            struct { uint32_t fileName; TextureUsage usage; } textures[4] = {
+                {fileNode.texture, TEXTURE_COLOR},
+                {fileNode.normalMap, TEXTURE_NORMAL_MAP},
+                {fileNode.roughnessMap, TEXTURE_DATA},
+                {fileNode.metalRoughnessMap, TEXTURE_DATA}
+            };
+            for (int slot = 0; slot < 4; slot++) {
+                if (textures[slot].fileName) {
+                    node->textureHandles[slot] = resources.loadTexture(scene.string(textures[slot].fileName), textures[slot].usage);
+                }
+            }
+        }
+        nodes.push_back(node);
+    }
+    return nodes;
+}
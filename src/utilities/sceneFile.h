@@ -0,0 +1,82 @@
+#pragma once
+
+#include <sceneGraph.hpp>
+#include <utilities/textureLoader.h>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Scenes are written by hand as text (see res/scenes/glowbox.scene for the format), and compiled into a binary file
+// next to the text one the first time they are opened. The binary file is mapped straight into memory and used as
+// it is: every reference in it is an offset from the start of the file or an index into the node array, so nothing
+// needs patching after loading.
+
+// In the binary file, after the header
+struct SceneFileNode {
+    uint32_t name;              // Offsets into the string table, 0 for none (the table starts with an empty string)
+    int32_t parent;             // Index of the parent, always before this node, or -1 for the node instantiateScene() is given
+    uint32_t type;              // SceneNodeType
+    float position[3];
+    float rotation[3];
+    float scale[3];
+    float referencePoint[3];
+    uint32_t mesh;
+    uint32_t texture;
+    uint32_t normalMap;
+    uint32_t roughnessMap;
+    uint32_t metalRoughnessMap;
+    float lightColor[3];
+    float lightRange;           // 0 for no limit
+    float spotAngles[2];        // Inner and outer, radians
+    uint32_t flags;
+};
+
+enum SceneFileNodeFlags {
+    SCENE_NODE_SKYBOX = 1
+};
+
+struct SceneFile {
+    const char* data = nullptr;
+    size_t size = 0;
+    uint32_t nodeCount = 0;
+    const SceneFileNode* nodes = nullptr;
+    const char* strings = nullptr;
+
+    std::vector<char> buffer; // Holds the file when it could not be mapped
+    bool isMapped = false;
+
+    const char* string(uint32_t offset) const {
+        return strings + offset;
+    }
+};
+
+// Opens a .scene text file through its compiled .bscene, which is rebuilt if it is missing, older than the text,
+// or does not pass the checks (from another version). A .bscene can also be opened directly.
+bool openScene(const std::string &fileName, SceneFile &scene);
+void closeScene(SceneFile &scene);
+
+// Writes the binary form of a text scene
+bool compileScene(const std::string &textFileName, const std::string &binaryFileName);
+
+// -1 if there is no node with that name
+int findSceneFileNode(const SceneFile &scene, const std::string &name);
+
+// What a mesh name in the scene file stands for
+struct SceneMesh {
+    int vertexArrayObjectID;
+    unsigned int indexCount;
+    const std::vector<Meshlet>* meshlets;
+    float boundingRadius;
+    int gpuMesh; // From addGPUMesh(), or -1
+};
+
+struct SceneResources {
+    std::unordered_map<std::string, SceneMesh> meshes;
+    // Called for every texture a node asks for, loadTextureAsync() in the game. The handles go in the node's
+    // textureHandles, by slot.
+    TextureHandle (*loadTexture)(std::string fileName, TextureUsage usage) = nullptr;
+};
+
+// Creates the nodes of the scene below parent and returns them in the same order as scene.nodes
+std::vector<SceneNode*> instantiateScene(const SceneFile &scene, SceneNode* parent, const SceneResources &resources);
@@ -34,8 +34,9 @@ namespace Gloom
         GLuint get()        { return mProgram; }
         void   destroy()    { glDeleteProgram(mProgram); }
 
-        /* Attach a shader to the current shader program */
-        void attach(std::string const &filename)
+        /* Attach a shader to the current shader program. Any defines
+           are inserted right after the #version line */
+        void attach(std::string const &filename, std::string const &defines = "")
         {
             // Load GLSL Shader from source
             std::ifstream fd(filename.c_str());
@@ -49,6 +50,12 @@ namespace Gloom
             }
             auto src = std::string(std::istreambuf_iterator<char>(fd),
                                   (std::istreambuf_iterator<char>()));
+            if (!defines.empty())
+            {
+                auto version = src.find("#version");
+                auto lineEnd = version == std::string::npos ? 0 : src.find('\n', version) + 1;
+                src.insert(lineEnd, defines);
+            }
 
             // Create shader object
             const char * source = src.c_str();
@@ -97,10 +104,11 @@ namespace Gloom
         /* Convenience function that attaches and links a vertex and a
            fragment shader in a shader program */
         void makeBasicShader(std::string const &vertexFilename,
-                             std::string const &fragmentFilename)
+                             std::string const &fragmentFilename,
+                             std::string const &defines = "")
         {
-            attach(vertexFilename);
-            attach(fragmentFilename);
+            attach(vertexFilename, defines);
+            attach(fragmentFilename, defines);
             link();
         }
 
@@ -0,0 +1,300 @@
+#include "textureAtlas.h"
+#include "imageLoader.hpp"
+#include "imageOps.h"
+#include <stb_image.h>
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+struct AtlasImage {
+    std::string fileName;
+    unsigned int width = 0;
+    unsigned int height = 0;
+    std::vector<unsigned char> pixels; // RGBA, bottom row first like every other texture
+    bool isSolid = false;
+
+    // Where the image and its gutter went
+    int page = -1;
+    unsigned int x = 0;
+    unsigned int y = 0;
+    AtlasRegion region = {-1, glm::vec4(1, 1, 0, 0)};
+};
+
+// The skyline is the top edge of everything packed so far, as segments from left to right.
+// New rectangles go on top of it, as low as possible.
+struct SkylineSegment {
+    unsigned int x;
+    unsigned int y;
+    unsigned int width;
+};
+
+struct AtlasPage {
+    std::vector<SkylineSegment> skyline;
+    std::vector<unsigned char> pixels;
+    unsigned int usedWidth = 0;
+    unsigned int usedHeight = 0;
+    GLuint textureID = 0;
+};
+
+static std::vector<AtlasImage> images;
+static std::vector<AtlasPage> pages;
+static size_t firstUnbuiltImage = 0; // Images from here on were added after the last buildAtlases()
+
+
+int addAtlasImage(const std::string &fileName) {
+    AtlasImage image;
+    image.fileName = fileName;
+    images.push_back(image);
+    return images.size() - 1;
+}
+
+AtlasRegion atlasRegion(int image) {
+    return images.at(image).region;
+}
+
+static bool decodeAtlasImage(AtlasImage &image) {
+    std::string extension = image.fileName.substr(image.fileName.rfind('.') + 1);
+    if (extension == "png") {
+        PNGImage png = loadPNGFile(image.fileName);
+        image.width = png.width;
+        image.height = png.height;
+        image.pixels = std::move(png.pixels);
+    } else {
+        int width, height, channels;
+        unsigned char* data = stbi_load(image.fileName.c_str(), &width, &height, &channels, 0);
+        if (!data) {
+            std::cout << "Atlas image failed to load at path: " << image.fileName << std::endl;
+            return false;
+        }
+        image.width = width;
+        image.height = height;
+        image.pixels.resize(4 * (size_t)width * height);
+        expandToRGBA(data, channels, (size_t)width * height, image.pixels.data());
+        stbi_image_free(data);
+        flipRows(image.pixels.data(), 4 * width, height);
+    }
+    if (image.pixels.empty()) {
+        return false;
+    }
+
+    uint32_t first;
+    std::memcpy(&first, image.pixels.data(), 4);
+    image.isSolid = true;
+    for (size_t i = 4; i < image.pixels.size() && image.isSolid; i += 4) {
+        uint32_t pixel;
+        std::memcpy(&pixel, &image.pixels[i], 4);
+        image.isSolid = pixel == first;
+    }
+    if (image.isSolid) {
+        image.width = image.height = 1;
+        image.pixels.resize(4);
+    }
+    return true;
+}
+
+// Finds the lowest spot for a rectangle with its left edge at the start of segment i. False if it sticks out of the page.
+static bool skylineFit(const AtlasPage &page, size_t i, unsigned int width, unsigned int height, unsigned int pageSize, unsigned int &y) {
+    if (page.skyline[i].x + width > pageSize) {
+        return false;
+    }
+    y = 0;
+    unsigned int covered = 0;
+    for (size_t j = i; covered < width; j++) {
+        y = std::max(y, page.skyline[j].y);
+        if (y + height > pageSize) {
+            return false;
+        }
+        covered += page.skyline[j].width;
+    }
+    return true;
+}
+
+// Bottom left placement: the spot where the top of the rectangle ends up lowest, leftmost if there is a tie
+static bool skylinePlace(AtlasPage &page, unsigned int width, unsigned int height, unsigned int pageSize, unsigned int &x, unsigned int &y) {
+    size_t best = page.skyline.size();
+    unsigned int bestTop = ~0u;
+    for (size_t i = 0; i < page.skyline.size(); i++) {
+        unsigned int fitY;
+        if (skylineFit(page, i, width, height, pageSize, fitY) && fitY + height < bestTop) {
+            best = i;
+            bestTop = fitY + height;
+        }
+    }
+    if (best == page.skyline.size()) {
+        return false;
+    }
+    x = page.skyline[best].x;
+    y = bestTop - height;
+
+    // The new segment covers the start of the ones it sits on, those are cut back or removed
+    page.skyline.insert(page.skyline.begin() + best, SkylineSegment{x, bestTop, width});
+    for (size_t j = best + 1; j < page.skyline.size();) {
+        SkylineSegment &segment = page.skyline[j];
+        if (segment.x >= x + width) {
+            break;
+        }
+        unsigned int overlap = x + width - segment.x;
+        if (segment.width <= overlap) {
+            page.skyline.erase(page.skyline.begin() + j);
+            continue;
+        }
+        segment.x += overlap;
+        segment.width -= overlap;
+        break;
+    }
+    for (size_t j = 0; j + 1 < page.skyline.size();) {
+        if (page.skyline[j].y == page.skyline[j + 1].y) {
+            page.skyline[j].width += page.skyline[j + 1].width;
+            page.skyline.erase(page.skyline.begin() + j + 1);
+        } else {
+            j++;
+        }
+    }
+
+    page.usedWidth = std::max(page.usedWidth, x + width);
+    page.usedHeight = std::max(page.usedHeight, bestTop);
+    return true;
+}
+
+static unsigned int paddedSize(unsigned int size, unsigned int padding) {
+    return (size + 2 * padding + padding - 1) / padding * padding;
+}
+
+// Copies the image into the page, with the gutter around it repeating the nearest edge pixel
+static void blitWithGutter(const AtlasImage &image, AtlasPage &page, unsigned int pageSize, unsigned int padding) {
+    unsigned int width = paddedSize(image.width, padding);
+    unsigned int height = paddedSize(image.height, padding);
+    for (unsigned int row = 0; row < height; row++) {
+        unsigned int sourceRow = std::min((unsigned int)std::max(0, (int)row - (int)padding), image.height - 1);
+        const unsigned char* source = &image.pixels[4 * (size_t)sourceRow * image.width];
+        unsigned char* target = &page.pixels[4 * ((size_t)(image.y + row) * pageSize + image.x)];
+        for (unsigned int column = 0; column < width; column++) {
+            unsigned int sourceColumn = std::min((unsigned int)std::max(0, (int)column - (int)padding), image.width - 1);
+            std::memcpy(target + 4 * column, source + 4 * sourceColumn, 4);
+        }
+    }
+}
+
+// Only the used part of the page is uploaded, with as many mip levels as the padding keeps clean
+static void uploadPage(AtlasPage &page, unsigned int pageSize, unsigned int padding) {
+    unsigned int width = page.usedWidth, height = page.usedHeight;
+    std::vector<unsigned char> level(4 * (size_t)width * height);
+    for (unsigned int row = 0; row < height; row++) {
+        std::memcpy(&level[4 * (size_t)row * width], &page.pixels[4 * (size_t)row * pageSize], 4 * width);
+    }
+    std::vector<unsigned char>().swap(page.pixels);
+
+    GLsizei levels = 1;
+    while ((1u << (levels - 1)) < padding) {
+        levels++;
+    }
+    glCreateTextures(GL_TEXTURE_2D, 1, &page.textureID);
+    glTextureStorage2D(page.textureID, levels, GL_RGBA8, width, height);
+    glTextureParameteri(page.textureID, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTextureParameteri(page.textureID, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTextureParameteri(page.textureID, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTextureParameteri(page.textureID, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+    // The page size is a multiple of the padding, so every level halves exactly
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    for (GLsizei i = 0; i < levels; i++) {
+        glTextureSubImage2D(page.textureID, i, 0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, level.data());
+        if (i + 1 < levels) {
+            std::vector<unsigned char> next(4 * (size_t)(width / 2) * (height / 2));
+            downsample2x2(level.data(), width, height, next.data());
+            level.swap(next);
+            width /= 2;
+            height /= 2;
+        }
+    }
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+}
+
+void buildAtlases(unsigned int pageSize, unsigned int maxImageSize, unsigned int padding) {
+    std::vector<AtlasImage*> queued;
+    for (size_t i = firstUnbuiltImage; i < images.size(); i++) {
+        queued.push_back(&images[i]);
+    }
+    firstUnbuiltImage = images.size();
+
+    // Decoding is the slow part, so spread it over one thread per core, each taking the next image
+    std::vector<char> loaded(queued.size(), false);
+    std::atomic<size_t> nextImage(0);
+    unsigned int workerCount = std::min<size_t>(std::max(1u, std::thread::hardware_concurrency()), queued.size());
+    std::vector<std::thread> workers;
+    for (unsigned int i = 0; i < workerCount; i++) {
+        workers.emplace_back([&] {
+            for (size_t image = nextImage++; image < queued.size(); image = nextImage++) {
+                loaded[image] = decodeAtlasImage(*queued[image]);
+            }
+        });
+    }
+    for (std::thread &worker : workers) {
+        worker.join();
+    }
+
+    std::vector<AtlasImage*> packing;
+    for (unsigned int i = 0; i < queued.size(); i++) {
+        AtlasImage* image = queued[i];
+        if (loaded[i] && paddedSize(image->width, padding) <= pageSize && paddedSize(image->height, padding) <= pageSize
+            && (image->isSolid || std::max(image->width, image->height) <= maxImageSize)) {
+            packing.push_back(image);
+        } else {
+            std::vector<unsigned char>().swap(image->pixels);
+        }
+    }
+
+    // Tallest first packs tighter
+    std::stable_sort(packing.begin(), packing.end(), [](const AtlasImage* a, const AtlasImage* b) { return a->height > b->height; });
+
+    size_t firstNewPage = pages.size();
+    for (AtlasImage* image : packing) {
+        unsigned int width = paddedSize(image->width, padding);
+        unsigned int height = paddedSize(image->height, padding);
+        for (size_t i = firstNewPage; i <= pages.size() && image->page < 0; i++) {
+            if (i == pages.size()) {
+                AtlasPage page;
+                page.skyline.push_back(SkylineSegment{0, 0, pageSize});
+                page.pixels.resize(4 * (size_t)pageSize * pageSize);
+                pages.push_back(page);
+            }
+            if (skylinePlace(pages[i], width, height, pageSize, image->x, image->y)) {
+                image->page = i;
+                blitWithGutter(*image, pages[i], pageSize, padding);
+            }
+        }
+    }
+
+    for (size_t i = firstNewPage; i < pages.size(); i++) {
+        uploadPage(pages[i], pageSize, padding);
+    }
+
+    for (AtlasImage* image : packing) {
+        const AtlasPage &page = pages[image->page];
+        float pageWidth = page.usedWidth, pageHeight = page.usedHeight;
+        float left = (image->x + padding) / pageWidth, bottom = (image->y + padding) / pageHeight;
+        if (image->isSolid) {
+            // Every UV lands in the middle of the one pixel
+            image->region = {(int)page.textureID, glm::vec4(0, 0, left + 0.5f / pageWidth, bottom + 0.5f / pageHeight)};
+        } else {
+            image->region = {(int)page.textureID, glm::vec4(image->width / pageWidth, image->height / pageHeight, left, bottom)};
+        }
+        std::vector<unsigned char>().swap(image->pixels);
+    }
+
+    std::cout << "Packed " << packing.size() << " of " << queued.size() << " images into "
+              << pages.size() - firstNewPage << " atlas pages" << std::endl;
+}
+
+void shutdownAtlases() {
+    for (AtlasPage &page : pages) {
+        glDeleteTextures(1, &page.textureID);
+    }
+    pages.clear();
+    images.clear();
+    firstUnbuiltImage = 0;
+}
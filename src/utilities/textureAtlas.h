@@ -0,0 +1,29 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <string>
+
+// Small images, and images of a single colour, packed together into shared atlas pages. Nodes using the same
+// page draw with the same texture, and pick out their own image with a UV transform.
+
+// Where an image ended up. uvTransform maps the image's own UVs into the page: uv * xy + zw.
+// textureID is -1 if the image was not packed, it should be loaded on its own instead.
+struct AtlasRegion {
+    int textureID;
+    glm::vec4 uvTransform;
+};
+
+// Queues an image for the next buildAtlases(). Returns the index to look it up with in atlasRegion().
+int addAtlasImage(const std::string &fileName);
+
+// Decodes the queued images, packs them into pages and uploads those. An image of a single colour shrinks to one
+// pixel, and its UV transform points every UV at that pixel. Other images bigger than maxImageSize are left out, and
+// since they share a page their UVs have to stay within 0-1.
+// Every image gets a gutter of padding repeated edge pixels and starts at a multiple of padding, so the
+// mip levels down to 1/padding of the page never mix neighbouring images. padding must be a power of two.
+void buildAtlases(unsigned int pageSize = 1024, unsigned int maxImageSize = 256, unsigned int padding = 4);
+
+AtlasRegion atlasRegion(int image);
+
+void shutdownAtlases();
@@ -0,0 +1,469 @@
+#include "textureCompression.h"
+#include "imageOps.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+// S3TC is an extension rather than core GL, so the loader headers may not define these
+#ifndef GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_RGB_S3TC_DXT1_EXT 0x83F0
+#endif
+#ifndef GL_COMPRESSED_RGBA_S3TC_DXT5_EXT
+#define GL_COMPRESSED_RGBA_S3TC_DXT5_EXT 0x83F3
+#endif
+
+typedef unsigned char Pixel[4];
+
+unsigned int blockSizeInBytes(BlockFormat format) {
+    return format == BLOCK_BC1 ? 8 : 16;
+}
+
+size_t levelSizeInBytes(BlockFormat format, unsigned int width, unsigned int height, unsigned int level) {
+    unsigned int levelWidth = std::max(1u, width >> level);
+    unsigned int levelHeight = std::max(1u, height >> level);
+    return size_t((levelWidth + 3) / 4) * ((levelHeight + 3) / 4) * blockSizeInBytes(format);
+}
+
+GLenum glInternalFormat(BlockFormat format) {
+    switch (format) {
+        case BLOCK_BC1: return GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+        case BLOCK_BC3: return GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+        case BLOCK_BC5: return GL_COMPRESSED_RG_RGTC2;
+        case BLOCK_BC7: return GL_COMPRESSED_RGBA_BPTC_UNORM;
+    }
+    return GL_NONE;
+}
+
+
+// ---- Endpoint selection ----
+
+// Finds the two pixels at the ends of the principal axis of the block (power iteration on the covariance).
+// `channels` is 3 to ignore alpha, 4 to include it.
+static void principalEndpoints(const Pixel block[16], int channels, float low[4], float high[4]) {
+    float mean[4] = {0, 0, 0, 0};
+    for (int i = 0; i < 16; i++)
+        for (int c = 0; c < channels; c++)
+            mean[c] += block[i][c] / 16.0f;
+
+    float covariance[4][4] = {};
+    for (int i = 0; i < 16; i++)
+        for (int a = 0; a < channels; a++)
+            for (int b = 0; b < channels; b++)
+                covariance[a][b] += (block[i][a] - mean[a]) * (block[i][b] - mean[b]);
+
+    float axis[4] = {1, 1, 1, 1};
+    for (int iteration = 0; iteration < 8; iteration++) {
+        float next[4] = {0, 0, 0, 0};
+        for (int a = 0; a < channels; a++)
+            for (int b = 0; b < channels; b++)
+                next[a] += covariance[a][b] * axis[b];
+        float length = 0;
+        for (int c = 0; c < channels; c++) length = std::max(length, std::fabs(next[c]));
+        if (length == 0) break;
+        for (int c = 0; c < channels; c++) axis[c] = next[c] / length;
+    }
+
+    float minProjection = INFINITY, maxProjection = -INFINITY;
+    int minIndex = 0, maxIndex = 0;
+    for (int i = 0; i < 16; i++) {
+        float projection = 0;
+        for (int c = 0; c < channels; c++) projection += (block[i][c] - mean[c]) * axis[c];
+        if (projection < minProjection) { minProjection = projection; minIndex = i; }
+        if (projection > maxProjection) { maxProjection = projection; maxIndex = i; }
+    }
+    for (int c = 0; c < 4; c++) {
+        low[c] = block[minIndex][c];
+        high[c] = block[maxIndex][c];
+    }
+}
+
+static int squaredDistance(const int a[4], const Pixel b, int channels) {
+    int sum = 0;
+    for (int c = 0; c < channels; c++) sum += (a[c] - b[c]) * (a[c] - b[c]);
+    return sum;
+}
+
+
+// ---- BC1 / BC3 / BC4 / BC5 ----
+
+static uint16_t packRGB565(const float color[4]) {
+    int r = std::min(31, int(color[0] * 31.0f / 255.0f + 0.5f));
+    int g = std::min(63, int(color[1] * 63.0f / 255.0f + 0.5f));
+    int b = std::min(31, int(color[2] * 31.0f / 255.0f + 0.5f));
+    return uint16_t((r << 11) | (g << 5) | b);
+}
+
+static void unpackRGB565(uint16_t packed, int color[4]) {
+    int r = (packed >> 11) & 31, g = (packed >> 5) & 63, b = packed & 31;
+    color[0] = (r << 3) | (r >> 2);
+    color[1] = (g << 2) | (g >> 4);
+    color[2] = (b << 3) | (b >> 2);
+    color[3] = 255;
+}
+
+static void encodeBC1Block(const Pixel block[16], unsigned char* out) {
+    float low[4], high[4];
+    principalEndpoints(block, 3, low, high);
+
+    uint16_t color0 = packRGB565(high);
+    uint16_t color1 = packRGB565(low);
+    // color0 > color1 selects the four colour mode, equal endpoints only need index 0
+    if (color0 < color1) std::swap(color0, color1);
+
+    uint32_t indices = 0;
+    if (color0 != color1) {
+        int palette[4][4];
+        unpackRGB565(color0, palette[0]);
+        unpackRGB565(color1, palette[1]);
+        for (int c = 0; c < 3; c++) {
+            palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+            palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+        }
+        for (int i = 0; i < 16; i++) {
+            int best = 0, bestDistance = squaredDistance(palette[0], block[i], 3);
+            for (int p = 1; p < 4; p++) {
+                int distance = squaredDistance(palette[p], block[i], 3);
+                if (distance < bestDistance) { best = p; bestDistance = distance; }
+            }
+            indices |= uint32_t(best) << (2 * i);
+        }
+    }
+
+    out[0] = color0 & 0xFF; out[1] = color0 >> 8;
+    out[2] = color1 & 0xFF; out[3] = color1 >> 8;
+    for (int i = 0; i < 4; i++) out[4 + i] = (indices >> (8 * i)) & 0xFF;
+}
+
+// Single channel block, used for BC3 alpha and both BC5 channels
+static void encodeBC4Block(const Pixel block[16], int channel, unsigned char* out) {
+    int high = 0, low = 255;
+    for (int i = 0; i < 16; i++) {
+        high = std::max(high, int(block[i][channel]));
+        low = std::min(low, int(block[i][channel]));
+    }
+
+    uint64_t indices = 0;
+    if (high != low) {
+        // high > low selects the mode with 6 interpolated values
+        int palette[8] = {high, low};
+        for (int p = 2; p < 8; p++) palette[p] = ((8 - p) * high + (p - 1) * low) / 7;
+        for (int i = 0; i < 16; i++) {
+            int best = 0, bestDistance = 256;
+            for (int p = 0; p < 8; p++) {
+                int distance = std::abs(palette[p] - block[i][channel]);
+                if (distance < bestDistance) { best = p; bestDistance = distance; }
+            }
+            indices |= uint64_t(best) << (3 * i);
+        }
+    }
+
+    out[0] = high;
+    out[1] = low;
+    for (int i = 0; i < 6; i++) out[2 + i] = (indices >> (8 * i)) & 0xFF;
+}
+
+
+// ---- BC7 (mode 6 only: one subset, RGBA endpoints with p-bits and 4 bit indices) ----
+
+struct BitWriter {
+    unsigned char* bytes;
+    int position = 0;
+
+    void write(uint32_t value, int bits) {
+        for (int i = 0; i < bits; i++, position++) {
+            bytes[position >> 3] |= ((value >> i) & 1) << (position & 7);
+        }
+    }
+};
+
+// Picks the 7 bit endpoint and shared p-bit that reconstruct the colour best
+static void quantizeBC7Endpoint(const float color[4], int quantized[4], int &pBit) {
+    int bestError = INT32_MAX;
+    for (int p = 0; p < 2; p++) {
+        int candidate[4], error = 0;
+        for (int c = 0; c < 4; c++) {
+            candidate[c] = std::max(0, std::min(127, int((color[c] - p) / 2.0f + 0.5f)));
+            int reconstructed = (candidate[c] << 1) | p;
+            error += (reconstructed - int(color[c])) * (reconstructed - int(color[c]));
+        }
+        if (error < bestError) {
+            bestError = error;
+            pBit = p;
+            std::copy(candidate, candidate + 4, quantized);
+        }
+    }
+}
+
+static void encodeBC7Block(const Pixel block[16], unsigned char* out) {
+    static const int weights[16] = {0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64};
+
+    float low[4], high[4];
+    principalEndpoints(block, 4, low, high);
+
+    int endpoints[2][4], pBits[2];
+    quantizeBC7Endpoint(low, endpoints[0], pBits[0]);
+    quantizeBC7Endpoint(high, endpoints[1], pBits[1]);
+
+    int palette[16][4];
+    for (int p = 0; p < 16; p++) {
+        for (int c = 0; c < 4; c++) {
+            int e0 = (endpoints[0][c] << 1) | pBits[0];
+            int e1 = (endpoints[1][c] << 1) | pBits[1];
+            palette[p][c] = ((64 - weights[p]) * e0 + weights[p] * e1 + 32) >> 6;
+        }
+    }
+
+    int indices[16];
+    for (int i = 0; i < 16; i++) {
+        int best = 0, bestDistance = squaredDistance(palette[0], block[i], 4);
+        for (int p = 1; p < 16; p++) {
+            int distance = squaredDistance(palette[p], block[i], 4);
+            if (distance < bestDistance) { best = p; bestDistance = distance; }
+        }
+        indices[i] = best;
+    }
+
+    // The first index is stored with one bit less, so its top bit has to be zero
+    if (indices[0] & 8) {
+        std::swap(endpoints[0], endpoints[1]);
+        std::swap(pBits[0], pBits[1]);
+        for (int &index : indices) index = 15 - index;
+    }
+
+    std::memset(out, 0, 16);
+    BitWriter writer{out};
+    writer.write(1 << 6, 7); // Mode 6
+    for (int c = 0; c < 4; c++) {
+        writer.write(endpoints[0][c], 7);
+        writer.write(endpoints[1][c], 7);
+    }
+    writer.write(pBits[0], 1);
+    writer.write(pBits[1], 1);
+    writer.write(indices[0], 3);
+    for (int i = 1; i < 16; i++) writer.write(indices[i], 4);
+}
+
+
+// ---- Mip chain ----
+
+static std::vector<unsigned char> downsample(const std::vector<unsigned char> &source, unsigned int width, unsigned int height, bool isNormalMap) {
+    unsigned int targetWidth = std::max(1u, width / 2);
+    unsigned int targetHeight = std::max(1u, height / 2);
+    std::vector<unsigned char> target(4 * targetWidth * targetHeight);
+    downsample2x2(source.data(), width, height, target.data());
+
+    if (isNormalMap) {
+        for (size_t i = 0; i < target.size(); i += 4) {
+            unsigned char* pixel = &target[i];
+            float n[3], length = 0;
+            for (int c = 0; c < 3; c++) {
+                n[c] = pixel[c] / 127.5f - 1.0f;
+                length += n[c] * n[c];
+            }
+            length = std::sqrt(length);
+            if (length > 0) {
+                for (int c = 0; c < 3; c++) pixel[c] = (unsigned char)std::lround((n[c] / length + 1.0f) * 127.5f);
+            }
+        }
+    }
+    return target;
+}
+
+static std::vector<unsigned char> compressLevel(const std::vector<unsigned char> &rgba, unsigned int width, unsigned int height, BlockFormat format) {
+    unsigned int blocksX = (width + 3) / 4, blocksY = (height + 3) / 4;
+    unsigned int blockSize = blockSizeInBytes(format);
+    std::vector<unsigned char> blocks(blocksX * blocksY * blockSize);
+
+    for (unsigned int by = 0; by < blocksY; by++) {
+        for (unsigned int bx = 0; bx < blocksX; bx++) {
+            // Blocks hanging over the edge repeat the last row and column
+            Pixel block[16];
+            for (int i = 0; i < 16; i++) {
+                unsigned int x = std::min(4 * bx + i % 4, width - 1);
+                unsigned int y = std::min(4 * by + i / 4, height - 1);
+                std::memcpy(block[i], &rgba[4 * (y * width + x)], 4);
+            }
+
+            unsigned char* out = &blocks[(by * blocksX + bx) * blockSize];
+            switch (format) {
+                case BLOCK_BC1: encodeBC1Block(block, out); break;
+                case BLOCK_BC3: encodeBC4Block(block, 3, out); encodeBC1Block(block, out + 8); break;
+                case BLOCK_BC5: encodeBC4Block(block, 0, out); encodeBC4Block(block, 1, out + 8); break;
+                case BLOCK_BC7: encodeBC7Block(block, out); break;
+            }
+        }
+    }
+    return blocks;
+}
+
+CompressedTexture compressTexture(const unsigned char* rgba, unsigned int width, unsigned int height, BlockFormat format, bool isNormalMap) {
+    CompressedTexture texture;
+    texture.format = format;
+    texture.width = width;
+    texture.height = height;
+
+    std::vector<unsigned char> level(rgba, rgba + 4 * width * height);
+    while (true) {
+        texture.levels.push_back(compressLevel(level, width, height, format));
+        if (width == 1 && height == 1) {
+            break;
+        }
+        level = downsample(level, width, height, isNormalMap);
+        width = std::max(1u, width / 2);
+        height = std::max(1u, height / 2);
+    }
+    return texture;
+}
+
+
+// ---- KTX 2.0 container ----
+
+static const unsigned char ktx2Identifier[12] = {0xAB, 0x4B, 0x54, 0x58, 0x20, 0x32, 0x30, 0xBB, 0x0D, 0x0A, 0x1A, 0x0A};
+
+struct KTX2Header {
+    unsigned char identifier[12];
+    uint32_t vkFormat;
+    uint32_t typeSize;
+    uint32_t pixelWidth;
+    uint32_t pixelHeight;
+    uint32_t pixelDepth;
+    uint32_t layerCount;
+    uint32_t faceCount;
+    uint32_t levelCount;
+    uint32_t supercompressionScheme;
+    uint32_t dfdByteOffset;
+    uint32_t dfdByteLength;
+    uint32_t kvdByteOffset;
+    uint32_t kvdByteLength;
+    uint64_t sgdByteOffset;
+    uint64_t sgdByteLength;
+};
+
+struct KTX2LevelIndex {
+    uint64_t byteOffset;
+    uint64_t byteLength;
+    uint64_t uncompressedByteLength;
+};
+
+static uint32_t vkFormat(BlockFormat format) {
+    switch (format) {
+        case BLOCK_BC1: return 131; // VK_FORMAT_BC1_RGB_UNORM_BLOCK
+        case BLOCK_BC3: return 137; // VK_FORMAT_BC3_UNORM_BLOCK
+        case BLOCK_BC5: return 141; // VK_FORMAT_BC5_UNORM_BLOCK
+        case BLOCK_BC7: return 145; // VK_FORMAT_BC7_UNORM_BLOCK
+    }
+    return 0;
+}
+
+// Basic data format descriptor, telling readers which channels the blocks hold
+static std::vector<uint32_t> dataFormatDescriptor(BlockFormat format) {
+    struct Sample { uint32_t bitOffset, bitLength, channel; };
+    std::vector<Sample> samples;
+    uint32_t colorModel = 0;
+    switch (format) {
+        case BLOCK_BC1: colorModel = 128; samples = {{0, 64, 0}}; break;
+        case BLOCK_BC3: colorModel = 130; samples = {{0, 64, 15}, {64, 64, 0}}; break;
+        case BLOCK_BC5: colorModel = 132; samples = {{0, 64, 0}, {64, 64, 1}}; break;
+        case BLOCK_BC7: colorModel = 134; samples = {{0, 128, 0}}; break;
+    }
+
+    uint32_t blockSize = 24 + 16 * samples.size();
+    std::vector<uint32_t> words = {
+        4 + blockSize,                      // Total size
+        0,                                  // Khronos vendor, basic descriptor type
+        2u | (blockSize << 16),             // Version 2
+        colorModel | (1 << 8) | (1 << 16),  // BT.709 primaries, linear transfer
+        3u | (3u << 8),                     // 4x4x1x1 texel blocks
+        blockSizeInBytes(format),           // Bytes in plane 0
+        0
+    };
+    for (const Sample &sample : samples) {
+        words.push_back(sample.bitOffset | ((sample.bitLength - 1) << 16) | (sample.channel << 24));
+        words.push_back(0);
+        words.push_back(0);
+        words.push_back(0xFFFFFFFF);
+    }
+    return words;
+}
+
+bool writeKTX2(const std::string &fileName, const CompressedTexture &texture) {
+    std::vector<uint32_t> dfd = dataFormatDescriptor(texture.format);
+    uint32_t levelCount = texture.levels.size();
+
+    KTX2Header header = {};
+    std::memcpy(header.identifier, ktx2Identifier, sizeof(ktx2Identifier));
+    header.vkFormat = vkFormat(texture.format);
+    header.typeSize = 1;
+    header.pixelWidth = texture.width;
+    header.pixelHeight = texture.height;
+    header.faceCount = texture.faceCount;
+    header.levelCount = levelCount;
+    header.dfdByteOffset = sizeof(KTX2Header) + levelCount * sizeof(KTX2LevelIndex);
+    header.dfdByteLength = dfd.size() * sizeof(uint32_t);
+
+    // Level data is stored smallest mip first, each level aligned to the block size
+    std::vector<KTX2LevelIndex> levelIndex(levelCount);
+    uint64_t offset = header.dfdByteOffset + header.dfdByteLength;
+    for (int level = levelCount - 1; level >= 0; level--) {
+        offset = (offset + 15) & ~uint64_t(15);
+        levelIndex[level] = {offset, texture.levels[level].size(), texture.levels[level].size()};
+        offset += texture.levels[level].size();
+    }
+
+    std::ofstream file(fileName, std::ios::binary);
+    if (!file) {
+        return false;
+    }
+    file.write((const char*)&header, sizeof(header));
+    file.write((const char*)levelIndex.data(), levelIndex.size() * sizeof(KTX2LevelIndex));
+    file.write((const char*)dfd.data(), dfd.size() * sizeof(uint32_t));
+    for (int level = levelCount - 1; level >= 0; level--) {
+        static const char padding[16] = {};
+        file.write(padding, levelIndex[level].byteOffset - file.tellp());
+        file.write((const char*)texture.levels[level].data(), texture.levels[level].size());
+    }
+    return bool(file);
+}
+
+bool readKTX2(const std::string &fileName, CompressedTexture &texture, unsigned int firstLevel, unsigned int levelCount) {
+    std::ifstream file(fileName, std::ios::binary);
+    if (!file) {
+        return false;
+    }
+
+    KTX2Header header;
+    if (!file.read((char*)&header, sizeof(header)) || std::memcmp(header.identifier, ktx2Identifier, sizeof(ktx2Identifier)) != 0) {
+        std::cout << "Not a KTX2 file: " << fileName << std::endl;
+        return false;
+    }
+
+    bool knownFormat = false;
+    for (BlockFormat format : {BLOCK_BC1, BLOCK_BC3, BLOCK_BC5, BLOCK_BC7}) {
+        if (vkFormat(format) == header.vkFormat) {
+            texture.format = format;
+            knownFormat = true;
+        }
+    }
+    if (!knownFormat || header.supercompressionScheme != 0 || header.levelCount == 0) {
+        std::cout << "Unsupported KTX2 file: " << fileName << std::endl;
+        return false;
+    }
+
+    std::vector<KTX2LevelIndex> levelIndex(header.levelCount);
+    file.read((char*)levelIndex.data(), levelIndex.size() * sizeof(KTX2LevelIndex));
+
+    texture.width = header.pixelWidth;
+    texture.height = header.pixelHeight;
+    texture.faceCount = header.faceCount;
+    texture.levels.assign(header.levelCount, {});
+    uint32_t endLevel = std::min<uint64_t>(header.levelCount, (uint64_t)firstLevel + levelCount);
+    for (uint32_t level = firstLevel; level < endLevel; level++) {
+        texture.levels[level].resize(levelIndex[level].byteLength);
+        file.seekg(levelIndex[level].byteOffset);
+        file.read((char*)texture.levels[level].data(), levelIndex[level].byteLength);
+    }
+    return bool(file);
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <string>
+#include <vector>
+
+// GPU block compression formats, all using 4x4 pixel blocks
+enum BlockFormat {
+    BLOCK_BC1, // RGB, 8 bytes per block
+    BLOCK_BC3, // RGBA, 16 bytes per block
+    BLOCK_BC5, // Two channels (normal map x and y), 16 bytes per block
+    BLOCK_BC7  // RGBA at high quality, 16 bytes per block
+};
+
+struct CompressedTexture {
+    BlockFormat format;
+    unsigned int width;
+    unsigned int height;
+    std::vector<std::vector<unsigned char>> levels; // Mip level 0 first, empty for levels that were not loaded
+    unsigned int faceCount = 1;                     // 6 for cube maps, each level then holds the faces one after another
+};
+
+// Builds the full mip chain of an RGBA image on the CPU and block compresses every level.
+// Normal maps are renormalised after every downsample, so they stay unit length.
+CompressedTexture compressTexture(const unsigned char* rgba, unsigned int width, unsigned int height,
+                                  BlockFormat format, bool isNormalMap = false);
+
+unsigned int blockSizeInBytes(BlockFormat format);
+size_t levelSizeInBytes(BlockFormat format, unsigned int width, unsigned int height, unsigned int level);
+GLenum glInternalFormat(BlockFormat format);
+
+// Cache files in the KTX 2.0 container, so they can also be inspected with the usual tools
+bool writeKTX2(const std::string &fileName, const CompressedTexture &texture);
+// Reading can be limited to some of the levels, the others are left empty
+bool readKTX2(const std::string &fileName, CompressedTexture &texture, unsigned int firstLevel = 0, unsigned int levelCount = ~0u);
@@ -0,0 +1,935 @@
+#include "textureLoader.h"
+#include "imageLoader.hpp"
+#include "imageOps.h"
+#include "lockFreeQueue.hpp"
+#include "textureCompression.h"
+#include <stb_image.h>
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cctype>
+#include <cstdint>
+#include <cstring>
+#include <climits>
+#include <cmath>
+#include <cstdlib>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <list>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include <sys/stat.h>
+
+// A texture on its way from disk to the GPU
+struct TextureJob {
+    std::string fileName;
+    int entry;
+    TextureUsage usage;
+
+    // Hash of the file contents. If another entry already claimed the same contents, nothing is decoded
+    // and the GL thread folds this entry into that one instead.
+    uint64_t contentHash = 0;
+    int duplicateOf = -1;
+
+    unsigned int width = 0;
+    unsigned int height = 0;
+    std::vector<unsigned char> pixels; // RGBA, bottom row first
+
+    // Used instead of the pixels when the texture is block compressed
+    bool isCompressed = false;
+    CompressedTexture blocks;
+
+    // Streamed textures start out with only the levels from firstLevel on. Finer levels are read
+    // from the .ktx2 cache later by stream-in jobs, which carry levelCount levels from firstLevel.
+    std::string cacheFileName;
+    unsigned int firstLevel = 0;
+    bool isStreamIn = false;
+    unsigned int levelCount = 0;
+
+    size_t sizeInBytes() const {
+        if (!isCompressed) {
+            return pixels.size();
+        }
+        size_t size = 0;
+        for (const std::vector<unsigned char> &level : blocks.levels) {
+            size += level.size();
+        }
+        return size;
+    }
+};
+
+// Jobs waiting for a decoder thread. The workers sleep on this, so a plain lock is fine here.
+static std::deque<TextureJob*> decodeQueue;
+static std::mutex decodeQueueMutex;
+static std::condition_variable decodeQueueCondition;
+static std::vector<std::thread> decodeWorkers;
+static bool decodeWorkersQuit = false;
+
+// Decoded images waiting for the GL thread, which must never block on the workers
+static Gloom::LockFreeQueue<TextureJob*> uploadQueue(256);
+static std::atomic<unsigned int> pendingJobs(0);
+
+// Every texture that has been asked for, keyed both by canonical path and by contents, so each image is on the GPU only once.
+// Everything here belongs to the GL thread, except claimedContent which the workers fill in.
+struct TextureEntry {
+    std::vector<std::string> keys;       // Path keys mapping to this entry, more than one if files had the same contents
+    uint64_t contentHash = 0;
+    TextureUsage usage;
+
+    GLuint id = 0;
+    size_t sizeInBytes = 0;
+    bool resident = false;
+
+    std::vector<TextureHandle> references;
+    bool inLRU = false;
+    std::list<int>::iterator lruPosition;
+
+    // Mip residency, only for streamed textures. The GL texture holds the levels from residentBase down.
+    bool streamed = false;
+    std::string cacheFileName;
+    BlockFormat format;
+    unsigned int width = 0;
+    unsigned int height = 0;
+    unsigned int levelCount = 0;
+    unsigned int residentBase = 0;
+    unsigned int tailLevel = 0;      // Never dropped below this, it is what we start with
+    unsigned int neededBase = 0;     // Finest level asked for in the last frame
+    float requestedSize = 0;         // Largest on-screen size asked for since the last pump
+    bool streamingIn = false;
+};
+struct TextureReference {
+    int entry;
+    int* target; // Null when the owner asks with textureFromHandle() instead
+};
+static std::unordered_map<int, TextureEntry> textureEntries;
+static std::unordered_map<std::string, int> entryByPath;
+static std::unordered_map<TextureHandle, TextureReference> textureReferences;
+static std::unordered_map<GLuint, int> entryByTextureID;
+static int nextEntry = 0;
+static TextureHandle nextHandle = 0;
+
+// Resident textures nobody references anymore, least recently released first. These are what gets evicted.
+static std::list<int> unusedTextures;
+static size_t residentBytes = 0;
+static size_t extraBytes = 0; // See setExtraTextureMemory()
+static size_t memoryBudget = size_t(1) << 30;
+static void (*evictionCallback)(GLuint) = nullptr;
+
+static std::unordered_map<uint64_t, int> claimedContent;
+static std::mutex claimedContentMutex;
+
+static GLuint placeholderTextures[3];
+static TextureCompression textureCompression = TEXTURE_COMPRESSION_FAST;
+static bool textureStreaming = true;
+static const unsigned int streamingTailSize = 128; // Streamed textures start at the first level this small
+static bool supportsS3TC = false;
+
+// Pixel unpack buffer that stays mapped for the lifetime of the program. It is used as a ring,
+// every upload remembers a fence so we know when its part of the ring can be written again.
+struct PendingUpload {
+    size_t offset;
+    size_t size;
+    GLsync fence; // Null until the GL calls reading this part of the ring have been issued
+};
+static GLuint uploadBufferID = 0;
+static unsigned char* uploadBufferMemory = nullptr;
+static size_t uploadBufferSize = 0;
+static size_t uploadBufferHead = 0;
+static std::deque<PendingUpload> pendingUploads;
+
+
+// "name@channels=B.png" is name.png with only its blue channel, copied to red, green and blue. With more than one
+// channel ("@channels=GB") they go to red, green and so on. A file that really has the full name is used as it is.
+static std::string sourceFileName(const std::string &fileName, std::string &channels) {
+    channels.clear();
+    size_t at = fileName.rfind("@channels=");
+    size_t dot = fileName.rfind('.');
+    struct stat info;
+    if (at == std::string::npos || dot == std::string::npos || dot < at || stat(fileName.c_str(), &info) == 0) {
+        return fileName;
+    }
+    channels = fileName.substr(at + 10, dot - at - 10);
+    return fileName.substr(0, at) + fileName.substr(dot);
+}
+
+static bool channelOrder(const std::string &channels, unsigned int order[4]) {
+    static const std::string names = "RGBA";
+    if (channels.empty() || channels.size() > 4) {
+        return false;
+    }
+    for (int i = 0; i < 4; i++) {
+        order[i] = i < 3 ? IMAGE_CHANNEL_ZERO : IMAGE_CHANNEL_ONE;
+    }
+    for (size_t i = 0; i < channels.size(); i++) {
+        size_t channel = names.find((char)std::toupper((unsigned char)channels[i]));
+        if (channel == std::string::npos) {
+            return false;
+        }
+        order[i] = channel;
+    }
+    if (channels.size() == 1) {
+        order[1] = order[2] = order[0];
+    }
+    return true;
+}
+
+// FNV-1a of the whole file, mixed with the usage since the same image compresses differently as colour and as a normal map
+static bool hashFileContents(const std::string &fileName, TextureUsage usage, uint64_t &hash) {
+    std::string channels;
+    std::ifstream file(sourceFileName(fileName, channels), std::ios::binary);
+    if (!file) {
+        return false;
+    }
+    hash = 14695981039346656037ull ^ (uint64_t)usage;
+    for (char c : channels) {
+        hash = (hash ^ (unsigned char)c) * 1099511628211ull;
+    }
+    char buffer[1 << 16];
+    while (file) {
+        file.read(buffer, sizeof(buffer));
+        std::streamsize count = file.gcount();
+        for (std::streamsize i = 0; i < count; i++) {
+            hash = (hash ^ (unsigned char)buffer[i]) * 1099511628211ull;
+        }
+    }
+    return true;
+}
+
+static bool decodeImage(TextureJob* job) {
+    std::string channels;
+    std::string fileName = sourceFileName(job->fileName, channels);
+    unsigned int order[4];
+    if (!channels.empty() && !channelOrder(channels, order)) {
+        std::cout << "Unknown channels in texture path: " << job->fileName << std::endl;
+        return false;
+    }
+
+    std::string extension = fileName.substr(fileName.rfind('.') + 1);
+    if (extension == "png") {
+        PNGImage image = loadPNGFile(fileName);
+        if (image.pixels.empty()) {
+            return false;
+        }
+        job->width = image.width;
+        job->height = image.height;
+        job->pixels = std::move(image.pixels);
+    } else {
+        // Keep the channels the file has, expanding to RGBA ourselves is faster than letting stb do it
+        int width, height, fileChannels;
+        unsigned char* data = stbi_load(fileName.c_str(), &width, &height, &fileChannels, 0);
+        if (!data) {
+            std::cout << "Texture failed to load at path: " << fileName << std::endl;
+            return false;
+        }
+        job->width = width;
+        job->height = height;
+        job->pixels.resize(4 * width * height);
+        expandToRGBA(data, fileChannels, (size_t)width * height, job->pixels.data());
+        stbi_image_free(data);
+
+        // Same bottom row first order as loadPNGFile()
+        flipRows(job->pixels.data(), 4 * width, height);
+    }
+
+    if (!channels.empty()) {
+        swizzleChannels(job->pixels.data(), (size_t)job->width * job->height, order);
+    }
+    return true;
+}
+
+static long long modificationTime(const std::string &fileName) {
+    struct stat info;
+    if (stat(fileName.c_str(), &info) != 0) {
+        return -1;
+    }
+    return (long long)info.st_mtime;
+}
+
+static bool hasAlpha(const std::vector<unsigned char> &rgba) {
+    for (size_t i = 3; i < rgba.size(); i += 4) {
+        if (rgba[i] != 255) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// BC1 and BC3 (S3TC) are not core GL, so BC7 is used for those if the driver lacks the extension
+static BlockFormat chooseBlockFormat(TextureUsage usage, bool withAlpha) {
+    if (usage == TEXTURE_NORMAL_MAP) {
+        return BLOCK_BC5;
+    }
+    if (textureCompression == TEXTURE_COMPRESSION_HIGH_QUALITY || !supportsS3TC) {
+        return BLOCK_BC7;
+    }
+    return withAlpha ? BLOCK_BC3 : BLOCK_BC1;
+}
+
+static bool isCachedFormatUsable(BlockFormat format, TextureUsage usage) {
+    if (usage == TEXTURE_NORMAL_MAP) {
+        return format == BLOCK_BC5;
+    }
+    return format == chooseBlockFormat(usage, format == BLOCK_BC3) || (format == BLOCK_BC7 && !supportsS3TC);
+}
+
+static unsigned int tailLevel(unsigned int width, unsigned int height, unsigned int levelCount) {
+    unsigned int level = 0;
+    while ((std::max(width, height) >> level) > streamingTailSize && level + 1 < levelCount) {
+        level++;
+    }
+    return level;
+}
+
+// Reads the .ktx2 next to the image if it is newer than the image, otherwise decodes and compresses the image and writes the cache.
+// When streaming, only the mip tail is kept, the rest stays on disk until it is needed.
+static bool loadCompressed(TextureJob* job) {
+    std::string cacheFileName = job->fileName.substr(0, job->fileName.rfind('.')) + ".ktx2";
+    long long cacheTime = modificationTime(cacheFileName);
+    std::string channels;
+    if (cacheTime >= 0 && cacheTime >= modificationTime(sourceFileName(job->fileName, channels))
+        && readKTX2(cacheFileName, job->blocks, 0, 0) && isCachedFormatUsable(job->blocks.format, job->usage)) {
+        unsigned int firstLevel = textureStreaming ? tailLevel(job->blocks.width, job->blocks.height, job->blocks.levels.size()) : 0;
+        if (readKTX2(cacheFileName, job->blocks, firstLevel)) {
+            job->isCompressed = true;
+            job->width = job->blocks.width;
+            job->height = job->blocks.height;
+            if (textureStreaming) {
+                job->cacheFileName = cacheFileName;
+                job->firstLevel = firstLevel;
+            }
+            return true;
+        }
+    }
+
+    if (!decodeImage(job)) {
+        return false;
+    }
+    BlockFormat format = chooseBlockFormat(job->usage, hasAlpha(job->pixels));
+    job->blocks = compressTexture(job->pixels.data(), job->width, job->height, format, job->usage == TEXTURE_NORMAL_MAP);
+    job->isCompressed = true;
+    job->pixels.clear();
+
+    if (!writeKTX2(cacheFileName, job->blocks)) {
+        std::cout << "Could not write texture cache " << cacheFileName << std::endl;
+    } else if (textureStreaming) {
+        job->cacheFileName = cacheFileName;
+        job->firstLevel = tailLevel(job->width, job->height, job->blocks.levels.size());
+        for (unsigned int level = 0; level < job->firstLevel; level++) {
+            std::vector<unsigned char>().swap(job->blocks.levels[level]);
+        }
+    }
+    return true;
+}
+
+static void decodeWorker() {
+    while (true) {
+        TextureJob* job;
+        {
+            std::unique_lock<std::mutex> lock(decodeQueueMutex);
+            decodeQueueCondition.wait(lock, [] { return decodeWorkersQuit || !decodeQueue.empty(); });
+            if (decodeWorkersQuit) {
+                return;
+            }
+            job = decodeQueue.front();
+            decodeQueue.pop_front();
+        }
+
+        if (job->isStreamIn) {
+            job->isCompressed = readKTX2(job->fileName, job->blocks, job->firstLevel, job->levelCount);
+            while (!uploadQueue.push(job)) {
+                std::this_thread::yield();
+            }
+            continue;
+        }
+
+        if (hashFileContents(job->fileName, job->usage, job->contentHash)) {
+            std::lock_guard<std::mutex> lock(claimedContentMutex);
+            auto claim = claimedContent.find(job->contentHash);
+            if (claim != claimedContent.end() && claim->second != job->entry) {
+                job->duplicateOf = claim->second;
+            } else {
+                claimedContent[job->contentHash] = job->entry;
+            }
+        }
+
+        bool loaded = false;
+        if (job->duplicateOf < 0) {
+            loaded = textureCompression == TEXTURE_COMPRESSION_NONE ? decodeImage(job) : loadCompressed(job);
+        }
+        if (!loaded) {
+            job->pixels.clear();
+            job->isCompressed = false;
+        }
+
+        while (!uploadQueue.push(job)) {
+            std::this_thread::yield();
+        }
+    }
+}
+
+static GLuint createPlaceholder(const unsigned char rgba[4]) {
+    GLuint id;
+    glCreateTextures(GL_TEXTURE_2D, 1, &id);
+    glTextureStorage2D(id, 1, GL_RGBA8, 1, 1);
+    glTextureSubImage2D(id, 0, 0, 0, 1, 1, GL_RGBA, GL_UNSIGNED_BYTE, rgba);
+    return id;
+}
+
+void initTextureLoader(TextureCompression compression, unsigned int workerCount, size_t bufferSize) {
+    textureCompression = compression;
+    // The levels that are not resident are read back from the .ktx2 cache, so only compressed textures can be streamed
+    textureStreaming = textureStreaming && compression != TEXTURE_COMPRESSION_NONE;
+    supportsS3TC = GLAD_GL_EXT_texture_compression_s3tc;
+
+    const unsigned char white[4] = {255, 255, 255, 255};
+    const unsigned char flatNormal[4] = {128, 128, 255, 255};
+    const unsigned char grey[4] = {128, 128, 128, 255};
+    placeholderTextures[TEXTURE_COLOR] = createPlaceholder(white);
+    placeholderTextures[TEXTURE_NORMAL_MAP] = createPlaceholder(flatNormal);
+    placeholderTextures[TEXTURE_DATA] = createPlaceholder(grey);
+
+    uploadBufferSize = bufferSize;
+    GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+    glCreateBuffers(1, &uploadBufferID);
+    glNamedBufferStorage(uploadBufferID, uploadBufferSize, nullptr, flags);
+    uploadBufferMemory = (unsigned char*)glMapNamedBufferRange(uploadBufferID, 0, uploadBufferSize, flags);
+
+    if (workerCount == 0) {
+        workerCount = std::max(1u, std::thread::hardware_concurrency() - 1);
+    }
+    decodeWorkersQuit = false;
+    for (unsigned int i = 0; i < workerCount; i++) {
+        decodeWorkers.emplace_back(decodeWorker);
+    }
+}
+
+static void queueDecode(TextureJob* job) {
+    {
+        std::lock_guard<std::mutex> lock(decodeQueueMutex);
+        decodeQueue.push_back(job);
+    }
+    decodeQueueCondition.notify_one();
+}
+
+static void addReference(int entryIndex, TextureHandle handle, int* target) {
+    TextureEntry &entry = textureEntries[entryIndex];
+    entry.references.push_back(handle);
+    textureReferences[handle] = {entryIndex, target};
+    if (entry.inLRU) {
+        unusedTextures.erase(entry.lruPosition);
+        entry.inLRU = false;
+    }
+    if (target) {
+        *target = entry.resident ? entry.id : placeholderTextures[entry.usage];
+    }
+}
+
+static void evictTexture(int entryIndex) {
+    TextureEntry &entry = textureEntries[entryIndex];
+    if (evictionCallback) {
+        evictionCallback(entry.id);
+    }
+    entryByTextureID.erase(entry.id);
+    glDeleteTextures(1, &entry.id);
+    residentBytes -= entry.sizeInBytes;
+    unusedTextures.erase(entry.lruPosition);
+    for (const std::string &key : entry.keys) {
+        entryByPath.erase(key);
+    }
+    {
+        std::lock_guard<std::mutex> lock(claimedContentMutex);
+        auto claim = claimedContent.find(entry.contentHash);
+        if (claim != claimedContent.end() && claim->second == entryIndex) {
+            claimedContent.erase(claim);
+        }
+    }
+    textureEntries.erase(entryIndex);
+}
+
+static size_t residentLevelBytes(const TextureEntry &entry, unsigned int firstLevel, unsigned int endLevel) {
+    size_t size = 0;
+    for (unsigned int level = firstLevel; level < endLevel; level++) {
+        size += levelSizeInBytes(entry.format, entry.width, entry.height, level);
+    }
+    return size;
+}
+
+static void resizeResidentLevels(int entryIndex, unsigned int newBase, const CompressedTexture* finerLevels);
+
+static void enforceMemoryBudget() {
+    while (residentBytes + extraBytes > memoryBudget && !unusedTextures.empty()) {
+        evictTexture(unusedTextures.front());
+    }
+
+    // Then the levels of streamed textures that are finer than anyone has asked for, biggest savings first
+    while (residentBytes + extraBytes > memoryBudget) {
+        int largest = -1;
+        size_t largestSavings = 0;
+        for (auto &pair : textureEntries) {
+            const TextureEntry &entry = pair.second;
+            if (entry.streamed && entry.resident && entry.neededBase > entry.residentBase) {
+                size_t savings = residentLevelBytes(entry, entry.residentBase, entry.neededBase);
+                if (savings > largestSavings) {
+                    largest = pair.first;
+                    largestSavings = savings;
+                }
+            }
+        }
+        if (largest < 0) {
+            break;
+        }
+        resizeResidentLevels(largest, textureEntries[largest].neededBase, nullptr);
+    }
+}
+
+static void markUnused(int entryIndex) {
+    TextureEntry &entry = textureEntries[entryIndex];
+    if (entry.resident && entry.references.empty() && !entry.inLRU) {
+        entry.lruPosition = unusedTextures.insert(unusedTextures.end(), entryIndex);
+        entry.inLRU = true;
+    }
+}
+
+TextureHandle loadTextureAsync(std::string fileName, int* textureID, TextureUsage usage) {
+    TextureHandle handle = nextHandle++;
+    // The path as given is tried first, so scenes asking for one texture many times skip realpath()
+    std::string nameKey = fileName + "#" + std::to_string(usage);
+    auto existing = entryByPath.find(nameKey);
+    if (existing != entryByPath.end()) {
+        addReference(existing->second, handle, textureID);
+        return handle;
+    }
+
+    // Different spellings of the same path should end up as the same texture
+    char canonicalPath[PATH_MAX];
+    std::string key = realpath(fileName.c_str(), canonicalPath) ? canonicalPath : fileName;
+    key += "#" + std::to_string(usage);
+
+    existing = entryByPath.find(key);
+    if (existing != entryByPath.end()) {
+        textureEntries[existing->second].keys.push_back(nameKey);
+        entryByPath[nameKey] = existing->second;
+        addReference(existing->second, handle, textureID);
+        return handle;
+    }
+
+    int entryIndex = nextEntry++;
+    TextureEntry &entry = textureEntries[entryIndex];
+    entry.keys.push_back(key);
+    entry.usage = usage;
+    entryByPath[key] = entryIndex;
+    if (nameKey != key) {
+        entry.keys.push_back(nameKey);
+        entryByPath[nameKey] = entryIndex;
+    }
+    addReference(entryIndex, handle, textureID);
+
+    TextureJob* job = new TextureJob();
+    job->fileName = fileName;
+    job->entry = entryIndex;
+    job->usage = usage;
+    pendingJobs++;
+    queueDecode(job);
+    return handle;
+}
+
+void releaseTexture(TextureHandle handle) {
+    auto reference = textureReferences.find(handle);
+    if (reference == textureReferences.end()) {
+        return;
+    }
+    int entryIndex = reference->second.entry;
+    textureReferences.erase(reference);
+
+    std::vector<TextureHandle> &references = textureEntries[entryIndex].references;
+    references.erase(std::find(references.begin(), references.end(), handle));
+    markUnused(entryIndex);
+    enforceMemoryBudget();
+}
+
+int textureFromHandle(TextureHandle handle) {
+    auto reference = textureReferences.find(handle);
+    if (reference == textureReferences.end()) {
+        return -1;
+    }
+    const TextureEntry &entry = textureEntries[reference->second.entry];
+    return entry.resident ? entry.id : placeholderTextures[entry.usage];
+}
+
+void setTextureMemoryBudget(size_t bytes) {
+    memoryBudget = bytes;
+    enforceMemoryBudget();
+}
+
+void setExtraTextureMemory(size_t bytes) {
+    extraBytes = bytes;
+}
+
+void setTextureEvictionCallback(void (*callback)(GLuint)) {
+    evictionCallback = callback;
+}
+
+void requestTextureDetail(int textureID, float screenSize) {
+    auto entry = entryByTextureID.find(textureID);
+    if (entry != entryByTextureID.end()) {
+        float &requestedSize = textureEntries[entry->second].requestedSize;
+        requestedSize = std::max(requestedSize, screenSize);
+    }
+}
+
+bool streamedTextureLevels(int textureID, TextureLevels &levels) {
+    auto found = entryByTextureID.find(textureID);
+    if (found == entryByTextureID.end()) {
+        return false;
+    }
+    const TextureEntry &entry = textureEntries[found->second];
+    if (!entry.streamed) {
+        return false;
+    }
+    levels = {entry.width, entry.height, entry.levelCount, entry.residentBase};
+    return true;
+}
+
+void setTextureStreaming(bool enabled) {
+    textureStreaming = enabled;
+}
+
+size_t textureMemoryUsage() {
+    return residentBytes;
+}
+
+// Puts a fence behind every part of the ring written since the last call
+static void fenceStagedUploads() {
+    for (PendingUpload &upload : pendingUploads) {
+        if (upload.fence == nullptr) {
+            upload.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        }
+    }
+}
+
+// Finds room for `size` bytes in the upload ring, waiting for the GPU to finish with older uploads if needed
+static size_t reserveUploadSpace(size_t size) {
+    size_t offset = uploadBufferHead;
+    if (offset + size > uploadBufferSize) {
+        offset = 0;
+    }
+
+    auto overlaps = [&](const PendingUpload &upload) {
+        return upload.offset < offset + size && offset < upload.offset + upload.size;
+    };
+    while (std::any_of(pendingUploads.begin(), pendingUploads.end(), overlaps)) {
+        PendingUpload &oldest = pendingUploads.front();
+        if (oldest.fence == nullptr) {
+            fenceStagedUploads();
+        }
+        glClientWaitSync(oldest.fence, GL_SYNC_FLUSH_COMMANDS_BIT, GLuint64(1000000000));
+        glDeleteSync(oldest.fence);
+        pendingUploads.pop_front();
+    }
+
+    // Keep every upload starting on a nicely aligned address
+    uploadBufferHead = (offset + size + 255) & ~size_t(255);
+    pendingUploads.push_back({offset, size, nullptr});
+    return offset;
+}
+
+// Copies data into the ring and binds it for unpacking. Returns what to pass as the pixel pointer to GL.
+static const void* stageUpload(const void* data, size_t size) {
+    if (size > uploadBufferSize) {
+        // Too big for the ring, let the driver copy it
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        return data;
+    }
+    size_t offset = reserveUploadSpace(size);
+    std::memcpy(uploadBufferMemory + offset, data, size);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, uploadBufferID);
+    return (const void*)offset;
+}
+
+static GLuint uploadJob(TextureJob* job) {
+    GLuint id;
+    glCreateTextures(GL_TEXTURE_2D, 1, &id);
+    glTextureParameteri(id, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTextureParameteri(id, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+    if (job->isCompressed) {
+        // The mip chain was built on the loader thread, so the GPU only has to copy.
+        // Streamed textures start at firstLevel, which becomes level 0 of the GL texture.
+        const CompressedTexture &blocks = job->blocks;
+        GLenum format = glInternalFormat(blocks.format);
+        unsigned int base = job->firstLevel;
+        glTextureStorage2D(id, blocks.levels.size() - base, format, std::max(1u, blocks.width >> base), std::max(1u, blocks.height >> base));
+        for (unsigned int level = base; level < blocks.levels.size(); level++) {
+            const std::vector<unsigned char> &data = blocks.levels[level];
+            const void* pixels = stageUpload(data.data(), data.size());
+            glCompressedTextureSubImage2D(id, level - base, 0, 0, std::max(1u, blocks.width >> level), std::max(1u, blocks.height >> level),
+                                          format, data.size(), pixels);
+        }
+    } else {
+        GLsizei levels = 1;
+        while ((std::max(job->width, job->height) >> levels) > 0) {
+            levels++;
+        }
+        glTextureStorage2D(id, levels, GL_RGBA8, job->width, job->height);
+        const void* pixels = stageUpload(job->pixels.data(), job->pixels.size());
+        glTextureSubImage2D(id, 0, 0, 0, job->width, job->height, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+        glGenerateTextureMipmap(id);
+    }
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    fenceStagedUploads();
+    return id;
+}
+
+// Two paths turned out to hold the same image. Everything referencing `from` now shares `into`.
+static void mergeEntries(int fromIndex, int intoIndex) {
+    TextureEntry &from = textureEntries[fromIndex];
+    TextureEntry &into = textureEntries[intoIndex];
+    for (TextureHandle handle : from.references) {
+        TextureReference &reference = textureReferences[handle];
+        reference.entry = intoIndex;
+        into.references.push_back(handle);
+        if (into.resident && reference.target) {
+            *reference.target = into.id;
+        }
+    }
+    if (into.inLRU && !into.references.empty()) {
+        unusedTextures.erase(into.lruPosition);
+        into.inLRU = false;
+    }
+    for (const std::string &key : from.keys) {
+        entryByPath[key] = intoIndex;
+        into.keys.push_back(key);
+    }
+    textureEntries.erase(fromIndex);
+}
+
+static void finishJob(TextureJob* job) {
+    TextureEntry &entry = textureEntries[job->entry];
+    entry.contentHash = job->contentHash;
+    if (job->isCompressed || !job->pixels.empty()) {
+        entry.id = uploadJob(job);
+        entry.sizeInBytes = job->isCompressed ? job->sizeInBytes() : job->sizeInBytes() * 4 / 3;
+        entry.resident = true;
+        residentBytes += entry.sizeInBytes;
+        entryByTextureID[entry.id] = job->entry;
+        for (TextureHandle handle : entry.references) {
+            if (textureReferences[handle].target) {
+                *textureReferences[handle].target = entry.id;
+            }
+        }
+        markUnused(job->entry);
+
+        if (!job->cacheFileName.empty()) {
+            entry.streamed = true;
+            entry.cacheFileName = job->cacheFileName;
+            entry.format = job->blocks.format;
+            entry.width = job->blocks.width;
+            entry.height = job->blocks.height;
+            entry.levelCount = job->blocks.levels.size();
+            entry.residentBase = entry.tailLevel = entry.neededBase = job->firstLevel;
+        }
+    }
+}
+
+// Swaps in a new GL texture for an entry, everyone pointing at the old one is pointed at the new one
+static void replaceTexture(int entryIndex, GLuint id, size_t sizeInBytes) {
+    TextureEntry &entry = textureEntries[entryIndex];
+    if (evictionCallback) {
+        evictionCallback(entry.id);
+    }
+    entryByTextureID.erase(entry.id);
+    glDeleteTextures(1, &entry.id);
+
+    residentBytes = residentBytes - entry.sizeInBytes + sizeInBytes;
+    entry.id = id;
+    entry.sizeInBytes = sizeInBytes;
+    entryByTextureID[id] = entryIndex;
+    for (TextureHandle handle : entry.references) {
+        if (textureReferences[handle].target) {
+            *textureReferences[handle].target = id;
+        }
+    }
+}
+
+// Reallocates a streamed texture to hold the levels from newBase down. Levels both textures have are copied on the GPU,
+// finer ones come from finerLevels. A new texture rather than GL_TEXTURE_BASE_LEVEL on one full size allocation,
+// since that would not give any memory back, and bindless handles freeze the base level anyway.
+static void resizeResidentLevels(int entryIndex, unsigned int newBase, const CompressedTexture* finerLevels) {
+    TextureEntry &entry = textureEntries[entryIndex];
+    GLenum format = glInternalFormat(entry.format);
+
+    GLuint id;
+    glCreateTextures(GL_TEXTURE_2D, 1, &id);
+    glTextureParameteri(id, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTextureParameteri(id, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTextureStorage2D(id, entry.levelCount - newBase, format, std::max(1u, entry.width >> newBase), std::max(1u, entry.height >> newBase));
+
+    for (unsigned int level = std::max(newBase, entry.residentBase); level < entry.levelCount; level++) {
+        glCopyImageSubData(entry.id, GL_TEXTURE_2D, level - entry.residentBase, 0, 0, 0,
+                           id, GL_TEXTURE_2D, level - newBase, 0, 0, 0,
+                           std::max(1u, entry.width >> level), std::max(1u, entry.height >> level), 1);
+    }
+    if (finerLevels) {
+        for (unsigned int level = newBase; level < entry.residentBase; level++) {
+            const std::vector<unsigned char> &data = finerLevels->levels[level];
+            const void* pixels = stageUpload(data.data(), data.size());
+            glCompressedTextureSubImage2D(id, level - newBase, 0, 0, std::max(1u, entry.width >> level), std::max(1u, entry.height >> level),
+                                          format, data.size(), pixels);
+        }
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        fenceStagedUploads();
+    }
+
+    replaceTexture(entryIndex, id, residentLevelBytes(entry, newBase, entry.levelCount));
+    entry.residentBase = newBase;
+}
+
+static void finishStreamIn(TextureJob* job) {
+    auto found = textureEntries.find(job->entry);
+    if (found == textureEntries.end()) {
+        return;
+    }
+    TextureEntry &entry = found->second;
+    entry.streamingIn = false;
+
+    // If levels were dropped while we were reading, the next frame asks again
+    if (job->isCompressed && entry.resident && entry.residentBase == job->firstLevel + job->levelCount) {
+        resizeResidentLevels(job->entry, job->firstLevel, &job->blocks);
+    }
+}
+
+// Turns the sizes asked for by the last frame into the level each texture needs, and queues reads of the missing ones
+static void updateStreaming() {
+    for (auto &pair : textureEntries) {
+        TextureEntry &entry = pair.second;
+        if (!entry.streamed || !entry.resident) {
+            continue;
+        }
+
+        // One texel per pixel is enough
+        entry.neededBase = entry.tailLevel;
+        if (entry.requestedSize > 0) {
+            float texelsPerPixel = std::max(entry.width, entry.height) / entry.requestedSize;
+            int level = texelsPerPixel > 1 ? (int)std::floor(std::log2(texelsPerPixel)) : 0;
+            entry.neededBase = std::min((unsigned int)level, entry.tailLevel);
+        }
+        entry.requestedSize = 0;
+
+        // Do not read in levels the budget would only make us drop again
+        if (entry.neededBase >= entry.residentBase || entry.streamingIn
+            || residentBytes + extraBytes + residentLevelBytes(entry, entry.neededBase, entry.residentBase) > memoryBudget) {
+            continue;
+        }
+        TextureJob* job = new TextureJob();
+        job->fileName = entry.cacheFileName;
+        job->entry = pair.first;
+        job->usage = entry.usage;
+        job->isStreamIn = true;
+        job->firstLevel = entry.neededBase;
+        job->levelCount = entry.residentBase - entry.neededBase;
+        entry.streamingIn = true;
+        queueDecode(job);
+    }
+}
+
+void pumpTextureUploads(size_t maxBytes) {
+    if (textureStreaming) {
+        updateStreaming();
+    }
+
+    size_t uploadedBytes = 0;
+    TextureJob* job;
+    while (uploadedBytes < maxBytes && uploadQueue.pop(job)) {
+        if (job->isStreamIn) {
+            finishStreamIn(job);
+            uploadedBytes += job->sizeInBytes();
+            delete job;
+            continue;
+        }
+        if (job->duplicateOf >= 0) {
+            if (textureEntries.count(job->duplicateOf)) {
+                mergeEntries(job->entry, job->duplicateOf);
+            } else {
+                // The original was evicted before we got here, so this one has to be decoded after all
+                job->duplicateOf = -1;
+                queueDecode(job);
+                continue;
+            }
+        } else {
+            finishJob(job);
+            uploadedBytes += job->sizeInBytes();
+        }
+        delete job;
+        pendingJobs--;
+    }
+    enforceMemoryBudget();
+
+    // Let go of fences the GPU has already passed
+    while (!pendingUploads.empty() && pendingUploads.front().fence != nullptr) {
+        GLenum status = glClientWaitSync(pendingUploads.front().fence, 0, 0);
+        if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED) {
+            break;
+        }
+        glDeleteSync(pendingUploads.front().fence);
+        pendingUploads.pop_front();
+    }
+}
+
+void finishTextureLoads() {
+    while (pendingJobs > 0) {
+        pumpTextureUploads(SIZE_MAX);
+        std::this_thread::yield();
+    }
+}
+
+unsigned int pendingTextureLoads() {
+    return pendingJobs;
+}
+
+void shutdownTextureLoader() {
+    {
+        std::lock_guard<std::mutex> lock(decodeQueueMutex);
+        decodeWorkersQuit = true;
+    }
+    decodeQueueCondition.notify_all();
+    for (std::thread &worker : decodeWorkers) {
+        worker.join();
+    }
+    decodeWorkers.clear();
+
+    for (TextureJob* job : decodeQueue) {
+        delete job;
+    }
+    decodeQueue.clear();
+    TextureJob* job;
+    while (uploadQueue.pop(job)) {
+        delete job;
+    }
+
+    for (PendingUpload &upload : pendingUploads) {
+        if (upload.fence) {
+            glDeleteSync(upload.fence);
+        }
+    }
+    pendingUploads.clear();
+
+    for (auto &entry : textureEntries) {
+        if (entry.second.resident) {
+            glDeleteTextures(1, &entry.second.id);
+        }
+    }
+    textureEntries.clear();
+    entryByPath.clear();
+    entryByTextureID.clear();
+    textureReferences.clear();
+    unusedTextures.clear();
+    claimedContent.clear();
+    residentBytes = 0;
+    extraBytes = 0;
+
+    glUnmapNamedBuffer(uploadBufferID);
+    glDeleteBuffers(1, &uploadBufferID);
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <string>
+#include <cstddef>
+
+// What a texture is used for. Decides the placeholder shown while it loads.
+enum TextureUsage {
+    TEXTURE_COLOR, TEXTURE_NORMAL_MAP, TEXTURE_DATA
+};
+
+// How textures are stored on the GPU. Compressed textures are block compressed on the loader threads
+// the first time they are seen, and cached as .ktx2 files next to the source image for later runs.
+enum TextureCompression {
+    TEXTURE_COMPRESSION_NONE,         // RGBA8, mips generated by the driver
+    TEXTURE_COMPRESSION_FAST,         // BC1 for opaque, BC3 with alpha, BC5 for normal maps
+    TEXTURE_COMPRESSION_HIGH_QUALITY  // BC7, BC5 for normal maps
+};
+
+// Starts the decoder threads and creates the placeholder textures. Needs a current GL context.
+// workerCount 0 uses one thread per core, minus the one running GL.
+void initTextureLoader(TextureCompression compression = TEXTURE_COMPRESSION_FAST, unsigned int workerCount = 0, size_t uploadBufferSize = 64 << 20);
+
+// A reference to a shared texture, returned by loadTextureAsync()
+typedef int TextureHandle;
+
+// Queues an image for decoding on the worker threads. *textureID is set to a placeholder right away,
+// and replaced with the real texture once pumpTextureUploads() has uploaded it.
+// Textures are shared: asking for a path (or for a file with the same contents as one) that is already
+// loaded or on its way gives the same GL texture, and only adds a reference.
+// textureID may be null, for owners that look the texture up with textureFromHandle() when they need it,
+// since *textureID is written on the GL thread.
+TextureHandle loadTextureAsync(std::string fileName, int* textureID, TextureUsage usage = TEXTURE_COLOR);
+
+// Drops a reference, *textureID is no longer updated after this. Textures without references stay
+// on the GPU so they can be picked up again, until the memory budget forces them out, least recently released first.
+// Must be called on the GL thread, since this can delete textures.
+void releaseTexture(TextureHandle handle);
+
+// The texture a handle refers to right now, the placeholder until it is uploaded. -1 once released.
+int textureFromHandle(TextureHandle handle);
+
+void setTextureMemoryBudget(size_t bytes);
+// Memory the budget has to cover besides the loaded textures, like copies of them in texture arrays. It is only
+// recorded here, and counted the next time the budget is enforced, so it may be set from the eviction callback.
+void setExtraTextureMemory(size_t bytes);
+
+// Compressed textures are streamed: they start out with only their small mip levels on the GPU, and finer levels
+// are read in from the .ktx2 cache when something asks for them. Levels nobody has asked for lately are dropped
+// again when over the memory budget. The texture ID changes whenever the resident levels do. On by default,
+// call before initTextureLoader() to turn it off.
+void setTextureStreaming(bool enabled);
+
+// Tells the streamer a texture is drawn about screenSize pixels across this frame
+void requestTextureDetail(int textureID, float screenSize);
+
+// A texture as it is at full detail. Streamed textures only have the levels from residentBase on in their GL texture,
+// which starts at that level.
+struct TextureLevels {
+    unsigned int width;
+    unsigned int height;
+    unsigned int levelCount;
+    unsigned int residentBase;
+};
+// False for textures the loader does not stream, which have all their levels
+bool streamedTextureLevels(int textureID, TextureLevels &levels);
+
+// Called with the GL name of every texture just before the registry deletes it
+void setTextureEvictionCallback(void (*callback)(GLuint textureID));
+
+// Bytes of GPU memory used by loaded textures, including mip levels
+size_t textureMemoryUsage();
+
+// Uploads images that have finished decoding, at most about maxBytes per call. Must be called on the GL thread.
+void pumpTextureUploads(size_t maxBytes = 32 << 20);
+
+// Blocks until every queued texture has been uploaded
+void finishTextureLoads();
+
+// Number of textures queued that have not been uploaded yet
+unsigned int pendingTextureLoads();
+
+void shutdownTextureLoader();
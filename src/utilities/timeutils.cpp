@@ -5,6 +5,13 @@
 // We initialise this value to the time at the start of the program.
 static std::chrono::steady_clock::time_point _previousTimePoint = std::chrono::steady_clock::now();
 
+// Used instead of the measured time when it is not 0
+static double _fixedTimeDelta = 0;
+
+void setFixedTimeDelta(double seconds) {
+	_fixedTimeDelta = seconds;
+}
+
 // Calculates the elapsed time since the previous time this function was called.
 double getTimeDeltaSeconds() {
 	// Determine the current time
@@ -18,6 +25,10 @@ double getTimeDeltaSeconds() {
 	// Store the previously measured current time
 	_previousTimePoint = currentTime;
 
+	if (_fixedTimeDelta > 0) {
+		return _fixedTimeDelta;
+	}
+
 	// Return the calculated time delta in seconds
 	return timeDeltaSeconds;
 }
\ No newline at end of file
@@ -1,3 +1,7 @@
 #pragma once
 
-double getTimeDeltaSeconds();
\ No newline at end of file
+double getTimeDeltaSeconds();
+
+// Makes getTimeDeltaSeconds() return this instead of the real time, for runs that have to be the same every time.
+// 0 goes back to the real time.
+void setFixedTimeDelta(double seconds);
@@ -0,0 +1,426 @@
+#include "transformHierarchy.h"
+#include "transformKernels.h"
+#include <algorithm>
+#include <vector>
+
+// Three floats per transform, kept as three arrays so a field of many transforms can be read at once
+struct Vec3Array {
+    std::vector<float> x, y, z;
+
+    void push_back(glm::vec3 v) {
+        x.push_back(v.x);
+        y.push_back(v.y);
+        z.push_back(v.z);
+    }
+    void set(size_t i, glm::vec3 v) {
+        x[i] = v.x;
+        y[i] = v.y;
+        z[i] = v.z;
+    }
+    glm::vec3 get(size_t i) const {
+        return glm::vec3(x[i], y[i], z[i]);
+    }
+};
+
+// Indexed by position in the arrays, parents before children
+static std::vector<int> parents; // Position of the parent, -1 for roots
+static Vec3Array positions;
+static Vec3Array rotations;
+static Vec3Array scales;
+static Vec3Array referencePoints;
+static std::vector<glm::mat4> localMatrices;
+static std::vector<glm::mat4> worldMatrices;
+static std::vector<glm::mat3> localNormalMatrices;
+static std::vector<glm::mat3> worldNormalMatrices;
+static std::vector<int> subtreeEnds; // One past the last descendant, subtrees are contiguous
+static std::vector<unsigned char> isDirty; // The local matrix is out of date
+static std::vector<TransformID> idAtIndex; // -1 for a destroyed transform that has not been compacted away yet
+
+// The state at the start of the tick, and the blend between that and the current state the last interpolation
+// used. They only differ from the current state for transforms that are moving, that is, set during the tick.
+static Vec3Array previousPositions;
+static Vec3Array previousRotations;
+static Vec3Array previousScales;
+static Vec3Array blendedPositions;
+static Vec3Array blendedRotations;
+static Vec3Array blendedScales;
+static std::vector<unsigned char> motions;
+static std::vector<TransformID> movingIDs;
+
+enum Motion : unsigned char {
+    STILL,
+    MOVING,
+    CREATED // Set up since the tick began, so there is nothing to blend from and it is drawn where it is
+};
+
+static std::vector<int> indexOfID; // -1 for IDs that are free
+static std::vector<TransformID> freeIDs;
+static size_t destroyedCount = 0;
+static bool needsSorting = false;
+
+// Transforms changed since the last update, and the ones whose world matrix that update changed
+static std::vector<TransformID> dirtyIDs;
+static std::vector<TransformID> changedIDs;
+
+struct Listener {
+    TransformListener callback;
+    void* userData;
+};
+static std::vector<Listener> listeners;
+
+
+static void markDirty(int index) {
+    if (!isDirty[index]) {
+        isDirty[index] = true;
+        dirtyIDs.push_back(idAtIndex[index]);
+    }
+}
+
+static void markMoving(int index) {
+    if (motions[index] == STILL) {
+        motions[index] = MOVING;
+        movingIDs.push_back(idAtIndex[index]);
+    }
+}
+
+
+TransformID createTransform() {
+    TransformID id;
+    if (!freeIDs.empty()) {
+        id = freeIDs.back();
+        freeIDs.pop_back();
+        indexOfID[id] = parents.size();
+    } else {
+        id = indexOfID.size();
+        indexOfID.push_back(parents.size());
+    }
+    idAtIndex.push_back(id);
+    parents.push_back(-1);
+    positions.push_back(glm::vec3(0));
+    rotations.push_back(glm::vec3(0));
+    scales.push_back(glm::vec3(1));
+    referencePoints.push_back(glm::vec3(0));
+    previousPositions.push_back(glm::vec3(0));
+    previousRotations.push_back(glm::vec3(0));
+    previousScales.push_back(glm::vec3(1));
+    blendedPositions.push_back(glm::vec3(0));
+    blendedRotations.push_back(glm::vec3(0));
+    blendedScales.push_back(glm::vec3(1));
+    motions.push_back(CREATED);
+    movingIDs.push_back(id);
+    localMatrices.push_back(glm::mat4(1));
+    worldMatrices.push_back(glm::mat4(1));
+    localNormalMatrices.push_back(glm::mat3(1));
+    worldNormalMatrices.push_back(glm::mat3(1));
+    subtreeEnds.push_back(parents.size());
+    isDirty.push_back(false);
+    markDirty(parents.size() - 1);
+    return id;
+}
+
+static void reserve(Vec3Array &values, size_t count) {
+    values.x.reserve(count);
+    values.y.reserve(count);
+    values.z.reserve(count);
+}
+
+void reserveTransforms(size_t count) {
+    count += destroyedCount; // Those still take up space until the next sort
+    parents.reserve(count);
+    reserve(positions, count);
+    reserve(rotations, count);
+    reserve(scales, count);
+    reserve(referencePoints, count);
+    reserve(previousPositions, count);
+    reserve(previousRotations, count);
+    reserve(previousScales, count);
+    reserve(blendedPositions, count);
+    reserve(blendedRotations, count);
+    reserve(blendedScales, count);
+    motions.reserve(count);
+    localMatrices.reserve(count);
+    worldMatrices.reserve(count);
+    localNormalMatrices.reserve(count);
+    worldNormalMatrices.reserve(count);
+    subtreeEnds.reserve(count);
+    isDirty.reserve(count);
+    idAtIndex.reserve(count);
+    indexOfID.reserve(count);
+    dirtyIDs.reserve(count);
+}
+
+void destroyTransform(TransformID id) {
+    int index = indexOfID[id];
+    idAtIndex[index] = -1;
+    indexOfID[id] = -1;
+    freeIDs.push_back(id);
+    destroyedCount++;
+    // Leave the hole until there are enough of them to be worth moving everything
+    if (destroyedCount * 4 > parents.size()) {
+        needsSorting = true;
+    }
+}
+
+void setTransformParent(TransformID id, TransformID parent) {
+    int index = indexOfID[id];
+    int parentIndex = parent < 0 ? -1 : indexOfID[parent];
+    if (parents[index] == parentIndex) {
+        return;
+    }
+    parents[index] = parentIndex;
+    markDirty(index);
+    needsSorting = true; // To keep the subtrees in one piece
+}
+
+TransformID transformParent(TransformID id) {
+    int parent = parents[indexOfID[id]];
+    return parent < 0 ? -1 : idAtIndex[parent];
+}
+
+// Setting a value the transform already has does not make it dirty, so it is fine to set things every frame
+static bool setField(Vec3Array &field, TransformID id, glm::vec3 value) {
+    int index = indexOfID[id];
+    if (field.get(index) != value) {
+        field.set(index, value);
+        markDirty(index);
+        return true;
+    }
+    return false;
+}
+
+// Until the next tick begins, the transform is drawn somewhere between where it was and where it is now
+static void setBlendedField(Vec3Array &field, TransformID id, glm::vec3 value) {
+    if (setField(field, id, value)) {
+        markMoving(indexOfID[id]);
+    }
+}
+
+void setLocalPosition(TransformID id, glm::vec3 position) { setBlendedField(positions, id, position); }
+void setLocalRotation(TransformID id, glm::vec3 rotation) { setBlendedField(rotations, id, rotation); }
+void setLocalScale(TransformID id, glm::vec3 scale) { setBlendedField(scales, id, scale); }
+void setReferencePoint(TransformID id, glm::vec3 referencePoint) { setField(referencePoints, id, referencePoint); }
+glm::vec3 localPosition(TransformID id) { return positions.get(indexOfID[id]); }
+glm::vec3 localRotation(TransformID id) { return rotations.get(indexOfID[id]); }
+glm::vec3 localScale(TransformID id) { return scales.get(indexOfID[id]); }
+glm::vec3 referencePoint(TransformID id) { return referencePoints.get(indexOfID[id]); }
+
+const glm::mat4& worldMatrix(TransformID id) {
+    return worldMatrices[indexOfID[id]];
+}
+
+const glm::mat3& normalMatrix(TransformID id) {
+    return worldNormalMatrices[indexOfID[id]];
+}
+
+size_t transformCount() {
+    return parents.size() - destroyedCount;
+}
+
+template <typename T>
+static void permute(std::vector<T> &values, const std::vector<int> &order) {
+    std::vector<T> sorted(order.size());
+    for (size_t i = 0; i < order.size(); i++) {
+        sorted[i] = values[order[i]];
+    }
+    values.swap(sorted);
+}
+
+static void permute(Vec3Array &values, const std::vector<int> &order) {
+    permute(values.x, order);
+    permute(values.y, order);
+    permute(values.z, order);
+}
+
+// Depth first order, which puts parents first and keeps every subtree in one piece.
+// Destroyed transforms are dropped, and children left without a parent become roots.
+static void sortTransforms() {
+    size_t count = parents.size();
+    std::vector<int> firstChild(count, -1), nextSibling(count, -1);
+    std::vector<int> roots;
+    for (int i = count - 1; i >= 0; i--) {
+        if (idAtIndex[i] < 0) {
+            continue;
+        }
+        if (parents[i] < 0 || idAtIndex[parents[i]] < 0) {
+            roots.push_back(i);
+        } else {
+            nextSibling[i] = firstChild[parents[i]];
+            firstChild[parents[i]] = i;
+        }
+    }
+
+    std::vector<int> order;
+    order.reserve(count - destroyedCount);
+    std::vector<int> stack(roots.begin(), roots.end()); // Reversed above, so they come off the stack in order
+    std::vector<int> children;
+    while (!stack.empty()) {
+        int index = stack.back();
+        stack.pop_back();
+        order.push_back(index);
+        children.clear();
+        for (int child = firstChild[index]; child >= 0; child = nextSibling[child]) {
+            children.push_back(child);
+        }
+        stack.insert(stack.end(), children.rbegin(), children.rend());
+    }
+
+    std::vector<int> newIndex(count, -1);
+    for (size_t i = 0; i < order.size(); i++) {
+        newIndex[order[i]] = i;
+    }
+    count = order.size();
+    permute(parents, order);
+    for (int &parent : parents) {
+        parent = parent < 0 ? -1 : newIndex[parent];
+    }
+    permute(positions, order);
+    permute(rotations, order);
+    permute(scales, order);
+    permute(referencePoints, order);
+    permute(previousPositions, order);
+    permute(previousRotations, order);
+    permute(previousScales, order);
+    permute(blendedPositions, order);
+    permute(blendedRotations, order);
+    permute(blendedScales, order);
+    permute(motions, order);
+    permute(localMatrices, order);
+    permute(worldMatrices, order);
+    permute(localNormalMatrices, order);
+    permute(worldNormalMatrices, order);
+    permute(isDirty, order);
+    permute(idAtIndex, order);
+    subtreeEnds.resize(count);
+    destroyedCount = 0;
+    for (size_t i = 0; i < count; i++) {
+        indexOfID[idAtIndex[i]] = i;
+        subtreeEnds[i] = i + 1;
+    }
+    // Children come after their parent, so going backwards every subtree is finished before its parent needs it
+    for (int i = count - 1; i >= 0; i--) {
+        if (parents[i] >= 0) {
+            subtreeEnds[parents[i]] = std::max(subtreeEnds[parents[i]], subtreeEnds[i]);
+        }
+    }
+    needsSorting = false;
+}
+
+// Updates from the given local positions, rotations and scales, either the current ones or the blended ones
+static void updateWorld(const Vec3Array &fromPositions, const Vec3Array &fromRotations, const Vec3Array &fromScales) {
+    changedIDs.clear();
+    if (dirtyIDs.empty()) {
+        return;
+    }
+    if (needsSorting) {
+        sortTransforms();
+    }
+
+    std::vector<int> dirtyIndices;
+    dirtyIndices.reserve(dirtyIDs.size());
+    for (TransformID id : dirtyIDs) {
+        if (indexOfID[id] >= 0) { // Not destroyed since
+            dirtyIndices.push_back(indexOfID[id]);
+        }
+    }
+    dirtyIDs.clear();
+    std::sort(dirtyIndices.begin(), dirtyIndices.end());
+    // An ID that was destroyed and reused can be listed twice
+    dirtyIndices.erase(std::unique(dirtyIndices.begin(), dirtyIndices.end()), dirtyIndices.end());
+
+    // The local matrices only depend on their own transform, so they are all done up front in one batch
+    // (Sorting may have moved the arrays, so their pointers are only taken now)
+    TransformComponents components = {
+        {fromPositions.x.data(), fromPositions.y.data(), fromPositions.z.data()},
+        {fromRotations.x.data(), fromRotations.y.data(), fromRotations.z.data()},
+        {fromScales.x.data(), fromScales.y.data(), fromScales.z.data()},
+        {referencePoints.x.data(), referencePoints.y.data(), referencePoints.z.data()}
+    };
+    composeTransforms(components, dirtyIndices.data(), dirtyIndices.size(), localMatrices.data(), localNormalMatrices.data());
+    for (int dirty : dirtyIndices) {
+        isDirty[dirty] = false;
+    }
+
+    // Everything below a dirty transform moves with it. Parents come first, so their world matrix
+    // is always done by the time a child needs it.
+    int end = 0;
+    for (int dirty : dirtyIndices) {
+        if (dirty < end) {
+            continue; // Inside a subtree that was just updated
+        }
+        end = subtreeEnds[dirty];
+        for (int i = dirty; i < end; i++) {
+            if (idAtIndex[i] < 0) {
+                continue; // Destroyed, along with everything below it
+            }
+            if (parents[i] < 0) {
+                worldMatrices[i] = localMatrices[i];
+                worldNormalMatrices[i] = localNormalMatrices[i];
+            } else {
+                worldMatrices[i] = worldMatrices[parents[i]] * localMatrices[i];
+                worldNormalMatrices[i] = worldNormalMatrices[parents[i]] * localNormalMatrices[i];
+            }
+            changedIDs.push_back(idAtIndex[i]);
+        }
+    }
+
+    for (const Listener &listener : listeners) {
+        listener.callback(changedIDs, listener.userData);
+    }
+}
+
+void updateWorldTransforms() {
+    updateWorld(positions, rotations, scales);
+}
+
+void beginTransformTick() {
+    for (TransformID id : movingIDs) {
+        int index = indexOfID[id];
+        if (index < 0) {
+            continue; // Destroyed
+        }
+        glm::vec3 position = positions.get(index), rotation = rotations.get(index), scale = scales.get(index);
+        previousPositions.set(index, position);
+        previousRotations.set(index, rotation);
+        previousScales.set(index, scale);
+        // Drawn where it is from now on, unless it moves again
+        blendedPositions.set(index, position);
+        blendedRotations.set(index, rotation);
+        blendedScales.set(index, scale);
+        motions[index] = STILL;
+        markDirty(index);
+    }
+    movingIDs.clear();
+}
+
+void interpolateWorldTransforms(float alpha) {
+    for (TransformID id : movingIDs) {
+        int index = indexOfID[id];
+        if (index < 0) {
+            continue;
+        }
+        if (motions[index] == CREATED) {
+            previousPositions.set(index, positions.get(index));
+            previousRotations.set(index, rotations.get(index));
+            previousScales.set(index, scales.get(index));
+        }
+        blendedPositions.set(index, glm::mix(previousPositions.get(index), positions.get(index), alpha));
+        blendedRotations.set(index, glm::mix(previousRotations.get(index), rotations.get(index), alpha));
+        blendedScales.set(index, glm::mix(previousScales.get(index), scales.get(index), alpha));
+        markDirty(index);
+    }
+    updateWorld(blendedPositions, blendedRotations, blendedScales);
+}
+
+const std::vector<TransformID>& changedTransforms() {
+    return changedIDs;
+}
+
+void addTransformListener(TransformListener callback, void* userData) {
+    listeners.push_back(Listener{callback, userData});
+}
+
+void removeTransformListener(TransformListener callback, void* userData) {
+    listeners.erase(std::remove_if(listeners.begin(), listeners.end(), [&](const Listener &listener) {
+        return listener.callback == callback && listener.userData == userData;
+    }), listeners.end());
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <cstddef>
+#include <vector>
+
+// The local transforms and world matrices of every scene node. They are kept as arrays, one per field, ordered
+// so a parent always comes before its children. Updating the world matrices is then a single pass through
+// memory, instead of a walk over pointers to nodes spread around the heap.
+// Only transforms that changed since the last update, and everything below them, are recomputed.
+
+// Stays the same while the arrays are reordered, unlike the position of a transform in them
+typedef int TransformID;
+
+// A new transform has no parent, sits at the origin and has a scale of 1
+TransformID createTransform();
+
+// Makes room for this many transforms in all, for loading a whole scene at once
+void reserveTransforms(size_t count);
+
+// The ID can be handed out again by a later createTransform(). Children of a destroyed transform should be
+// destroyed too or given a new parent, otherwise they keep following its last world matrix until the arrays
+// are next compacted, and then become roots.
+void destroyTransform(TransformID id);
+
+// -1 makes it a root again. The arrays are sorted again on the next update, which touches every transform,
+// so this is meant for building the scene rather than for every frame.
+void setTransformParent(TransformID id, TransformID parent);
+TransformID transformParent(TransformID id);
+
+// The local transform is position * referencePoint * rotation (y, then x, then z) * scale * -referencePoint,
+// so rotation and scale happen around the reference point. Setting a value marks the transform dirty,
+// unless it is the value it already had.
+void setLocalPosition(TransformID id, glm::vec3 position);
+void setLocalRotation(TransformID id, glm::vec3 rotation);
+void setLocalScale(TransformID id, glm::vec3 scale);
+void setReferencePoint(TransformID id, glm::vec3 referencePoint);
+glm::vec3 localPosition(TransformID id);
+glm::vec3 localRotation(TransformID id);
+glm::vec3 localScale(TransformID id);
+glm::vec3 referencePoint(TransformID id);
+
+// As of the last updateWorldTransforms()
+const glm::mat4& worldMatrix(TransformID id);
+// The inverse transpose of the world matrix's top left 3x3, for transforming normals
+const glm::mat3& normalMatrix(TransformID id);
+
+// Recomputes the world matrices of dirty transforms and their descendants, then tells the listeners which changed
+void updateWorldTransforms();
+
+// For a simulation that runs in fixed ticks while frames are drawn at their own rate. Call at the start of every
+// tick: the local transforms as they are then become the previous state of the tick.
+void beginTransformTick();
+// Used instead of updateWorldTransforms() before drawing. The world matrices of transforms that moved in the
+// last tick are made from their position, rotation and scale blended between the previous state and the current
+// one, alpha (0 to 1) of the way. Rotations are blended as angles, so they should not jump by a full turn in a tick.
+void interpolateWorldTransforms(float alpha);
+
+// The transforms whose world matrix changed in the last updateWorldTransforms()
+const std::vector<TransformID>& changedTransforms();
+
+// For things that keep their own copy of where nodes are, like culling structures or cached reflections
+typedef void (*TransformListener)(const std::vector<TransformID> &changed, void* userData);
+void addTransformListener(TransformListener callback, void* userData = nullptr);
+void removeTransformListener(TransformListener callback, void* userData = nullptr);
+
+// Transforms that have not been destroyed
+size_t transformCount();
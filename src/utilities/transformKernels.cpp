@@ -0,0 +1,175 @@
+#include "transformKernels.h"
+#include <cmath>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define TRANSFORM_KERNELS_SSE2
+#include <emmintrin.h>
+#endif
+
+static inline float inverseScale(float scale) {
+    return scale != 0 ? 1.0f / scale : 0.0f;
+}
+
+static void composeTransform(const TransformComponents &c, int i, glm::mat4 &matrix, glm::mat3 &normalMatrix) {
+    float sx = std::sin(c.rotation[0][i]), cx = std::cos(c.rotation[0][i]);
+    float sy = std::sin(c.rotation[1][i]), cy = std::cos(c.rotation[1][i]);
+    float sz = std::sin(c.rotation[2][i]), cz = std::cos(c.rotation[2][i]);
+
+    // The columns of rotate(y) * rotate(x) * rotate(z)
+    glm::vec3 rotation[3] = {
+        glm::vec3(cy * cz + sy * sx * sz, cx * sz, -sy * cz + cy * sx * sz),
+        glm::vec3(-cy * sz + sy * sx * cz, cx * cz, sy * sz + cy * sx * cz),
+        glm::vec3(sy * cx, -sx, cy * cx)
+    };
+
+    glm::vec3 translation(c.position[0][i] + c.referencePoint[0][i],
+                          c.position[1][i] + c.referencePoint[1][i],
+                          c.position[2][i] + c.referencePoint[2][i]);
+    for (int j = 0; j < 3; j++) {
+        float scale = c.scale[j][i];
+        glm::vec3 column = rotation[j] * scale;
+        matrix[j] = glm::vec4(column, 0);
+        normalMatrix[j] = rotation[j] * inverseScale(scale);
+        translation -= column * c.referencePoint[j][i];
+    }
+    matrix[3] = glm::vec4(translation, 1);
+}
+
+void composeTransformsScalar(const TransformComponents &components, const int* indices, size_t count,
+                             glm::mat4* matrices, glm::mat3* normalMatrices) {
+    for (size_t k = 0; k < count; k++) {
+        int i = indices ? indices[k] : k;
+        composeTransform(components, i, matrices[i], normalMatrices[i]);
+    }
+}
+
+#if defined(TRANSFORM_KERNELS_SSE2)
+
+// Sine and cosine of four angles, using the same range reduction and polynomials as the Cephes library.
+// Good to about one unit in the last place for angles up to a few thousand radians.
+static inline void sinCos(__m128 x, __m128 &sine, __m128 &cosine) {
+    const __m128 signMask = _mm_castsi128_ps(_mm_set1_epi32((int)0x80000000));
+    __m128 sineSign = _mm_and_ps(x, signMask);
+    x = _mm_andnot_ps(signMask, x);
+
+    // Which octant x is in, rounded up to even
+    __m128i octant = _mm_cvttps_epi32(_mm_mul_ps(x, _mm_set1_ps(1.27323954473516f)));
+    octant = _mm_and_si128(_mm_add_epi32(octant, _mm_set1_epi32(1)), _mm_set1_epi32(~1));
+    __m128 y = _mm_cvtepi32_ps(octant);
+
+    __m128 swapSine = _mm_castsi128_ps(_mm_slli_epi32(_mm_and_si128(octant, _mm_set1_epi32(4)), 29));
+    __m128 cosineSign = _mm_castsi128_ps(_mm_slli_epi32(_mm_andnot_si128(_mm_sub_epi32(octant, _mm_set1_epi32(2)), _mm_set1_epi32(4)), 29));
+    __m128 usePolynomialSwap = _mm_castsi128_ps(_mm_cmpeq_epi32(_mm_and_si128(octant, _mm_set1_epi32(2)), _mm_setzero_si128()));
+    sineSign = _mm_xor_ps(sineSign, swapSine);
+
+    // x minus the octant times pi/4, in three parts to keep the precision
+    x = _mm_add_ps(x, _mm_mul_ps(y, _mm_set1_ps(-0.78515625f)));
+    x = _mm_add_ps(x, _mm_mul_ps(y, _mm_set1_ps(-2.4187564849853515625e-4f)));
+    x = _mm_add_ps(x, _mm_mul_ps(y, _mm_set1_ps(-3.77489497744594108e-8f)));
+    __m128 z = _mm_mul_ps(x, x);
+
+    __m128 cosinePolynomial = _mm_set1_ps(2.443315711809948e-5f);
+    cosinePolynomial = _mm_add_ps(_mm_mul_ps(cosinePolynomial, z), _mm_set1_ps(-1.388731625493765e-3f));
+    cosinePolynomial = _mm_add_ps(_mm_mul_ps(cosinePolynomial, z), _mm_set1_ps(4.166664568298827e-2f));
+    cosinePolynomial = _mm_mul_ps(_mm_mul_ps(cosinePolynomial, z), z);
+    cosinePolynomial = _mm_sub_ps(cosinePolynomial, _mm_mul_ps(z, _mm_set1_ps(0.5f)));
+    cosinePolynomial = _mm_add_ps(cosinePolynomial, _mm_set1_ps(1.0f));
+
+    __m128 sinePolynomial = _mm_set1_ps(-1.9515295891e-4f);
+    sinePolynomial = _mm_add_ps(_mm_mul_ps(sinePolynomial, z), _mm_set1_ps(8.3321608736e-3f));
+    sinePolynomial = _mm_add_ps(_mm_mul_ps(sinePolynomial, z), _mm_set1_ps(-1.6666654611e-1f));
+    sinePolynomial = _mm_add_ps(_mm_mul_ps(_mm_mul_ps(sinePolynomial, z), x), x);
+
+    // In every other pair of octants sine and cosine trade polynomials
+    sine = _mm_or_ps(_mm_and_ps(usePolynomialSwap, sinePolynomial), _mm_andnot_ps(usePolynomialSwap, cosinePolynomial));
+    cosine = _mm_or_ps(_mm_and_ps(usePolynomialSwap, cosinePolynomial), _mm_andnot_ps(usePolynomialSwap, sinePolynomial));
+    sine = _mm_xor_ps(sine, sineSign);
+    cosine = _mm_xor_ps(cosine, cosineSign);
+}
+
+static inline __m128 load4(const float* values, const int* indices, size_t k) {
+    if (indices) {
+        return _mm_setr_ps(values[indices[k]], values[indices[k + 1]], values[indices[k + 2]], values[indices[k + 3]]);
+    }
+    return _mm_loadu_ps(values + k);
+}
+
+// Stores the x, y and z of four vectors (one per lane) as one xyz(w) column of each of the four matrices
+static inline void storeColumns(__m128 x, __m128 y, __m128 z, __m128 w, float* const targets[4], int column, int stride, bool withW) {
+    _MM_TRANSPOSE4_PS(x, y, z, w);
+    __m128 columns[4] = {x, y, z, w};
+    for (int lane = 0; lane < 4; lane++) {
+        float* target = targets[lane] + column * stride;
+        if (withW) {
+            _mm_storeu_ps(target, columns[lane]);
+        } else {
+            // A mat3 column is only three floats, so the fourth would land on the next column or matrix
+            _mm_storel_pi((__m64*)target, columns[lane]);
+            _mm_store_ss(target + 2, _mm_movehl_ps(columns[lane], columns[lane]));
+        }
+    }
+}
+
+void composeTransforms(const TransformComponents &components, const int* indices, size_t count,
+                       glm::mat4* matrices, glm::mat3* normalMatrices) {
+    const TransformComponents &c = components;
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 one = _mm_set1_ps(1.0f);
+    size_t k = 0;
+    for (; k + 4 <= count; k += 4) {
+        __m128 sx, cx, sy, cy, sz, cz;
+        sinCos(load4(c.rotation[0], indices, k), sx, cx);
+        sinCos(load4(c.rotation[1], indices, k), sy, cy);
+        sinCos(load4(c.rotation[2], indices, k), sz, cz);
+
+        // Rotation columns, as in composeTransform()
+        __m128 sxsz = _mm_mul_ps(sx, sz), sxcz = _mm_mul_ps(sx, cz);
+        __m128 rotation[3][3] = {
+            {_mm_add_ps(_mm_mul_ps(cy, cz), _mm_mul_ps(sy, sxsz)), _mm_mul_ps(cx, sz), _mm_sub_ps(_mm_mul_ps(cy, sxsz), _mm_mul_ps(sy, cz))},
+            {_mm_sub_ps(_mm_mul_ps(sy, sxcz), _mm_mul_ps(cy, sz)), _mm_mul_ps(cx, cz), _mm_add_ps(_mm_mul_ps(sy, sz), _mm_mul_ps(cy, sxcz))},
+            {_mm_mul_ps(sy, cx), _mm_sub_ps(zero, sx), _mm_mul_ps(cy, cx)}
+        };
+
+        __m128 reference[3], translation[3];
+        for (int axis = 0; axis < 3; axis++) {
+            reference[axis] = load4(c.referencePoint[axis], indices, k);
+            translation[axis] = _mm_add_ps(load4(c.position[axis], indices, k), reference[axis]);
+        }
+
+        float* matrixTargets[4];
+        float* normalTargets[4];
+        for (int lane = 0; lane < 4; lane++) {
+            int i = indices ? indices[k + lane] : k + lane;
+            matrixTargets[lane] = &matrices[i][0][0];
+            normalTargets[lane] = &normalMatrices[i][0][0];
+        }
+
+        for (int j = 0; j < 3; j++) {
+            __m128 scale = load4(c.scale[j], indices, k);
+            __m128 nonZero = _mm_cmpneq_ps(scale, zero);
+            __m128 inverse = _mm_and_ps(nonZero, _mm_div_ps(one, scale));
+            __m128 column[3];
+            for (int row = 0; row < 3; row++) {
+                column[row] = _mm_mul_ps(rotation[j][row], scale);
+                translation[row] = _mm_sub_ps(translation[row], _mm_mul_ps(column[row], reference[j]));
+            }
+            storeColumns(column[0], column[1], column[2], zero, matrixTargets, j, 4, true);
+            storeColumns(_mm_mul_ps(rotation[j][0], inverse), _mm_mul_ps(rotation[j][1], inverse),
+                         _mm_mul_ps(rotation[j][2], inverse), zero, normalTargets, j, 3, false);
+        }
+        storeColumns(translation[0], translation[1], translation[2], one, matrixTargets, 3, 4, true);
+    }
+    for (; k < count; k++) {
+        int i = indices ? indices[k] : k;
+        composeTransform(components, i, matrices[i], normalMatrices[i]);
+    }
+}
+
+#else
+
+void composeTransforms(const TransformComponents &components, const int* indices, size_t count,
+                       glm::mat4* matrices, glm::mat3* normalMatrices) {
+    composeTransformsScalar(components, indices, count, matrices, normalMatrices);
+}
+
+#endif
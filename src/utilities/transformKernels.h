@@ -0,0 +1,28 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <cstddef>
+
+// Builds local matrices straight from position, rotation, scale and reference point, instead of multiplying
+// seven 4x4 matrices together. The result is the same as
+//     translate(position) * translate(referencePoint) * rotate(rotation.y, Y) * rotate(rotation.x, X)
+//         * rotate(rotation.z, Z) * scale(scale) * translate(-referencePoint)
+// and the normal matrix (the inverse transpose of the top left 3x3) comes out as rotation * (1 / scale),
+// with no inverse needed.
+
+// The transforms as one array per component
+struct TransformComponents {
+    const float* position[3];
+    const float* rotation[3];
+    const float* scale[3];
+    const float* referencePoint[3];
+};
+
+// Writes transform indices[i] to matrices[indices[i]] and normalMatrices[indices[i]], for i up to count.
+// With indices null, transforms 0 to count are done. Runs four transforms at a time with SSE2.
+void composeTransforms(const TransformComponents &components, const int* indices, size_t count,
+                       glm::mat4* matrices, glm::mat3* normalMatrices);
+
+// The same one transform at a time, for checking and timing the vector version
+void composeTransformsScalar(const TransformComponents &components, const int* indices, size_t count,
+                             glm::mat4* matrices, glm::mat3* normalMatrices);
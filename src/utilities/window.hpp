@@ -16,4 +16,18 @@ const int         windowSamples   = 4;
 struct CommandLineOptions {
     bool enableMusic;
     bool enableAutoplay;
+    std::string textureCompression;
+    std::string textureBinding;
+    std::string scene;
+    std::string profileTrace;
+    unsigned int tickRate;
+    bool lowLatency;
+    unsigned int framesInFlight;
+    bool justInTime;
+    bool singleThreaded;
+    bool gpuCulling;
+    bool benchmark;
+    unsigned int benchmarkWarmupFrames;
+    unsigned int benchmarkFrames;
+    std::string benchmarkReport;
 };
\ No newline at end of file